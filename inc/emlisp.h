@@ -1,11 +1,14 @@
 #pragma once
 #include <cassert>
+#include <chrono>
 #include <cstdint>
+#include <cstring>
 #include <memory>
 #include <optional>
 #include <set>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -20,6 +23,11 @@ enum class value_type {
     float_t = 0x3,
     sym     = 0x4,
     str     = 0x5,
+    vector  = 0x6,
+    array   = 0x9,
+    vec     = 0xa,
+    hash    = 0xb,
+    _object = 0xc,
     _extern = 0xd,
     closure = 0xe,
     cons    = 0xf
@@ -33,6 +41,85 @@ constexpr value FALSE = value(001);
 
 inline value_type type_of(value v) { return value_type(v & 0xf); }
 
+/// values of these types are pointers to something allocated in the heap: `str`, `vector` and
+/// every tag from `array` up to `cons`, one bit per tag
+inline bool is_heap_type(value_type ty) { return (0xfe60u >> (unsigned)ty) & 1; }
+
+/// low nibble of the header word that starts every `_object` in the heap, no value has this tag
+constexpr uint64_t HEADER_TAG = 0x7;
+/// marks a global that has no definition, never a valid value
+constexpr value UNBOUND = HEADER_TAG;
+/// during a collection, replaces the first word of a copied object with its new address
+constexpr uint64_t FORWARD_TAG = 0x8;
+
+enum class object_kind : uint8_t {
+    /// environment frame for compiled code: parent frame followed by the local slots
+    frame = 0x0,
+    /// variables captured by a tree walker closure, as pairs of name and value
+    captures = 0x1,
+    /// holds a single captured variable that is assigned with `set!` so all closures share it
+    box = 0x2,
+    /// an `owned_extern_header` followed by the C++ value, referenced from `_extern` cells
+    owned_extern = 0x3,
+    /// the bytes of a string, the payload size is its length
+    string = 0x4,
+    /// a `std::shared_ptr<function>` that closures refer to, the template is released when the
+    /// object is garbage
+    function = 0x5,
+    /// the elements of a vector, the payload size is its length in words
+    vector = 0x6,
+    /// the packed numbers of an `array`, the payload size is its length times the element size
+    f32_array = 0x7,
+    f64_array = 0x8,
+    i64_array = 0x9,
+    /// the floats of a `vec` of 2, 3 or 4 elements, always four of them with the unused ones zero
+    /// so that arithmetic works on whole SIMD registers
+    vec2 = 0xa,
+    vec3 = 0xb,
+    vec4 = 0xc,
+    /// a hash table: its size, its flags, how many of its keys are hashed by their address, the
+    /// collections it was last hashed after, and a vector of key and value pairs, see `hash_word`
+    hash_table = 0xd
+};
+
+/// the words of the payload of a `hash_table`, all of them ints except `entries`
+enum class hash_word : size_t { count, flags, address_keys, moves, full_moves, entries, size };
+
+/// make a hash table that was copied to new addresses with the rest of a heap hash its keys again
+/// before it is used, `obj` is its header
+void mark_hash_table_moved(value* obj);
+/// hash the keys of a table that was copied into a base for good, where nothing moves again
+void freeze_hash_table(value* obj);
+
+/// objects of these kinds hold bytes rather than values, so collections copy them without tracing
+inline bool holds_bytes(object_kind kind) {
+    return kind == object_kind::string || kind == object_kind::owned_extern
+           || kind == object_kind::f32_array || kind == object_kind::f64_array
+           || kind == object_kind::i64_array || kind == object_kind::vec2
+           || kind == object_kind::vec3 || kind == object_kind::vec4;
+}
+
+inline value make_header(object_kind kind, size_t payload_bytes) {
+    return (payload_bytes << 16) | ((uint64_t)kind << 8) | HEADER_TAG;
+}
+
+inline object_kind header_kind(value header) { return object_kind((header >> 8) & 0xff); }
+
+inline size_t header_payload_bytes(value header) { return header >> 16; }
+
+/// total size of an object in the heap including its header, objects are 8 byte aligned
+inline size_t object_size(value header) {
+    size_t payload = (header_payload_bytes(header) + sizeof(value) - 1) & ~(sizeof(value) - 1);
+    return sizeof(value) + payload;
+}
+
+/// the words following the header of an `_object`
+inline value* object_data(value obj) { return (value*)(obj >> 4) + 1; }
+
+inline bool is_object(value v, object_kind kind) {
+    return type_of(v) == value_type::_object && header_kind(*(value*)(v >> 4)) == kind;
+}
+
 struct type_mismatch_error : public std::runtime_error {
     value_type expected;
     value_type actual;
@@ -64,6 +151,53 @@ inline value nth(value list, int n) {
     return nth(second(list), n - 1);
 }
 
+inline size_t vector_length(value v) {
+    check_type(v, value_type::vector);
+    return header_payload_bytes(*(value*)(v >> 4)) / sizeof(value);
+}
+
+/// store into vectors with `runtime::vector_set`, which keeps the write barrier
+inline value vector_ref(value v, size_t i) {
+    if(i >= vector_length(v)) throw std::out_of_range("vector index out of range");
+    return object_data(v)[i];
+}
+
+inline object_kind array_kind(value v) {
+    check_type(v, value_type::array);
+    return header_kind(*(value*)(v >> 4));
+}
+
+inline size_t array_element_size(object_kind kind) {
+    return kind == object_kind::f32_array ? 4 : 8;
+}
+
+inline size_t array_length(value v) {
+    auto kind = array_kind(v);
+    return header_payload_bytes(*(value*)(v >> 4)) / array_element_size(kind);
+}
+
+/// the elements of an array, `T` has to be the element type of its kind
+template<typename T>
+inline T* array_data(value v) {
+    return (T*)object_data(v);
+}
+
+inline size_t vec_dim(value v) {
+    check_type(v, value_type::vec);
+    return (size_t)header_kind(*(value*)(v >> 4)) - (size_t)object_kind::vec2 + 2;
+}
+
+/// the four floats of a vec, vecs can't be changed once they are made
+inline const float* vec_data(value v) {
+    check_type(v, value_type::vec);
+    return (const float*)object_data(v);
+}
+
+inline size_t hash_count(value h) {
+    check_type(h, value_type::hash);
+    return object_data(h)[(size_t)hash_word::count] >> 4;
+}
+
 inline bool to_bool(value v) {
     check_type(v, value_type::bool_t);
     return v != FALSE;
@@ -71,7 +205,7 @@ inline bool to_bool(value v) {
 
 inline int64_t to_int(value v) {
     check_type(v, value_type::int_t);
-    return v >> 4;
+    return (int64_t)v >> 4;
 }
 
 inline float to_float(value v) {
@@ -80,28 +214,137 @@ inline float to_float(value v) {
     return *((float*)&x);
 }
 
+struct function;
+
+/// where the tree walker keeps a variable of a function body during a call
+struct tree_slot {
+    /// an argument by its position, or else a captured variable by its pair in the captures
+    bool     argument;
+    uint32_t index;
+};
+
+/// bytecode compiled from a function body or a top level form, see `src/bytecode.h`
+struct code {
+    std::vector<uint32_t>                  instrs;
+    std::vector<value>                     consts;
+    std::vector<std::shared_ptr<function>> children;
+    /// the function objects of `children` that closures made by this code refer to, made once the
+    /// code is compiled
+    std::vector<value> child_objects;
+    /// number of slots in the environment frame for an activation, including the arguments
+    uint32_t frame_size = 0;
+    /// the form this code was compiled from, reported in error traces
+    value source;
+};
+
 struct function {
-    std::vector<value> arguments;
-    value              body;
-    bool               varadic;
+    std::vector<value>    arguments;
+    value                 body;
+    bool                  varadic;
+    std::shared_ptr<code> compiled;
+    /// the names used by the body that a tree walker closure has to capture, found when the first
+    /// closure is made, with the name of the function that was taken to be bound at the time
+    std::optional<std::vector<value>> free_variables;
+    value                             free_variables_self = NIL;
+    /// the names the body assigns with `set!`, shared by the scopes of all calls, found when the
+    /// first call needs them
+    std::shared_ptr<const std::unordered_set<value>> assigned_variables;
+    /// the slots of the arguments, and of the `capture_count` variables the first tree walker
+    /// closure captured. Later closures capture those names at the same positions, and any others
+    /// after them
+    std::unordered_map<value, tree_slot> tree_slots;
+    uint32_t                             capture_count = 0;
     function(value arg_list, value body, value sym_ellipsis);
+    /// gives the arguments their slots, once they are all in `arguments`
+    void slot_arguments();
 };
 
-struct frame {
-    std::unordered_map<value, value> data;
-
-    frame() = default;
+/// the template held by an `object_kind::function` object
+inline function* object_function(value obj) {
+    return ((std::shared_ptr<function>*)object_data(obj))->get();
+}
 
-    frame(std::unordered_map<value, value>& data) : data(std::move(data)) {}
+/// the template of a closure made by either evaluator
+inline function* closure_function(value f) { return object_function(*(value*)(f >> 4)); }
+
+/// selects how `runtime::eval` evaluates forms. Bytecode is the default. Lexical addressing, where
+/// locals are resolved to frame slots once when a form is compiled, only exists there
+enum class eval_mode {
+    /// walk the expanded cons cells directly. Kept as the reference evaluator: the arguments and
+    /// captures of a call are found by slot, but `let` scopes are still looked up by name
+    tree_walk,
+    /// compile each form to bytecode and run it on the VM
+    bytecode
+};
 
-    value get(value name);
-    void  set(value name, value val);
+/// a local scope of the tree walker
+struct tree_scope {
+    /// for the scope of a call, the function whose arguments are in `args` by position
+    function*          fn = nullptr;
+    std::vector<value> args;
+    /// variables bound by a `let` or defined in the scope, by name
+    std::unordered_map<value, value> vars;
+    /// the form the variables are bound over
+    value form;
+    /// true for the scope of a closure's arguments, where name lookup continues in the captures
+    /// of the closure and then the globals rather than in the scope of the caller
+    bool  boundary = false;
+    value captured = NIL;
+    /// the names assigned with `set!` in `form`, which closures box when they capture them. Found
+    /// when a closure first captures from the scope, or taken from the scope around it, whose form
+    /// holds this one
+    std::shared_ptr<const std::unordered_set<value>> assigned;
+
+    /// the scope of a `let` over `form`
+    explicit tree_scope(value form) : form(form) {}
+    /// the scope of a call of `fn`, which continues in `captured`
+    tree_scope(function* fn, std::vector<value> args, value captured)
+        : fn(fn), args(std::move(args)), form(fn->body), boundary(true), captured(captured) {}
 };
 
 using extern_func_t = value (*)(class runtime*, value, void*);
 
 struct heap_info {
+    /// bytes in use after the collection in the nursery, where new values are allocated, and in
+    /// the old space that values surviving a collection are promoted to
     size_t new_size, old_size;
+    /// bytes of the nursery that survived the collection
+    size_t promoted;
+    /// bytes of program text in the code space, which collections never look at
+    size_t code_size;
+    /// true while an incremental collection started by `collect_garbage_step` is unfinished
+    bool collecting;
+    /// bytes the incremental collection has copied out of the old space so far, and how many of
+    /// those it has scanned, it can finish once the scan catches up
+    size_t copied, scanned;
+};
+
+/// how the heap is resized when an allocation finds the nursery full and collects garbage
+struct heap_policy {
+    /// the nursery doubles when more than this fraction of it survives a collection
+    double grow_threshold = 0.5;
+    /// and halves, but never below the size the runtime was created with, when less survives
+    double shrink_threshold = 0.05;
+    /// a full collection gives the old space room for this many times what survived
+    double old_space_growth = 2.0;
+    /// allocations that would need the nursery and old space to grow past this many bytes throw
+    /// instead, 0 for no limit
+    size_t max_heap_size = 0;
+};
+
+/// keeps the values in C++ variables up to date while it is in scope. Any allocation can collect
+/// garbage, which moves values, so a variable that is still needed after something allocates must
+/// be rooted, or the value kept in a `value_handle`
+class root_guard {
+    class runtime* rt;
+    size_t         count;
+
+  public:
+    template<typename... Values>
+    root_guard(class runtime* rt, Values&... vs);
+    root_guard(const root_guard&)            = delete;
+    root_guard& operator=(const root_guard&) = delete;
+    ~root_guard();
 };
 
 using owned_extern_deconstructor_t    = void (*)(void*);
@@ -113,9 +356,54 @@ struct owned_extern_header {
     owned_extern_move_constructor_t move;
 };
 
+/// the frozen state of a runtime that other runtimes are built on and share, made by
+/// `runtime::make_base`. Nothing in a base changes once it is made, so runtimes on different
+/// threads can share one
+struct runtime_base {
+    std::vector<std::string> symbols;
+    std::vector<size_t>      symbol_hashes;
+    std::vector<uint32_t>    symbol_table;
+    /// the old space of the runtime followed by its code space, mapped read only where possible
+    uint8_t* data = nullptr;
+    size_t   size = 0;
+    /// the values of the globals, indexed by symbol, and the macros
+    std::vector<value>                                   globals;
+    std::unordered_map<value, std::shared_ptr<function>> macros;
+    /// the function objects in `data`, which own the templates of the base
+    std::vector<value*> function_objects;
+    /// the templates and their code, which never refer to anything outside the base
+    std::unordered_set<const void*> templates;
+
+    inline bool contains(const void* p) const { return p >= data && p < data + size; }
+
+    runtime_base()                               = default;
+    runtime_base(const runtime_base&)            = delete;
+    runtime_base& operator=(const runtime_base&) = delete;
+    ~runtime_base();
+};
+
 class runtime {
-    std::vector<std::string>               symbols;
-    std::vector<std::shared_ptr<function>> functions;
+    /// the base this runtime is built on, if any, whose symbols come before the ones made here
+    std::shared_ptr<const runtime_base> base;
+    size_t                              base_symbols = 0;
+    inline bool in_base(const void* p) const { return base != nullptr && base->contains(p); }
+
+    /// the name of each symbol made here by index less `base_symbols`, unique symbols share the
+    /// names they were made from
+    std::vector<std::string> symbols;
+    /// the hash of each symbol's name, so that the table can grow without hashing names again
+    std::vector<size_t> symbol_hashes;
+    /// open addressing table of interned symbol indices plus one, 0 marks an empty entry
+    std::vector<uint32_t> symbol_table;
+    size_t                interned_symbol_count = 0;
+    void                  index_symbol(uint32_t ix);
+
+    inline size_t symbol_count() const { return base_symbols + symbols.size(); }
+
+    inline const std::string& symbol_name(size_t ix) const {
+        return ix < base_symbols ? base->symbols[ix] : symbols[ix - base_symbols];
+    }
+
     value parse_value(std::string_view src, size_t& i, bool quasimode = false);
 
     value sym_quote, sym_lambda, sym_if, sym_set, sym_define, sym_let, sym_letseq, sym_letrec,
@@ -123,39 +411,243 @@ class runtime {
         sym_unique_sym, sym_macro_error;
 
     void define_intrinsics();
+    void define_array_functions();
+    void define_vec_functions();
+    void define_hash_functions();
+    /// `+ - * /` on a list of arguments that starts with a vec, `op` is the operator character
+    value vec_math(char op, value args);
     void define_std_functions();
 
     std::vector<value> reserved_syms;
 
     std::unordered_map<value, std::shared_ptr<function>> macros;
-    std::vector<std::unordered_map<value, value>>        scopes;
+    /// local scopes of the tree walker, innermost last
+    std::vector<tree_scope> scopes;
+    /// global bindings indexed by symbol, `UNBOUND` if the symbol has no definition
+    std::vector<value> globals;
 
     value look_up(value name);
+    value capture(value name);
+    value look_up_global(value name);
+    void  set_global(value name, value val);
+    void  define_local(value name, value val);
+    void  assign(value name, value val);
+    value unique_symbol(value name);
 
     void  compute_closure(value v, const std::set<value>& bound, std::set<value>& free);
-    value apply_quasiquote(value s);
-    value eval_list(value x);
+    void  collect_assigned(value form, std::unordered_set<value>& names);
+    const std::unordered_set<value>& assigned_names(tree_scope& sc);
+    /// the scope of the arguments of a call to the tree walker closure `fv`
+    tree_scope closure_scope(value fv, std::vector<value>& args);
+    /// where `name` is bound in `sc`, or nullptr. `captured` is set for variables the closure of
+    /// the scope captured, which can only be changed through their boxes
+    value*             scope_slot(tree_scope& sc, value name, bool& captured);
+    value              apply_quasiquote(value s);
+    value              tree_eval(value x);
+    value              eval_list(value x);
+    value              call_closure(value f, std::vector<value>& args);
+    std::vector<value> bind_arguments(function* fn, value arguments, bool evaluate);
+    value              enter_let(value kind, value arguments);
+    /// evaluate a special form up to its tail position and replace `x` with the form there
+    bool enter_tail_form(value& x);
+    value make_closure(value arg_list, value body, value self_name = NIL);
     std::optional<value> apply_builtin(value f, value arguments);
 
+    eval_mode mode;
+    /// values of the VM: the environment of each frame at its base, then its temporaries. The tree
+    /// walker and reader also keep values here while they build lists
+    std::vector<value> stack;
+    /// pop the values above `base` off the stack into a list, first value first
+    value list_from_stack(size_t base);
+    /// the same into a vector
+    value vector_from_stack(size_t base);
+    /// activation records of the compiled functions being run by the VM, innermost last
+    struct vm_frame {
+        code*  c;
+        size_t pc;
+        size_t base;
+        /// the function object that owns `c`, NIL for top level code
+        value fn;
+    };
+    std::vector<vm_frame> frames;
+    size_t                max_call_depth;
+
+    friend struct compiler;
+    std::shared_ptr<code> compile(value x);
+    void                  compile_function(function& fn, struct compiler* parent);
+    code&                 compiled_body(function* fn);
+    value                 alloc_env(size_t slots, value parent);
+    value                 alloc_object(object_kind kind, size_t words);
+    value                 make_box(value v);
+    void                  set_box(value box, value v);
+    value                 bind_env(
+        function* fn, value parent, const value* args, size_t argc, value reuse = NIL
+    );
+    value                 execute(code& c, value env, value fn = NIL);
+
+    /// the nursery: every value is bump allocated here, and the survivors are promoted to the
+    /// old space by the next collection, which leaves the nursery empty
     uint8_t* heap;
     uint8_t* heap_next;
     size_t   heap_size;
+    /// only full collections copy the old space, which they reallocate to fit what survives
+    uint8_t* old_space;
+    uint8_t* old_next;
+    size_t   old_capacity;
+    /// slots in the old space that have been written with references into the nursery since the
+    /// last collection, which are roots for the next minor collection
+    std::unordered_set<value*> remembered;
+
+    heap_policy policy;
+    size_t      min_heap_size;
+    /// variables registered by a `root_guard`, innermost last
+    std::vector<value*> c_roots;
+    friend class root_guard;
+
+    /// bump allocate `bytes` in the nursery, collecting garbage first if it is full. `roots` are
+    /// values the caller still needs afterwards
+    template<typename... Roots>
+    uint8_t* alloc(size_t bytes, Roots&... roots) {
+        bytes = (bytes + sizeof(value) - 1) & ~(sizeof(value) - 1);
+        if(bytes > (size_t)(heap + heap_size - heap_next)) {
+            root_guard g(this, roots...);
+            make_room(bytes);
+        }
+        auto* addr = heap_next;
+        heap_next += bytes;
+        return addr;
+    }
+
+    /// collect garbage, and resize the heap according to the policy, so `bytes` will fit
+    void make_room(size_t bytes);
+
+    inline bool in_nursery(const void* p) const { return p >= heap && p < heap + heap_size; }
+
+    inline bool in_old_space(const void* p) const {
+        return p >= old_space && p < old_space + old_capacity;
+    }
 
-    frame* alloc_frame();
+    /// chunks of memory holding interned code with their sizes, bump allocated from `code_next`
+    std::vector<std::pair<std::unique_ptr<uint8_t[]>, size_t>> code_chunks;
+    uint8_t*                                                   code_next  = nullptr;
+    uint8_t*                                                   code_limit = nullptr;
+    size_t                                                     code_size  = 0;
+    /// slots in the code space that refer to values in the heap, these are roots for every
+    /// collection
+    std::vector<value*> code_roots;
+    uint8_t*            code_alloc(size_t bytes);
+    bool                in_code_space(const void* p) const;
+    /// each chunk of the code space with the bytes of it that are in use
+    std::vector<std::pair<uint8_t*, size_t>> code_in_use() const;
+
+    /// must follow every store of `v` into `slot` inside a heap object
+    inline void write_barrier(value* slot, value v) {
+        if(in_nursery(slot)) return;
+        if(is_heap_type(type_of(v)) && in_nursery((void*)(v >> 4))) remembered.insert(slot);
+        // an incremental collection has to copy the slot again before it finishes
+        if(incremental != nullptr) mutation_log.push_back(slot);
+    }
+
+    /// the unfinished incremental collection, if there is one
+    struct incremental_gc* incremental = nullptr;
+    /// slots in the old space written while an incremental collection is running
+    std::vector<value*> mutation_log;
+    /// bytes that the next full collection leaves free in the old space beyond what it needs
+    size_t old_space_reserve = 0;
+    /// collections that moved values, and the ones among them that moved the old space, which
+    /// tell hash tables when keys hashed by their address have to be hashed again
+    size_t collections = 0, full_collections = 0;
+
+    /// the slot of `key` in the entries of `h`, or the free slot it would go in, and whether it is
+    /// hashed by its address
+    size_t hash_slot(value h, value key, bool& found, bool& by_address);
+    /// hash the keys of `h` again if a collection has moved any that are hashed by address
+    void hash_prepare(value h);
+    /// empty the entries of `h` and put `pairs` into them
+    void hash_fill(value h, const std::vector<std::pair<value, value>>& pairs);
+    /// the write barrier for the int words of `h`, which are stored without one
+    void hash_touch(value h);
+    /// returns the bytes promoted from the nursery
+    size_t              finish_incremental();
+    void                fill_heap_info(heap_info* res_info, size_t promoted);
+
+    /// call `f` on a reference to every value that the collector treats as a root
+    template<typename F>
+    void for_each_root(F&& f);
 
     friend struct gc_state;
+    friend struct incremental_gc;
 
     std::unordered_map<uint64_t, std::pair<value, uint64_t>> value_handles;
     uint64_t                                                 next_extern_value_handle;
 
     std::unordered_set<size_t> owned_externs;
+    /// the addresses of the function objects in the old space and of the ones made since the last
+    /// collection, so that their templates can be released. Minor collections only look at the
+    /// young ones
+    std::unordered_set<size_t> function_objects;
+    std::vector<size_t>        young_function_objects;
+    /// function objects made by `create_function` keyed by their bodies. The keys change as
+    /// collections move the bodies, so the index is rebuilt by full collections and by minor ones
+    /// after young objects were added to it
+    std::unordered_multimap<value, value> function_index;
+    bool                                  young_functions_indexed = false;
+    /// code that is compiled but still getting its function objects
+    std::vector<code*> compiling;
+
+    /// call `f` on a reference to every value held by a template or its compiled code
+    template<typename F>
+    void trace_function(function& fn, F&& f);
+    template<typename F>
+    void trace_code(code& c, F&& f);
+    /// after a collection, `moved` gives the new address of a function object or NIL if it died
+    template<typename F>
+    void rebuild_function_index(F&& moved);
+
+    template<typename T>
+    value make_extern_cell(value p) {
+        return (cons(p, (typeid(T).hash_code() << 4) | (value)value_type::int_t) & ~0xf)
+               | (value)value_type::_extern;
+    }
 
-    std::shared_ptr<function> create_function(value arg_list, value body);
+    /// the function object for a lambda with `arg_list` and `body`, evaluating the same form
+    /// again gives the same object
+    value create_function(value arg_list, value body);
+    value make_function_object(std::shared_ptr<function> fn);
+    /// make the function objects of every function nested in `c`
+    void make_child_objects(code& c);
 
-    void ser_value(std::ostream&, std::set<value>&, value);
+    void intern_special_forms();
+
+    /// a runtime with the settings and symbols of `from`, empty heaps and an old space of
+    /// `old_capacity` bytes, which `clone` fills in
+    runtime(const runtime& from, size_t old_capacity);
 
   public:
-    runtime(size_t heap_size = 1024 * 1024, bool load_std_lib = true);
+    runtime(
+        size_t    heap_size    = 1024 * 1024,
+        bool      load_std_lib = true,
+        eval_mode mode         = eval_mode::bytecode
+    );
+    /// a runtime built on `base`, which starts out with the symbols, globals and macros of the
+    /// base without evaluating anything. The values of the base are shared rather than copied, and
+    /// can't be changed, the runtime only allocates new values in its own heap
+    explicit runtime(
+        std::shared_ptr<const runtime_base> base,
+        size_t                              heap_size = 1024 * 1024,
+        eval_mode                           mode      = eval_mode::bytecode
+    );
+    runtime(const runtime&)            = delete;
+    runtime& operator=(const runtime&) = delete;
+    ~runtime();
+
+    inline eval_mode current_eval_mode() const { return mode; }
+
+    /// closures keep running on the evaluator that created them, and can be called from either
+    inline void set_eval_mode(eval_mode m) { mode = m; }
+
+    /// calls nested deeper than this in compiled code throw an error instead of using more memory
+    inline void set_max_call_depth(size_t depth) { max_call_depth = depth; }
 
     inline value from_bool(bool b) { return b ? 0x11 : 0x01; }
 
@@ -176,54 +668,184 @@ class runtime {
     std::vector<value> to_vec(value list);
 
     value cons(value fst = NIL, value snd = NIL);
+    /// store into a cons cell, mutating values through `first` and `second` directly bypasses the
+    /// write barrier that the collector relies on
+    void set_first(value cell, value v);
+    void set_second(value cell, value v);
+
+    /// a vector of `length` elements that are all `fill`, its elements are contiguous in the heap
+    value make_vector(size_t length, value fill = NIL);
+    void  vector_set(value vec, size_t i, value v);
+
+    /// an array of `length` zeros packed as one of the `*_array` kinds. Arrays convert their
+    /// elements to and from ints and floats when they are read and stored one at a time, and
+    /// arithmetic on whole arrays runs with SIMD instructions where the target has them
+    value make_array(object_kind kind, size_t length);
+    value array_ref(value arr, size_t i);
+    void  array_set(value arr, size_t i, value v);
+
+    /// a hash table whose keys compare with `eq?`, or with `equal?` if `equal` is set, that has
+    /// room for `capacity` entries before it grows. Symbols and other immediates are hashed by
+    /// their bits, strings and vecs by their contents and, for `equal?`, conses and vectors by what
+    /// they hold. Keys that can only be told apart by their address are hashed by it, and a table
+    /// that has such keys hashes them again when it is used after a collection has moved them
+    value                make_hash(bool equal = false, size_t capacity = 0);
+    std::optional<value> hash_ref(value h, value key);
+    void                 hash_set(value h, value key, value v);
+    /// returns whether `key` was in `h`
+    bool hash_remove(value h, value key);
+
+    /// a vec of the first `dim` floats of `xs`, where `dim` is 2, 3 or 4. Vecs are immutable like
+    /// numbers, `+ - * /` work on them a whole register at a time
+    value make_vec(size_t dim, const float* xs);
+
+    /// a vec from a struct of 2 to 4 floats such as the vector type of a math library, copied as
+    /// a whole rather than field by field. This is how `emlisp_autobind` passes `EL_VEC` types
+    template<typename T>
+    value from_vec_struct(const T& v) {
+        static_assert(std::is_trivially_copyable_v<T> && sizeof(T) % sizeof(float) == 0);
+        static_assert(sizeof(T) >= 2 * sizeof(float) && sizeof(T) <= 4 * sizeof(float));
+        float xs[4];
+        std::memcpy(xs, &v, sizeof(T));
+        return make_vec(sizeof(T) / sizeof(float), xs);
+    }
+
+    template<typename T>
+    T to_vec_struct(value v) {
+        static_assert(std::is_trivially_copyable_v<T> && sizeof(T) % sizeof(float) == 0);
+        if(vec_dim(v) != sizeof(T) / sizeof(float))
+            throw std::runtime_error("vec has the wrong number of elements");
+        T r;
+        std::memcpy(&r, vec_data(v), sizeof(T));
+        return r;
+    }
 
     value         read(std::string_view src);
     value         read_all(std::string_view src);
     std::ostream& write(std::ostream&, value);
 
+    /// write `v` in a compact binary format that keeps shared structure and cycles, which
+    /// `deserialize` reads back into this or another runtime. Only data can be serialized: conses,
+    /// vectors, arrays, vecs, strings, symbols, numbers and booleans
+    void  serialize(std::ostream& out, value v);
+    value deserialize(const uint8_t* data, size_t size);
+
+    /// copy `v` out into a block laid out like the heap, which `unpack` copies into this or another
+    /// runtime of the same process with a single allocation instead of reading it. Like
+    /// `serialize`, keeps shared structure and cycles and only takes data
+    std::vector<uint64_t> pack(value v);
+    value                 unpack(const uint64_t* words, size_t count);
+
     value eval(value x);
+    /// call `f` with a list of already evaluated argument values
     value apply(value f, value arguments);
 
     value expand(value v);
 
+    /// copy the program `v` into the code space and return the copy. Collections never move or
+    /// free the code space, so the forms of a program that is kept for the life of the runtime
+    /// aren't copied over and over, and the bodies of its functions keep their addresses. Conses,
+    /// vectors, arrays and strings in the code space can't be changed
+    value intern_code(value v);
+
     void eval_file(std::string_view contents);
 
+    /// read and expand `contents` like `eval_file`, and save the program and the macros it defines
+    /// as an image that `eval_image` evaluates without reading or expanding it again. Images hold
+    /// only program text and are only good for builds of the same version on the same platform
+    std::vector<uint8_t> make_image(std::string_view contents);
+    void                 eval_image(const uint8_t* image, size_t size);
+
+    /// write the state of the runtime, its heap, code space, symbols, globals, macros and function
+    /// templates, to the file at `path`, which `load_snapshot` restores without evaluating
+    /// anything. Builtins are saved by the names of the globals bound to them, C++ values and
+    /// owned externs can't be saved. Snapshots are only good for the build that saved them
+    void save_snapshot(const std::string& path);
+    /// map the snapshot at `path` into this runtime, which replaces the globals and macros it
+    /// defines. The builtins it refers to are taken from the globals of the same names here, so
+    /// the host has to define those before loading
+    void load_snapshot(const std::string& path);
+
+    /// a new runtime with a copy of this one's heap, code space, symbols, globals and macros, so
+    /// that each can go on without seeing what the other does. Builtins and C++ references are
+    /// shared by the copies, owned externs can't be cloned. A runtime whose nursery is empty is
+    /// copied as it is, so cloning a template runtime that is kept around for it costs about as
+    /// much as copying its memory
+    std::unique_ptr<runtime> clone();
+
+    /// freeze a copy of the state of this runtime, like `clone` does, as a base that any number of
+    /// runtimes can be built on. This runtime carries on unaffected. Owned externs can't be part
+    /// of a base, and a runtime that is built on a base can't make one
+    std::shared_ptr<const runtime_base> make_base();
+
     void define_fn(std::string_view name, extern_func_t fn, void* data = nullptr);
     void define_global(std::string_view name, value val);
+    /// the value of the global `name`, whatever the scope the runtime is evaluating in
+    value global(std::string_view name);
+
+    /// running the GC will invalidate any pointers returned from this runtime, and it runs
+    /// whenever an allocation finds the nursery full
+    /// if you need to maintain references over GC runs, use value_handles or a root_guard
+    /// a minor collection only copies the survivors out of the nursery, a `full` one also compacts
+    /// the old space. Minor collections become full ones when the old space is out of room
+    void collect_garbage(heap_info* res_info = nullptr, bool full = false);
+
+    /// do a slice of an incremental collection of the old space, starting one if none is running,
+    /// copying and scanning about `budget` bytes. Returns true if the collection finished, which
+    /// happens in the step where the scan catches up or in a full collection while it runs. The
+    /// work to finish is proportional to the roots, the nursery and the stores into the old space
+    /// made since the collection started, not to the size of the heap
+    bool collect_garbage_step(size_t budget, heap_info* res_info = nullptr);
+    /// keep doing slices of the incremental collection for about `budget`
+    bool collect_garbage_step(std::chrono::microseconds budget, heap_info* res_info = nullptr);
+
+    inline size_t current_heap_size() const {
+        return (heap_next - heap) + (old_next - old_space);
+    }
 
-    /// running the GC will invalidate any pointers returned from this runtime
-    /// if you need to maintain references over GC runs, use value_handles
-    void collect_garbage(heap_info* res_info = nullptr);
-
-    inline size_t current_heap_size() const { return heap_next - heap; }
+    inline void set_heap_policy(const heap_policy& p) { policy = p; }
 
     friend class value_handle;
     class value_handle handle_for(value v);
 
+    // extern references are cells of the pointer, or the `owned_extern` object that holds the
+    // value, and the type's hash, both stored like values so that the collector can scan them
     template<typename T>
     value make_extern_reference(T* ob) {
         // TODO: make this just cast the ptr in release mode and not bother with type checking
-        return (cons((value)ob, typeid(T).hash_code()) & ~0xf) | (value)value_type::_extern;
+        return make_extern_cell<T>(((value)ob << 4) | (value)value_type::_extern);
+    }
+
+    /// whether `v` is an extern reference to a `T`
+    template<typename T>
+    bool is_extern_reference(value v) {
+        if(type_of(v) != value_type::_extern) return false;
+        v = (v & ~0xf) | (value)value_type::cons;
+        return ((typeid(T).hash_code() << 4) | (value)value_type::int_t) == second(v);
     }
 
     template<typename T>
     T* get_extern_reference(value v) {
         check_type(v, value_type::_extern);
-        v = (v & ~0xf) | (value)value_type::cons;
-        if(typeid(T).hash_code() != second(v))
+        if(!is_extern_reference<T>(v))
             throw std::runtime_error(
                 std::string("mismatched type unwraping extern value, expected: ") + typeid(T).name()
             );
-        return (T*)first(v);
+        v       = (v & ~0xf) | (value)value_type::cons;
+        value p = first(v);
+        if(type_of(p) == value_type::_object)
+            return (T*)((uint8_t*)object_data(p) + sizeof(owned_extern_header));
+        return (T*)(p >> 4);
     }
 
     template<typename T, typename... Args>
     value make_owned_extern(Args... args) {
-        if(heap_next - heap > heap_size) throw std::runtime_error("out of memory");
-        auto* h = (owned_extern_header*)heap_next;
-        auto* t = (T*)(heap_next + sizeof(owned_extern_header));
-        h->size = sizeof(T) + sizeof(owned_extern_header);
-        heap_next += h->size;
+        size_t payload = sizeof(owned_extern_header) + sizeof(T);
+        auto*  o       = (value*)alloc(sizeof(value) + payload);
+        *o             = make_header(object_kind::owned_extern, payload);
+        auto* h        = (owned_extern_header*)(o + 1);
+        auto* t        = (T*)((uint8_t*)h + sizeof(owned_extern_header));
+        h->size        = sizeof(T);
         h->move = [](void* dst, void* src) {
             T* d = (T*)dst;
             T* s = (T*)src;
@@ -232,18 +854,25 @@ class runtime {
         h->deconstructor = [](void* x) { ((T*)x)->~T(); };
         new(t) T(args...);
         owned_externs.insert((uint64_t)t);
-        return make_extern_reference(t);
+        return make_extern_cell<T>(((value)o << 4) | (value)value_type::_object);
     }
 
     template<typename T>
     T take_owned_extern(value v) {
         T* p = get_extern_reference<T>(v);
-        assert((size_t)p >= (size_t)heap && (size_t)p < (size_t)(heap + heap_size));
+        assert(in_nursery(p) || in_old_space(p));
         owned_externs.erase((size_t)p);
         return std::move(*p);
     }
 };
 
+template<typename... Values>
+root_guard::root_guard(runtime* rt, Values&... vs) : rt(rt), count(sizeof...(Values)) {
+    (rt->c_roots.push_back(&vs), ...);
+}
+
+inline root_guard::~root_guard() { rt->c_roots.resize(rt->c_roots.size() - count); }
+
 // must live as long as the runtime from which it was obtained
 class value_handle {
   protected:
@@ -276,4 +905,8 @@ class value_handle {
 // };
 
 extern const char* EMLISP_STD_SRC;
+/// the standard library saved by `make_image` at build time, the size is 0 if there is none and the
+/// runtime reads `EMLISP_STD_SRC` instead
+extern const uint8_t* EMLISP_STD_IMAGE;
+extern const size_t   EMLISP_STD_IMAGE_SIZE;
 }  // namespace emlisp
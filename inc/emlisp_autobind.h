@@ -8,3 +8,4 @@
 #define EL_KNOWN_INSTS(ki)
 #define EL_TYPEDEF
 #define EL_ALWAYS_SHARED
+#define EL_VEC
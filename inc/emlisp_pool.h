@@ -0,0 +1,134 @@
+#pragma once
+#include "emlisp.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace emlisp {
+/// a value copied out of one runtime to be copied into another, values can't be shared between
+/// runtimes directly. Only data can be packed, see `runtime::pack`
+struct packed_value {
+    std::vector<uint64_t> words;
+
+    static packed_value pack(runtime& rt, value v);
+    value               unpack(runtime& rt) const;
+};
+
+/// a bounded queue that moves values between runtimes on different threads, such as the stages of
+/// a pipeline. Any number of threads can send and receive at once without taking a lock, each slot
+/// carries a sequence number that says whether it is free to be filled or ready to be taken. A
+/// value crosses as a packed block, so the receiving runtime takes it in one allocation
+class channel {
+    struct slot {
+        std::atomic<size_t> sequence;
+        packed_value        value;
+    };
+    std::unique_ptr<slot[]> slots;
+    size_t                  mask;
+    // kept on separate cache lines, senders only move `tail` and receivers only move `head`
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+
+  public:
+    /// a channel holding up to `capacity` values, rounded up to a power of two
+    explicit channel(size_t capacity);
+    channel(const channel&)            = delete;
+    channel& operator=(const channel&) = delete;
+
+    inline size_t capacity() const { return mask + 1; }
+
+    /// add `v` unless the channel is full, it is moved from only if it was added
+    bool try_send(packed_value& v);
+    /// take the oldest value unless the channel is empty
+    bool try_receive(packed_value& v);
+    /// these wait while the channel is full or empty
+    void         send(packed_value v);
+    packed_value receive();
+
+    /// define `(send channel value)`, which waits for room and returns the value, and
+    /// `(receive channel)` in `rt`. Channels are given to Lisp as extern references, which a base
+    /// can hold so that every runtime built on it sees the same channels
+    static void define_functions(runtime& rt);
+};
+
+/// worker threads that each own a runtime built on the same base, running jobs handed to the pool.
+/// Each worker keeps its own queue of jobs, taking the newest first, and when that is empty
+/// steals the oldest job of another worker. Jobs run on a worker's runtime one after another, so
+/// globals defined by one job are seen by later jobs on the same worker
+class runtime_pool {
+    struct worker {
+        std::unique_ptr<runtime>                   rt;
+        std::mutex                                 lock;
+        std::deque<std::function<void(runtime&)>> jobs;
+        std::thread                                thread;
+    };
+    std::vector<std::unique_ptr<worker>> workers;
+    std::shared_ptr<const runtime_base>  base;
+    size_t                               heap_size;
+    eval_mode                            mode;
+    /// runtimes built on the base that attached runtimes run the futures they touch on
+    std::vector<std::unique_ptr<runtime>> runners;
+    std::mutex                            runners_lock;
+
+    /// workers sleep on `wake` while no worker has a job queued
+    std::mutex              mutex;
+    std::condition_variable wake;
+    std::atomic<size_t>     queued{0};
+    bool                    stopping = false;
+    std::atomic<size_t>     next_worker{0};
+
+    void post(std::function<void(runtime&)> job);
+    /// take a job for the worker `self`, from its own queue or another worker's
+    bool take(size_t self, std::function<void(runtime&)>& job);
+    void work(size_t self);
+    /// define `future-call` and `touch` in `rt`, which runs the futures it touches on `runner`
+    void attach(runtime& rt, runtime& runner);
+
+  public:
+    /// start `workers` threads, one per hardware thread if it is 0
+    explicit runtime_pool(
+        std::shared_ptr<const runtime_base> base,
+        size_t                              workers   = 0,
+        size_t                              heap_size = 1024 * 1024,
+        eval_mode                           mode      = eval_mode::bytecode
+    );
+    runtime_pool(const runtime_pool&)            = delete;
+    runtime_pool& operator=(const runtime_pool&) = delete;
+    /// finishes the jobs that are queued before the workers stop
+    ~runtime_pool();
+
+    inline size_t size() const { return workers.size(); }
+
+    /// call `job` with the runtime of a worker. Jobs submitted from a worker go to its own queue
+    template<typename F>
+    auto run(F&& job) -> std::future<std::invoke_result_t<F&, runtime&>> {
+        using R     = std::invoke_result_t<F&, runtime&>;
+        auto task   = std::make_shared<std::packaged_task<R(runtime&)>>(std::forward<F>(job));
+        auto result = task->get_future();
+        post([task](runtime& rt) { (*task)(rt); });
+        return result;
+    }
+
+    /// apply the global function named `fn` to the list `args` on a worker, errors are rethrown by
+    /// the future
+    std::future<packed_value> submit(std::string_view fn, packed_value args);
+    /// the same with a list of arguments from the runtime `from`
+    std::future<packed_value> submit(runtime& from, std::string_view fn, value args);
+
+    /// make `future`, and so `pmap`, in `rt` run calls on the workers of this pool, which has to
+    /// outlive `rt`. The workers are attached already, so their jobs can make futures too.
+    /// `(future (f args...))` evaluates `f` and the arguments in `rt`. If `f` is the global `f`,
+    /// the arguments are copied to a worker that calls the global `f` of the base, and `touch`
+    /// waits for the result and copies it back. Touching a future that no worker has started yet
+    /// runs it on a runtime built on the same base instead, so the call means the same wherever it
+    /// runs. Closures can't be copied between runtimes, so any other function, such as a lambda or
+    /// a local variable, is called right away in `rt`. Also defines the channel functions, so
+    /// pipeline stages can run as pool jobs
+    void attach(runtime& rt);
+};
+}  // namespace emlisp
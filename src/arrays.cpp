@@ -0,0 +1,433 @@
+#include "emlisp.h"
+#include <cstring>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace emlisp {
+namespace {
+// The registers the kernels work on for each element type, which hold `width` elements. Without
+// vector instructions, and for 64 bit integers which SSE and AVX can't multiply or compare, a
+// register is a single element and the compiler is left to vectorize the loops itself. Like the
+// instructions, `min` and `max` give their second operand when the two are unordered, and
+// `keep_nan` makes the lanes of `acc` NaN where `x` is.
+template<typename T>
+struct simd {
+    using reg                    = T;
+    static constexpr size_t width = 1;
+
+    static reg  load(const T* p) { return *p; }
+    static void store(T* p, reg r) { *p = r; }
+    static reg  splat(T x) { return x; }
+    static reg  add(reg a, reg b) { return a + b; }
+    static reg  sub(reg a, reg b) { return a - b; }
+    static reg  mul(reg a, reg b) { return a * b; }
+    static reg  div(reg a, reg b) { return a / b; }
+    static reg  min(reg a, reg b) { return a < b ? a : b; }
+    static reg  max(reg a, reg b) { return b < a ? a : b; }
+    static reg  keep_nan(reg acc, reg x) { return x != x ? x : acc; }
+    static reg  mul_add(reg a, reg b, reg c) { return a * b + c; }
+};
+
+#if defined(__AVX__)
+template<>
+struct simd<float> {
+    using reg                    = __m256;
+    static constexpr size_t width = 8;
+
+    static reg  load(const float* p) { return _mm256_loadu_ps(p); }
+    static void store(float* p, reg r) { _mm256_storeu_ps(p, r); }
+    static reg  splat(float x) { return _mm256_set1_ps(x); }
+    static reg  add(reg a, reg b) { return _mm256_add_ps(a, b); }
+    static reg  sub(reg a, reg b) { return _mm256_sub_ps(a, b); }
+    static reg  mul(reg a, reg b) { return _mm256_mul_ps(a, b); }
+    static reg  div(reg a, reg b) { return _mm256_div_ps(a, b); }
+    static reg  min(reg a, reg b) { return _mm256_min_ps(a, b); }
+    static reg  max(reg a, reg b) { return _mm256_max_ps(a, b); }
+    static reg  keep_nan(reg acc, reg x) {
+        return _mm256_or_ps(acc, _mm256_and_ps(_mm256_cmp_ps(x, x, _CMP_UNORD_Q), x));
+    }
+#if defined(__FMA__)
+    static reg mul_add(reg a, reg b, reg c) { return _mm256_fmadd_ps(a, b, c); }
+#else
+    static reg mul_add(reg a, reg b, reg c) { return add(mul(a, b), c); }
+#endif
+};
+
+template<>
+struct simd<double> {
+    using reg                    = __m256d;
+    static constexpr size_t width = 4;
+
+    static reg  load(const double* p) { return _mm256_loadu_pd(p); }
+    static void store(double* p, reg r) { _mm256_storeu_pd(p, r); }
+    static reg  splat(double x) { return _mm256_set1_pd(x); }
+    static reg  add(reg a, reg b) { return _mm256_add_pd(a, b); }
+    static reg  sub(reg a, reg b) { return _mm256_sub_pd(a, b); }
+    static reg  mul(reg a, reg b) { return _mm256_mul_pd(a, b); }
+    static reg  div(reg a, reg b) { return _mm256_div_pd(a, b); }
+    static reg  min(reg a, reg b) { return _mm256_min_pd(a, b); }
+    static reg  max(reg a, reg b) { return _mm256_max_pd(a, b); }
+    static reg  keep_nan(reg acc, reg x) {
+        return _mm256_or_pd(acc, _mm256_and_pd(_mm256_cmp_pd(x, x, _CMP_UNORD_Q), x));
+    }
+#if defined(__FMA__)
+    static reg mul_add(reg a, reg b, reg c) { return _mm256_fmadd_pd(a, b, c); }
+#else
+    static reg mul_add(reg a, reg b, reg c) { return add(mul(a, b), c); }
+#endif
+};
+#elif defined(__SSE2__) || defined(_M_X64)
+template<>
+struct simd<float> {
+    using reg                    = __m128;
+    static constexpr size_t width = 4;
+
+    static reg  load(const float* p) { return _mm_loadu_ps(p); }
+    static void store(float* p, reg r) { _mm_storeu_ps(p, r); }
+    static reg  splat(float x) { return _mm_set1_ps(x); }
+    static reg  add(reg a, reg b) { return _mm_add_ps(a, b); }
+    static reg  sub(reg a, reg b) { return _mm_sub_ps(a, b); }
+    static reg  mul(reg a, reg b) { return _mm_mul_ps(a, b); }
+    static reg  div(reg a, reg b) { return _mm_div_ps(a, b); }
+    static reg  min(reg a, reg b) { return _mm_min_ps(a, b); }
+    static reg  max(reg a, reg b) { return _mm_max_ps(a, b); }
+    static reg  keep_nan(reg acc, reg x) {
+        return _mm_or_ps(acc, _mm_and_ps(_mm_cmpunord_ps(x, x), x));
+    }
+    static reg  mul_add(reg a, reg b, reg c) { return add(mul(a, b), c); }
+};
+
+template<>
+struct simd<double> {
+    using reg                    = __m128d;
+    static constexpr size_t width = 2;
+
+    static reg  load(const double* p) { return _mm_loadu_pd(p); }
+    static void store(double* p, reg r) { _mm_storeu_pd(p, r); }
+    static reg  splat(double x) { return _mm_set1_pd(x); }
+    static reg  add(reg a, reg b) { return _mm_add_pd(a, b); }
+    static reg  sub(reg a, reg b) { return _mm_sub_pd(a, b); }
+    static reg  mul(reg a, reg b) { return _mm_mul_pd(a, b); }
+    static reg  div(reg a, reg b) { return _mm_div_pd(a, b); }
+    static reg  min(reg a, reg b) { return _mm_min_pd(a, b); }
+    static reg  max(reg a, reg b) { return _mm_max_pd(a, b); }
+    static reg  keep_nan(reg acc, reg x) {
+        return _mm_or_pd(acc, _mm_and_pd(_mm_cmpunord_pd(x, x), x));
+    }
+    static reg  mul_add(reg a, reg b, reg c) { return add(mul(a, b), c); }
+};
+#endif
+
+// combine the lanes of `r` with `f`, reductions do this once at the end
+template<typename T, typename F>
+T fold_lanes(typename simd<T>::reg r, F&& f) {
+    T lanes[simd<T>::width];
+    simd<T>::store(lanes, r);
+    T x = lanes[0];
+    for(size_t i = 1; i < simd<T>::width; ++i)
+        x = f(x, lanes[i]);
+    return x;
+}
+
+// the operations of the elementwise kernels, on whole registers and on the elements left over
+#define ARRAY_OP(NAME, FN, OP)                                                                     \
+    struct NAME {                                                                                  \
+        template<typename T>                                                                       \
+        static typename simd<T>::reg vec(typename simd<T>::reg a, typename simd<T>::reg b) {       \
+            return simd<T>::FN(a, b);                                                              \
+        }                                                                                          \
+        template<typename T>                                                                       \
+        static T one(T a, T b) {                                                                   \
+            return a OP b;                                                                         \
+        }                                                                                          \
+    }
+ARRAY_OP(add_op, add, +);
+ARRAY_OP(sub_op, sub, -);
+ARRAY_OP(mul_op, mul, *);
+ARRAY_OP(div_op, div, /);
+#undef ARRAY_OP
+
+// out[i] = a[i] op b[i], or a[i] op b[0] when `b` is a single number
+template<typename T, typename Op>
+void zip(const T* a, const T* b, bool broadcast, T* out, size_t n) {
+    using S  = simd<T>;
+    size_t i = 0;
+    if(broadcast) {
+        auto rb = S::splat(*b);
+        for(; i + S::width <= n; i += S::width)
+            S::store(out + i, Op::template vec<T>(S::load(a + i), rb));
+        for(; i < n; ++i)
+            out[i] = Op::one(a[i], *b);
+    } else {
+        for(; i + S::width <= n; i += S::width)
+            S::store(out + i, Op::template vec<T>(S::load(a + i), S::load(b + i)));
+        for(; i < n; ++i)
+            out[i] = Op::one(a[i], b[i]);
+    }
+}
+
+// two accumulators, so that each addition doesn't wait for the one before it
+template<typename T>
+T sum(const T* a, size_t n) {
+    using S    = simd<T>;
+    auto   acc0 = S::splat(0), acc1 = S::splat(0);
+    size_t i    = 0;
+    for(; i + 2 * S::width <= n; i += 2 * S::width) {
+        acc0 = S::add(acc0, S::load(a + i));
+        acc1 = S::add(acc1, S::load(a + i + S::width));
+    }
+    T total = fold_lanes<T>(S::add(acc0, acc1), [](T x, T y) { return x + y; });
+    for(; i < n; ++i)
+        total += a[i];
+    return total;
+}
+
+template<typename T>
+T dot(const T* a, const T* b, size_t n) {
+    using S    = simd<T>;
+    auto   acc0 = S::splat(0), acc1 = S::splat(0);
+    size_t i    = 0;
+    for(; i + 2 * S::width <= n; i += 2 * S::width) {
+        acc0 = S::mul_add(S::load(a + i), S::load(b + i), acc0);
+        acc1 = S::mul_add(S::load(a + i + S::width), S::load(b + i + S::width), acc1);
+    }
+    T total = fold_lanes<T>(S::add(acc0, acc1), [](T x, T y) { return x + y; });
+    for(; i < n; ++i)
+        total += a[i] * b[i];
+    return total;
+}
+
+// the smallest or largest element, `n` isn't 0. Like arithmetic, a NaN anywhere makes the result
+// NaN: the best so far is the second operand of `min` or `max`, which keeps it once it is NaN, and
+// `keep_nan` takes a NaN element
+template<typename T, bool largest>
+T extreme(const T* a, size_t n) {
+    using S    = simd<T>;
+    auto   pick = [](T best, T x) { return x != x || (largest ? best < x : x < best) ? x : best; };
+    T      best = a[0];
+    size_t i    = 0;
+    if(n >= S::width) {
+        auto r = S::load(a);
+        for(i = S::width; i + S::width <= n; i += S::width) {
+            auto x = S::load(a + i);
+            r      = S::keep_nan(largest ? S::max(x, r) : S::min(x, r), x);
+        }
+        best = fold_lanes<T>(r, pick);
+    }
+    for(; i < n; ++i)
+        best = pick(best, a[i]);
+    return best;
+}
+
+// call `f` with a zero of the element type of arrays of `kind`
+template<typename F>
+auto with_element_type(object_kind kind, F&& f) {
+    switch(kind) {
+        case object_kind::f32_array: return f(float{0});
+        case object_kind::f64_array: return f(double{0});
+        default: return f(int64_t{0});
+    }
+}
+
+template<typename T>
+T number_as(value v) {
+    if(type_of(v) == value_type::int_t) return (T)to_int(v);
+    if(type_of(v) == value_type::float_t) return (T)to_float(v);
+    throw type_mismatch_error("arrays can only hold numbers", value_type::float_t, type_of(v));
+}
+
+template<typename T>
+value number_value(runtime* rt, T x) {
+    if constexpr(std::is_integral_v<T>)
+        return rt->from_int(x);
+    else
+        return rt->from_float((float)x);
+}
+
+object_kind array_kind_named(runtime* rt, value name) {
+    const auto& s = rt->symbol_str(name);
+    if(s == "f32") return object_kind::f32_array;
+    if(s == "f64") return object_kind::f64_array;
+    if(s == "i64") return object_kind::i64_array;
+    throw std::runtime_error("array element type must be f32, f64 or i64");
+}
+
+// a new array of `a` op `b`, where `b` is an array of the same kind and length or a number
+template<typename Op>
+value zip_arrays(runtime* rt, value args) {
+    value  a = first(args), b = first(second(args));
+    auto   kind = array_kind(a);
+    size_t n    = array_length(a);
+    bool   broadcast = type_of(b) != value_type::array;
+    if(!broadcast && (array_kind(b) != kind || array_length(b) != n))
+        throw std::runtime_error("arrays must have the same element type and length");
+    root_guard g(rt, a, b);
+    value      out = rt->make_array(kind, n);
+    with_element_type(kind, [&](auto zero) {
+        using T = decltype(zero);
+        T scalar{};
+        if(broadcast) scalar = number_as<T>(b);
+        const T* bs = broadcast ? &scalar : array_data<T>(b);
+        if constexpr(std::is_integral_v<T>) {
+            if(std::is_same_v<Op, div_op>)
+                for(size_t i = 0; i < (broadcast ? 1 : n); ++i)
+                    if(bs[i] == 0) throw std::runtime_error("integer division by zero");
+        }
+        zip<T, Op>(array_data<T>(a), bs, broadcast, array_data<T>(out), n);
+    });
+    return out;
+}
+
+template<bool largest>
+value extreme_of(runtime* rt, value args) {
+    value a = first(args);
+    if(array_length(a) == 0)
+        throw std::runtime_error("empty array has no smallest or largest element");
+    return with_element_type(array_kind(a), [&](auto zero) {
+        using T = decltype(zero);
+        return number_value(rt, extreme<T, largest>(array_data<T>(a), array_length(a)));
+    });
+}
+}  // namespace
+
+value runtime::make_array(object_kind kind, size_t length) {
+    size_t bytes = length * array_element_size(kind);
+    auto*  o     = (value*)alloc(sizeof(value) + bytes);
+    o[0]         = make_header(kind, bytes);
+    std::memset(o + 1, 0, object_size(o[0]) - sizeof(value));
+    return (((uint64_t)o) << 4) | (uint64_t)value_type::array;
+}
+
+value runtime::array_ref(value arr, size_t i) {
+    if(i >= array_length(arr)) throw std::out_of_range("array index out of range");
+    return with_element_type(array_kind(arr), [&](auto zero) {
+        using T = decltype(zero);
+        return number_value(this, array_data<T>(arr)[i]);
+    });
+}
+
+void runtime::array_set(value arr, size_t i, value v) {
+    if(i >= array_length(arr)) throw std::out_of_range("array index out of range");
+    if(in_code_space((void*)(arr >> 4))) throw std::runtime_error("can't change interned code");
+    if(in_base((void*)(arr >> 4))) throw std::runtime_error("can't change the values of a base");
+    with_element_type(array_kind(arr), [&](auto zero) {
+        using T               = decltype(zero);
+        array_data<T>(arr)[i] = number_as<T>(v);
+    });
+}
+
+void runtime::define_array_functions() {
+    define_fn("array?", [](runtime* rt, value args, void* d) {
+        return rt->from_bool(type_of(first(args)) == value_type::array);
+    });
+
+    define_fn("make-array", [](runtime* rt, value args, void* d) {
+        auto    kind   = array_kind_named(rt, first(args));
+        int64_t length = to_int(first(second(args)));
+        if(length < 0) throw std::out_of_range("negative array length");
+        // the arguments are read before allocating, which can move them
+        value fill = second(second(args)) != NIL ? first(second(second(args))) : NIL;
+        value arr  = rt->make_array(kind, length);
+        if(fill != NIL) {
+            with_element_type(kind, [&](auto zero) {
+                using T = decltype(zero);
+                std::fill(array_data<T>(arr), array_data<T>(arr) + length, number_as<T>(fill));
+            });
+        }
+        return arr;
+    });
+
+    define_fn("array-length", [](runtime* rt, value args, void* d) {
+        return rt->from_int(array_length(first(args)));
+    });
+
+    define_fn("array-ref", [](runtime* rt, value args, void* d) {
+        return rt->array_ref(first(args), to_int(first(second(args))));
+    });
+
+    define_fn("array-set!", [](runtime* rt, value args, void* d) {
+        value v = first(second(second(args)));
+        rt->array_set(first(args), to_int(first(second(args))), v);
+        return v;
+    });
+
+    define_fn("list->array", [](runtime* rt, value args, void* d) {
+        auto   kind   = array_kind_named(rt, first(args));
+        size_t length = 0;
+        for(value l = first(second(args)); l != NIL; l = second(l))
+            length++;
+        value list = first(second(args));
+        root_guard g(rt, list);
+        value      arr = rt->make_array(kind, length);
+        for(size_t i = 0; list != NIL; list = second(list), ++i)
+            rt->array_set(arr, i, first(list));
+        return arr;
+    });
+
+    define_fn("array->list", [](runtime* rt, value args, void* d) {
+        value  arr  = first(args);
+        size_t base = rt->stack.size();
+        for(size_t i = 0, n = array_length(arr); i < n; ++i)
+            rt->stack.push_back(rt->array_ref(arr, i));
+        return rt->list_from_stack(base);
+    });
+
+    // whole arrays //
+    define_fn("array+", [](runtime* rt, value args, void* d) {
+        return zip_arrays<add_op>(rt, args);
+    });
+    define_fn("array-", [](runtime* rt, value args, void* d) {
+        return zip_arrays<sub_op>(rt, args);
+    });
+    define_fn("array*", [](runtime* rt, value args, void* d) {
+        return zip_arrays<mul_op>(rt, args);
+    });
+    define_fn("array/", [](runtime* rt, value args, void* d) {
+        return zip_arrays<div_op>(rt, args);
+    });
+
+    define_fn("array-sum", [](runtime* rt, value args, void* d) {
+        value a = first(args);
+        return with_element_type(array_kind(a), [&](auto zero) {
+            using T = decltype(zero);
+            return number_value(rt, sum(array_data<T>(a), array_length(a)));
+        });
+    });
+
+    define_fn("array-dot", [](runtime* rt, value args, void* d) {
+        value a = first(args), b = first(second(args));
+        if(array_kind(a) != array_kind(b) || array_length(a) != array_length(b))
+            throw std::runtime_error("arrays must have the same element type and length");
+        return with_element_type(array_kind(a), [&](auto zero) {
+            using T = decltype(zero);
+            return number_value(rt, dot(array_data<T>(a), array_data<T>(b), array_length(a)));
+        });
+    });
+
+    define_fn("array-min", [](runtime* rt, value args, void* d) {
+        return extreme_of<false>(rt, args);
+    });
+    define_fn("array-max", [](runtime* rt, value args, void* d) {
+        return extreme_of<true>(rt, args);
+    });
+
+    // a Lisp function can't run in vector registers, so this calls it once per element
+    define_fn("array-map", [](runtime* rt, value args, void* d) {
+        value      f = first(args), a = first(second(args));
+        root_guard g(rt, f, a);
+        value      out = rt->make_array(array_kind(a), array_length(a));
+        root_guard h(rt, out);
+        for(size_t i = 0, n = array_length(a); i < n; ++i) {
+            value x = rt->array_ref(a, i);
+            // `cons` and `apply` can move `f` and `out`, so they are only read between the calls
+            value call = rt->cons(x);
+            value r    = rt->apply(f, call);
+            rt->array_set(out, i, r);
+        }
+        return out;
+    });
+}
+}  // namespace emlisp
@@ -27,9 +27,10 @@ const std::unordered_set<std::string> intlike_types
 const std::unordered_set<std::string> floatlike_types = {"float", "double"};
 
 struct code_generator {
-    size_t           next_tmp;
-    std::ofstream    out;
-    const tokenizer& toks;
+    size_t                 next_tmp;
+    std::ofstream          out;
+    const tokenizer&       toks;
+    std::unordered_set<id> vec_types;
 
     code_generator(const std::filesystem::path& output_path, const tokenizer& toks)
         : out(output_path), toks(toks), next_tmp(1) {}
@@ -140,6 +141,12 @@ struct code_generator {
                     << "rt->to_str(" << lisp_value << ");\n";
                 return tmp;
             }
+            if(vec_types.find(pt->name) != vec_types.end()) {
+                out << "auto " << tmp << " = "
+                    << "rt->to_vec_struct<" << toks.identifiers[pt->name] << ">(" << lisp_value
+                    << ");\n";
+                return tmp;
+            }
         }
 
         auto tt = std::dynamic_pointer_cast<template_instance>(type);
@@ -233,6 +240,10 @@ struct code_generator {
                 out << "rt->from_str(" << cpp_value << ");\n";
                 return tmp;
             }
+            if(vec_types.find(pt->name) != vec_types.end()) {
+                out << "rt->from_vec_struct(" << cpp_value << ");\n";
+                return tmp;
+            }
         }
 
         out << "rt->make_owned_extern<";
@@ -388,6 +399,7 @@ struct generate_visitor {
     void generate_bindings(
         const world& ast, const std::vector<std::filesystem::path>& input_files
     ) {
+        gen.vec_types = ast.vec_types;
         gen.start_bindings(input_files);
         for(const auto& ob : ast.objects)
             generate_bindings_for_object(ob);
@@ -331,6 +331,16 @@ std::pair<id, std::shared_ptr<cpptype>> parser::parse_typedef() {
     return {name, ty};
 }
 
+id parser::parse_vec_type() {
+    token tk = toks.next();
+    if(!tk.is_keyword(keyword::class_) && !tk.is_keyword(keyword::struct_))
+        throw parse_error(tk, toks.line_number, "can only apply EL_VEC to classes and structs");
+
+    tk = toks.next();
+    if(!tk.is_id()) throw parse_error(tk, toks.line_number, "expected name of class/struct");
+    return tk.data;
+}
+
 void parser::parse(world& ast) {
     token tk = toks.next();
     while(!tk.is_eof()) {
@@ -338,6 +348,8 @@ void parser::parse(world& ast) {
             ast.objects.emplace_back(parse_object());
         else if(tk.is_keyword(keyword::el_typedef))
             ast.typedefs.emplace(parse_typedef());
+        else if(tk.is_keyword(keyword::el_vec))
+            ast.vec_types.insert(parse_vec_type());
         tk = toks.next();
     }
 }
@@ -268,6 +268,8 @@ struct object {
 struct world {
     std::vector<object> objects;
     named_types_map     typedefs;
+    /// structs of 2 to 4 floats that are passed to Lisp as vecs
+    std::unordered_set<id> vec_types;
 
     std::ostream& print(std::ostream& out, const tokenizer& toks) const {
         for(const auto& ob : objects)
@@ -276,6 +278,8 @@ struct world {
             out << "using " << toks.identifiers[name] << " as ";
             ty->print(out, toks) << "\n";
         }
+        for(auto name : vec_types)
+            out << "vec " << toks.identifiers[name] << "\n";
         return out;
     }
 };
@@ -311,6 +315,7 @@ struct parser {
     void   parse_signature(std::vector<std::pair<std::shared_ptr<cpptype>, id>>& args);
     object parse_object();
     std::pair<id, std::shared_ptr<cpptype>>               parse_typedef();
+    id                                                    parse_vec_type();
     std::vector<std::shared_ptr<cpptype>>                 parse_template_param_list();
     template_known_instances                              parse_known_instance_map();
     std::tuple<std::vector<id>, template_known_instances> parse_template_def();
@@ -39,7 +39,8 @@ enum class keyword {
     readwrite,
     el_known_insts,
     el_typedef,
-    el_always_shared
+    el_always_shared,
+    el_vec
 };
 
 struct token {
@@ -83,6 +83,7 @@ const std::map<std::string_view, keyword> keywords = {
     {"r",                keyword::read            },
     {"rw",               keyword::readwrite       },
     {"EL_TYPEDEF",       keyword::el_typedef      },
+    {"EL_VEC",           keyword::el_vec          },
 };
 
 token tokenizer::parse_id(char ch) {
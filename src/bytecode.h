@@ -0,0 +1,76 @@
+#pragma once
+#include "emlisp.h"
+
+namespace emlisp {
+// Each instruction is one 32-bit word: the opcode in the low 8 bits and a single 24-bit operand
+// above it. Jump targets are absolute instruction indices into `code::instrs`.
+//
+// Local variables are resolved by the compiler to a (depth, slot) pair packed into the operand:
+// `depth` is the number of parent links to follow from the current environment frame and `slot`
+// indexes the locals of the frame found there. Anything that is not a local is a global, addressed
+// by its symbol index.
+enum class opcode : uint8_t {
+    // push consts[operand]
+    constant,
+    // discard the top of the stack
+    pop,
+    // push the local at (depth, slot)
+    load_local,
+    // pop a value into the local at (depth, slot)
+    store_local,
+    // push the global bound to the symbol with index operand
+    load_global,
+    // pop a value into the global for the symbol with index operand
+    store_global,
+    // push a closure of children[operand] over the current environment
+    closure,
+    // continue at instruction operand
+    jump,
+    // pop a value and continue at instruction operand if it is #f
+    jump_if_false,
+    // call stack[top - operand] with the operand values above it as arguments
+    call,
+    // like call, but return the result of the call, reusing the native frame for compiled code
+    tail_call,
+    // push a fresh symbol named like consts[operand]
+    unique_sym,
+    // pop b, pop a, push (a . b)
+    cons,
+    // pop b, pop the list a, push a copy of a whose last cdr is b
+    append,
+    // return the top of the stack
+    ret
+};
+
+constexpr uint32_t MAX_LOCAL_DEPTH = 0xff;
+constexpr uint32_t MAX_LOCAL_SLOT  = 0xffff;
+
+inline uint32_t make_instr(opcode op, uint32_t operand = 0) {
+    assert(operand < (1 << 24));
+    return (operand << 8) | (uint32_t)op;
+}
+
+inline opcode instr_op(uint32_t instr) { return opcode(instr & 0xff); }
+
+inline uint32_t instr_operand(uint32_t instr) { return instr >> 8; }
+
+inline uint32_t local_operand(uint32_t depth, uint32_t slot) { return (depth << 16) | slot; }
+
+inline uint32_t local_depth(uint32_t operand) { return operand >> 16; }
+
+inline uint32_t local_slot(uint32_t operand) { return operand & 0xffff; }
+
+// environment frames are `object_kind::frame` objects: the parent frame, then the slots
+inline value& env_parent(value env) { return object_data(env)[0]; }
+
+inline value& env_slot(value env, uint32_t slot) { return object_data(env)[1 + slot]; }
+
+inline size_t env_slot_count(value env) {
+    return header_payload_bytes(*(value*)(env >> 4)) / sizeof(value) - 1;
+}
+
+// closures made by the VM hold their environment frame, the tree walker's hold their captures
+inline bool is_compiled_closure(value f) {
+    return is_object(*((value*)(f >> 4) + 1), object_kind::frame);
+}
+}  // namespace emlisp
@@ -0,0 +1,323 @@
+#include "bytecode.h"
+#include "emlisp.h"
+#include <sstream>
+
+namespace emlisp {
+struct compiler {
+    runtime*  rt;
+    code&     c;
+    compiler* parent;
+    // true for a top level form, where defines outside of any let bind globals
+    bool   toplevel;
+    size_t let_depth = 0;
+    // locals in scope as (name, slot), innermost last so that later bindings shadow earlier ones
+    std::vector<std::pair<value, uint32_t>> visible;
+
+    compiler(runtime* rt, code& c, compiler* parent, bool toplevel)
+        : rt(rt), c(c), parent(parent), toplevel(toplevel) {}
+
+    uint32_t add_const(value v) {
+        c.consts.push_back(v);
+        return c.consts.size() - 1;
+    }
+
+    void emit(opcode op, uint32_t operand = 0) { c.instrs.push_back(make_instr(op, operand)); }
+
+    size_t emit_jump(opcode op) {
+        emit(op);
+        return c.instrs.size() - 1;
+    }
+
+    void patch_jump(size_t at) {
+        c.instrs[at] = make_instr(instr_op(c.instrs[at]), c.instrs.size());
+    }
+
+    uint32_t declare(value name) {
+        check_type(name, value_type::sym, "binding name must be symbol");
+        if(c.frame_size > MAX_LOCAL_SLOT) throw std::runtime_error("too many local variables");
+        visible.emplace_back(name, c.frame_size);
+        return c.frame_size++;
+    }
+
+    std::optional<uint32_t> find_in_frame(value name) {
+        for(auto v = visible.rbegin(); v != visible.rend(); ++v)
+            if(v->first == name) return v->second;
+        return std::nullopt;
+    }
+
+    // resolve `name` to the (depth, slot) operand of a local, or nothing if it is a global
+    std::optional<uint32_t> resolve(value name) {
+        uint32_t depth = 0;
+        for(compiler* cm = this; cm != nullptr; cm = cm->parent, ++depth) {
+            auto slot = cm->find_in_frame(name);
+            if(slot.has_value()) {
+                if(depth > MAX_LOCAL_DEPTH) throw std::runtime_error("functions nested too deeply");
+                return local_operand(depth, slot.value());
+            }
+        }
+        return std::nullopt;
+    }
+
+    void emit_load(value name) {
+        auto local = resolve(name);
+        if(local.has_value())
+            emit(opcode::load_local, local.value());
+        else
+            emit(opcode::load_global, name >> 4);
+    }
+
+    void emit_store(value name) {
+        auto local = resolve(name);
+        if(local.has_value())
+            emit(opcode::store_local, local.value());
+        else
+            emit(opcode::store_global, name >> 4);
+    }
+
+    void end_scope(size_t visible_before) {
+        visible.resize(visible_before);
+        let_depth--;
+    }
+
+    bool defines_global() const { return toplevel && let_depth == 0; }
+
+    bool has_unquote(value t) {
+        while(type_of(t) == value_type::cons) {
+            value x = first(t);
+            if(x == rt->sym_unquote) return true;
+            if(type_of(x) == value_type::cons
+               && (first(x) == rt->sym_unquote_splicing || has_unquote(x)))
+                return true;
+            t = second(t);
+        }
+        return false;
+    }
+
+    void compile_quasiquote(value t) {
+        if(type_of(t) != value_type::cons || !has_unquote(t)) {
+            emit(opcode::constant, add_const(t));
+        } else if(first(t) == rt->sym_unquote) {
+            compile(first(second(t)));
+        } else if(type_of(first(t)) == value_type::cons
+                  && first(first(t)) == rt->sym_unquote_splicing) {
+            compile(first(second(first(t))));
+            compile_quasiquote(second(t));
+            emit(opcode::append);
+        } else {
+            compile_quasiquote(first(t));
+            compile_quasiquote(second(t));
+            emit(opcode::cons);
+        }
+    }
+
+    void compile_let(value kind, value bindings, value body, bool tail) {
+        size_t outer = visible.size();
+        if(kind == rt->sym_let) {
+            // the values are all computed before any of the names are bound
+            std::vector<uint32_t> slots;
+            for(value b = bindings; b != NIL; b = second(b))
+                compile(first(second(first(b))));
+            let_depth++;
+            for(value b = bindings; b != NIL; b = second(b))
+                slots.push_back(declare(first(first(b))));
+            for(auto s = slots.rbegin(); s != slots.rend(); ++s)
+                emit(opcode::store_local, local_operand(0, *s));
+        } else if(kind == rt->sym_letseq) {
+            let_depth++;
+            for(value b = bindings; b != NIL; b = second(b)) {
+                compile(first(second(first(b))));
+                emit(opcode::store_local, local_operand(0, declare(first(first(b)))));
+            }
+        } else {
+            let_depth++;
+            std::vector<uint32_t> slots;
+            for(value b = bindings; b != NIL; b = second(b))
+                slots.push_back(declare(first(first(b))));
+            size_t i = 0;
+            for(value b = bindings; b != NIL; b = second(b)) {
+                compile(first(second(first(b))));
+                emit(opcode::store_local, local_operand(0, slots[i++]));
+            }
+        }
+        compile(body, tail);
+        end_scope(outer);
+    }
+
+    void compile_closure(value arg_list, value body) {
+        auto fn = std::make_shared<function>(arg_list, body, rt->sym_ellipsis);
+        rt->compile_function(*fn, this);
+        c.children.push_back(fn);
+        emit(opcode::closure, c.children.size() - 1);
+    }
+
+    // give the names of defines directly inside a body their slots up front, so that functions
+    // defined together can refer to each other
+    void declare_inner_defines(value body) {
+        if(defines_global()) return;
+        for(; body != NIL; body = second(body)) {
+            value form = first(body);
+            if(type_of(form) != value_type::cons || first(form) != rt->sym_define) continue;
+            value head = first(second(form));
+            value name = type_of(head) == value_type::cons ? first(head) : head;
+            if(!find_in_frame(name).has_value()) declare(name);
+        }
+    }
+
+    // `head` is either the name of a variable or a (name . arguments) list to define a function
+    void compile_define(value head, value form) {
+        bool  is_function   = type_of(head) == value_type::cons;
+        value name          = is_function ? first(head) : head;
+        auto  compile_value = [&]() {
+            if(is_function)
+                compile_closure(second(head), form);
+            else
+                compile(form);
+        };
+        if(defines_global()) {
+            compile_value();
+            emit(opcode::store_global, name >> 4);
+        } else {
+            auto slot = find_in_frame(name);
+            // a function's own name must be in scope for its body to recurse
+            if(!slot.has_value() && is_function) slot = declare(name);
+            compile_value();
+            if(!slot.has_value()) slot = declare(name);
+            emit(opcode::store_local, local_operand(0, slot.value()));
+        }
+        emit(opcode::constant, add_const(NIL));
+    }
+
+    // returns false if `f` does not name a special form
+    bool compile_special(value f, value args, bool tail) {
+        if(f == rt->sym_quote) {
+            emit(opcode::constant, add_const(first(args)));
+        } else if(f == rt->sym_unique_sym) {
+            check_type(first(args), value_type::sym, "unique-symbol expected symbol argument");
+            emit(opcode::unique_sym, add_const(first(args)));
+        } else if(f == rt->sym_let || f == rt->sym_letseq || f == rt->sym_letrec) {
+            compile_let(f, first(args), first(second(args)), tail);
+        } else if(f == rt->sym_begin) {
+            if(args == NIL) emit(opcode::constant, add_const(NIL));
+            declare_inner_defines(args);
+            while(args != NIL) {
+                compile(first(args), tail && second(args) == NIL);
+                args = second(args);
+                if(args != NIL) emit(opcode::pop);
+            }
+        } else if(f == rt->sym_lambda) {
+            compile_closure(first(args), first(second(args)));
+        } else if(f == rt->sym_if) {
+            compile(first(args));
+            auto to_else = emit_jump(opcode::jump_if_false);
+            compile(first(second(args)), tail);
+            auto to_end = emit_jump(opcode::jump);
+            patch_jump(to_else);
+            value else_branch = second(second(args));
+            compile(else_branch == NIL ? NIL : first(else_branch), tail);
+            patch_jump(to_end);
+        } else if(f == rt->sym_set) {
+            compile(first(second(args)));
+            emit_store(first(args));
+            emit(opcode::constant, add_const(NIL));
+        } else if(f == rt->sym_define) {
+            value head = first(args);
+            if(type_of(head) == value_type::sym || type_of(head) == value_type::cons) {
+                compile_define(head, first(second(args)));
+            } else {
+                throw std::runtime_error("invalid define");
+            }
+        } else if(f == rt->sym_quasiquote) {
+            compile_quasiquote(first(args));
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    // a call in tail position replaces the running function instead of returning to it
+    void compile(value x, bool tail = false) {
+        switch(type_of(x)) {
+            case value_type::nil:
+            case value_type::bool_t:
+            case value_type::int_t:
+            case value_type::float_t:
+            case value_type::str:
+            case value_type::vector:
+            case value_type::array:
+            case value_type::vec: emit(opcode::constant, add_const(x)); break;
+
+            case value_type::sym: emit_load(x); break;
+
+            case value_type::cons: {
+                if(compile_special(first(x), second(x), tail)) break;
+                compile(first(x));
+                uint32_t argc = 0;
+                for(value a = second(x); a != NIL; a = second(a), ++argc)
+                    compile(first(a));
+                emit(tail ? opcode::tail_call : opcode::call, argc);
+            } break;
+
+            default:
+                std::ostringstream oss;
+                oss << "cannot evaluate value ";
+                rt->write(oss, x);
+                throw std::runtime_error(oss.str());
+        }
+    }
+};
+
+std::shared_ptr<code> runtime::compile(value x) {
+    auto     c = std::make_shared<code>();
+    compiler cm{this, *c, nullptr, true};
+    c->source = x;
+    cm.compile(x, true);
+    cm.emit(opcode::ret);
+    // the code is a root while its function objects are made, since that can collect garbage
+    compiling.push_back(c.get());
+    try {
+        make_child_objects(*c);
+    } catch(...) {
+        compiling.pop_back();
+        throw;
+    }
+    compiling.pop_back();
+    return c;
+}
+
+void runtime::compile_function(function& fn, compiler* parent) {
+    fn.compiled = std::make_shared<code>();
+    compiler cm{this, *fn.compiled, parent, false};
+    fn.compiled->source = fn.body;
+    for(auto a : fn.arguments)
+        cm.declare(a);
+    cm.compile(fn.body, true);
+    cm.emit(opcode::ret);
+}
+
+void runtime::make_child_objects(code& c) {
+    // nested functions get their objects before the functions around them, so a function object
+    // is never older than the ones its code refers to and minor collections don't need to look in
+    // the templates of old function objects
+    for(auto& child : c.children) {
+        make_child_objects(*child->compiled);
+        value obj = make_function_object(child);
+        c.child_objects.push_back(obj);
+    }
+}
+
+code& runtime::compiled_body(function* fn) {
+    if(fn->compiled == nullptr) {
+        compile_function(*fn, nullptr);
+        compiling.push_back(fn->compiled.get());
+        try {
+            make_child_objects(*fn->compiled);
+        } catch(...) {
+            compiling.pop_back();
+            fn->compiled = nullptr;
+            throw;
+        }
+        compiling.pop_back();
+    }
+    return *fn->compiled;
+}
+}  // namespace emlisp
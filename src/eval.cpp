@@ -1,3 +1,4 @@
+#include "bytecode.h"
 #include "emlisp.h"
 #include <algorithm>
 #include <iostream>
@@ -5,7 +6,6 @@
 
 // TODO:
 //  + fix floats
-//  + vec2..4
 //  + garbage collection
 //  + external value handles
 //  + eval tests
@@ -18,8 +18,34 @@ type_mismatch_error::type_mismatch_error(const type_mismatch_error& e, runtime*
     : std::runtime_error(e.what()), expected(e.expected), actual(e.actual),
       trace(rt->cons(resp, e.trace)) {}
 
-runtime::runtime(size_t heap_size, bool load_std_lib)
-    : heap_size(heap_size), next_extern_value_handle(1) {
+runtime::runtime(size_t heap_size, bool load_std_lib, eval_mode mode)
+    : mode(mode), max_call_depth(1 << 20), heap_size(heap_size), min_heap_size(heap_size),
+      next_extern_value_handle(1) {
+    intern_special_forms();
+
+    heap = new uint8_t[heap_size];
+    assert(heap != nullptr);
+    heap_next = heap;
+    // enough to promote a full nursery, full collections grow it as needed
+    old_capacity = heap_size;
+    old_space    = new uint8_t[old_capacity];
+    old_next     = old_space;
+
+    define_intrinsics();
+    define_array_functions();
+    define_vec_functions();
+    define_hash_functions();
+
+    if(load_std_lib) {
+        define_std_functions();
+        if(EMLISP_STD_IMAGE_SIZE > 0)
+            eval_image(EMLISP_STD_IMAGE, EMLISP_STD_IMAGE_SIZE);
+        else
+            eval_file(EMLISP_STD_SRC);
+    }
+}
+
+void runtime::intern_special_forms() {
     sym_quote    = symbol("quote");
     sym_lambda   = symbol("lambda");
     sym_if       = symbol("if");
@@ -56,23 +82,45 @@ runtime::runtime(size_t heap_size, bool load_std_lib)
            sym_unquote_splicing,
            sym_defmacro,
            sym_begin};
+}
 
-    scopes.emplace_back();
+runtime::runtime(std::shared_ptr<const runtime_base> base, size_t heap_size, eval_mode mode)
+    : base(std::move(base)), mode(mode), max_call_depth(1 << 20), heap_size(heap_size),
+      min_heap_size(heap_size), next_extern_value_handle(1) {
+    base_symbols = this->base->symbols.size();
+    intern_special_forms();
+    globals = this->base->globals;
+    macros  = this->base->macros;
+
+    heap         = new uint8_t[heap_size];
+    heap_next    = heap;
+    old_capacity = heap_size;
+    old_space    = new uint8_t[old_capacity];
+    old_next     = old_space;
+}
 
-    heap = new uint8_t[heap_size];
-    assert(heap != nullptr);
+runtime::runtime(const runtime& from, size_t old_capacity)
+    : base(from.base), base_symbols(from.base_symbols), symbols(from.symbols),
+      symbol_hashes(from.symbol_hashes), symbol_table(from.symbol_table),
+      interned_symbol_count(from.interned_symbol_count), sym_quote(from.sym_quote),
+      sym_lambda(from.sym_lambda), sym_if(from.sym_if), sym_set(from.sym_set),
+      sym_define(from.sym_define), sym_let(from.sym_let), sym_letseq(from.sym_letseq),
+      sym_letrec(from.sym_letrec), sym_quasiquote(from.sym_quasiquote),
+      sym_unquote(from.sym_unquote), sym_unquote_splicing(from.sym_unquote_splicing),
+      sym_defmacro(from.sym_defmacro), sym_begin(from.sym_begin), sym_ellipsis(from.sym_ellipsis),
+      sym_unique_sym(from.sym_unique_sym), sym_macro_error(from.sym_macro_error),
+      reserved_syms(from.reserved_syms), mode(from.mode), max_call_depth(from.max_call_depth),
+      heap_size(from.heap_size), old_capacity(old_capacity), policy(from.policy),
+      min_heap_size(from.min_heap_size), next_extern_value_handle(1) {
+    heap      = new uint8_t[heap_size];
     heap_next = heap;
-
-    define_intrinsics();
-
-    if(load_std_lib) {
-        define_std_functions();
-        eval_file(EMLISP_STD_SRC);
-    }
+    old_space = new uint8_t[old_capacity];
+    old_next  = old_space;
 }
 
 void runtime::eval_file(std::string_view contents) {
-    value code = expand(read_all(contents));
+    // the program lives in the code space, which doesn't move, for as long as the runtime
+    value code = intern_code(expand(read_all(contents)));
     while(code != NIL) {
         eval(first(code));
         code = second(code);
@@ -89,22 +137,36 @@ function::function(value arg_list, value body, value sym_ellipsis) : body(body),
             arg_list = second(arg_list);
         }
     }
+    slot_arguments();
 }
 
-std::shared_ptr<function> runtime::create_function(value arg_list, value body) {
-    std::shared_ptr<function> fn = nullptr;
-    auto existing_fn = std::find_if(std::begin(functions), std::end(functions), [&](auto f) {
-        return f->body == body;  // NOTE: this is a (eq?) check for reference equality on the body,
-                                 // which should make sure that we deduplicate all function bodies
-                                 // coming from the same syntactic location, but is janky!
-    });
-    if(existing_fn != std::end(functions)) {
-        fn = *existing_fn;
-    } else {
-        fn = std::make_shared<function>(arg_list, body, sym_ellipsis);
-        functions.emplace_back(fn);
+void function::slot_arguments() {
+    for(uint32_t i = 0; i < arguments.size(); ++i)
+        tree_slots.emplace(arguments[i], tree_slot{true, i});
+}
+
+value runtime::create_function(value arg_list, value body) {
+    // the body is a part of the lambda form, so it is the same cons for every evaluation of the
+    // form. Bodies that are a single symbol are shared, so the arguments must match too
+    auto [begin, end] = function_index.equal_range(body);
+    for(auto it = begin; it != end; ++it) {
+        function* f = object_function(it->second);
+        value     a = arg_list;
+        if(f->varadic) a = second(a);
+        bool same = true;
+        for(auto arg : f->arguments) {
+            if(a == NIL || first(a) != arg) {
+                same = false;
+                break;
+            }
+            a = second(a);
+        }
+        if(same && a == NIL) return it->second;
     }
-    return fn;
+    value obj = make_function_object(std::make_shared<function>(arg_list, body, sym_ellipsis));
+    function_index.emplace(object_function(obj)->body, obj);
+    young_functions_indexed = true;
+    return obj;
 }
 
 void runtime::compute_closure(value v, const std::set<value>& bound, std::set<value>& free) {
@@ -167,230 +229,420 @@ void runtime::compute_closure(value v, const std::set<value>& bound, std::set<va
     }
 }
 
+void runtime::collect_assigned(value form, std::unordered_set<value>& names) {
+    if(type_of(form) != value_type::cons || first(form) == sym_quote) return;
+    if(first(form) == sym_set && type_of(second(form)) == value_type::cons)
+        names.insert(first(second(form)));
+    for(; type_of(form) == value_type::cons; form = second(form))
+        collect_assigned(first(form), names);
+}
+
+const std::unordered_set<value>& runtime::assigned_names(tree_scope& sc) {
+    if(sc.assigned == nullptr) {
+        auto names = std::make_shared<std::unordered_set<value>>();
+        collect_assigned(sc.form, *names);
+        sc.assigned = std::move(names);
+    }
+    return *sc.assigned;
+}
+
+tree_scope runtime::closure_scope(value fv, std::vector<value>& args) {
+    function*  fn = closure_function(fv);
+    tree_scope sc(fn, std::move(args), *((value*)(fv >> 4) + 1));
+    // every call of the function shares the names its body assigns
+    if(fn->assigned_variables == nullptr) {
+        assigned_names(sc);
+        fn->assigned_variables = sc.assigned;
+    }
+    sc.assigned = fn->assigned_variables;
+    return sc;
+}
+
+value runtime::make_closure(value arg_list, value body, value self_name) {
+    // the function object and then the captured names and values are kept on the stack while the
+    // captures are allocated
+    size_t base = stack.size();
+    stack.push_back(create_function(arg_list, body));
+    function* fn = object_function(stack[base]);
+    // the free names only depend on the form, except that templates for bodies that are a single
+    // symbol are shared by functions with different names
+    bool first_closure = !fn->free_variables.has_value() || fn->free_variables_self != self_name;
+    if(first_closure) {
+        std::set<value> bound(fn->arguments.begin(), fn->arguments.end()), free;
+        bound.insert(reserved_syms.begin(), reserved_syms.end());
+        if(self_name != NIL) bound.insert(self_name);
+        compute_closure(fn->body, bound, free);
+        fn->free_variables.emplace(free.begin(), free.end());
+        fn->free_variables_self = self_name;
+        for(auto s = fn->tree_slots.begin(); s != fn->tree_slots.end();)
+            s = s->second.argument ? std::next(s) : fn->tree_slots.erase(s);
+        fn->capture_count = 0;
+    }
+    auto has_slot = [&](value name) {
+        auto s = fn->tree_slots.find(name);
+        return s != fn->tree_slots.end() && !s->second.argument;
+    };
+    // the names the first closure captured keep their slots, which are left empty for names that
+    // are globals here
+    for(value free_name : *fn->free_variables) {
+        if(!has_slot(free_name)) continue;
+        value v = capture(free_name);
+        stack.push_back(v != UNBOUND ? free_name : NIL);
+        stack.push_back(v != UNBOUND ? v : NIL);
+    }
+    // free names that are not bound locally are globals, which are looked up when they are used
+    for(value free_name : *fn->free_variables) {
+        if(has_slot(free_name)) continue;
+        value v = capture(free_name);
+        if(v != UNBOUND) {
+            if(first_closure)
+                fn->tree_slots.emplace(free_name, tree_slot{false, fn->capture_count++});
+            stack.push_back(free_name);
+            stack.push_back(v);
+        }
+    }
+    // a function defined in a local scope refers to itself through its captures
+    bool   capture_self = self_name != NIL && !scopes.empty();
+    size_t n            = stack.size() - base - 1;
+    // a closure that captures nothing is just the cell
+    value caps = NIL;
+    if(n + 2 * capture_self > 0) {
+        caps = alloc_object(object_kind::captures, n + 2 * capture_self);
+        std::copy(stack.begin() + base + 1, stack.end(), object_data(caps));
+    }
+    value fo = stack[base];
+    stack.resize(base);
+    value closure = cons(fo, caps);
+    closure -= 1;  // cons -> closure
+    if(capture_self) {
+        // the captures may have been promoted while the closure was allocated
+        value* data = object_data(*((value*)(closure >> 4) + 1)) + n;
+        data[0]     = self_name;
+        data[1]     = closure;
+        write_barrier(&data[1], closure);
+    }
+    return closure;
+}
+
+value* runtime::scope_slot(tree_scope& sc, value name, bool& captured) {
+    captured              = false;
+    const tree_slot* slot = nullptr;
+    if(sc.fn != nullptr) {
+        auto s = sc.fn->tree_slots.find(name);
+        if(s != sc.fn->tree_slots.end()) {
+            slot = &s->second;
+            if(slot->argument && sc.args[slot->index] != UNBOUND) return &sc.args[slot->index];
+        }
+    }
+    if(!sc.vars.empty()) {
+        auto f = sc.vars.find(name);
+        if(f != sc.vars.end()) return &f->second;
+    }
+    if(!sc.boundary || sc.captured == NIL) return nullptr;
+    captured    = true;
+    value* data = object_data(sc.captured);
+    size_t n    = header_payload_bytes(data[-1]) / sizeof(value);
+    size_t from = 0;
+    if(slot != nullptr && !slot->argument) {
+        size_t i = 2 * slot->index;
+        if(i < n && data[i] == name) return &data[i + 1];
+    } else if(slot == nullptr && sc.fn != nullptr) {
+        // names without a slot come after the ones the first closure captured
+        from = std::min<size_t>(2 * sc.fn->capture_count, n);
+    }
+    for(size_t i = from; i < n; i += 2)
+        if(data[i] == name) return &data[i + 1];
+    return nullptr;
+}
+
+static value unbox(value v) { return is_object(v, object_kind::box) ? object_data(v)[0] : v; }
+
 value runtime::look_up(value name) {
-    int i;
-    for(i = scopes.size() - 1; i >= 0; i--) {
-        auto f = scopes[i].find(name);
-        if(f != scopes[i].end()) return f->second;
+    for(auto sc = scopes.rbegin(); sc != scopes.rend(); ++sc) {
+        bool   captured;
+        value* v = scope_slot(*sc, name, captured);
+        if(v != nullptr) return unbox(*v);
+        if(sc->boundary) break;
+    }
+    return look_up_global(name);
+}
+
+value runtime::capture(value name) {
+    for(auto sc = scopes.rbegin(); sc != scopes.rend(); ++sc) {
+        bool   captured;
+        value* v = scope_slot(*sc, name, captured);
+        if(v != nullptr) {
+            // the variable is shared with the scope it is bound in if either can change it
+            if(!captured && !is_object(*v, object_kind::box)
+               && assigned_names(*sc).count(name) != 0)
+                *v = make_box(*v);
+            return *v;
+        }
+        if(sc->boundary) break;
+    }
+    return UNBOUND;
+}
+
+value runtime::look_up_global(value name) {
+    size_t ix = name >> 4;
+    if(ix >= globals.size() || globals[ix] == UNBOUND)
+        throw std::runtime_error("unknown name " + symbol_str(name));
+    return globals[ix];
+}
+
+void runtime::set_global(value name, value val) {
+    size_t ix = name >> 4;
+    if(ix >= globals.size()) globals.resize(symbol_count(), UNBOUND);
+    globals[ix] = val;
+}
+
+void runtime::define_local(value name, value val) {
+    if(scopes.empty()) {
+        set_global(name, val);
+        return;
     }
-    throw std::runtime_error("unknown name " + symbol_str(name));
+    tree_scope& sc = scopes.back();
+    value*      v  = nullptr;
+    if(sc.fn != nullptr) {
+        auto s = sc.fn->tree_slots.find(name);
+        if(s != sc.fn->tree_slots.end() && s->second.argument) v = &sc.args[s->second.index];
+    }
+    if(v == nullptr) v = &sc.vars[name];
+    if(is_object(*v, object_kind::box))
+        set_box(*v, val);
+    else
+        *v = val;
+}
+
+void runtime::assign(value name, value val) {
+    for(auto sc = scopes.rbegin(); sc != scopes.rend(); ++sc) {
+        bool   captured;
+        value* v = scope_slot(*sc, name, captured);
+        if(v != nullptr) {
+            if(is_object(*v, object_kind::box))
+                set_box(*v, val);
+            else if(!captured)
+                *v = val;
+            else
+                throw std::runtime_error("captured variable " + symbol_str(name) + " is immutable");
+            return;
+        }
+        if(sc->boundary) break;
+    }
+    size_t ix = name >> 4;
+    if(ix < globals.size() && globals[ix] != UNBOUND)
+        globals[ix] = val;
+    else
+        define_local(name, val);
+}
+
+value runtime::unique_symbol(value name) {
+    check_type(name, value_type::sym, "unique-symbol expected symbol argument");
+    value sym = (uint64_t)(symbol_count() << 4) | (uint64_t)value_type::sym;
+    // the copy of the name is never interned, so reading it gives the original symbol
+    symbols.push_back(symbol_name(name >> 4));
+    symbol_hashes.push_back(std::hash<std::string_view>{}(symbols.back()));
+    return sym;
 }
 
 value runtime::apply_quasiquote(value s) {
     if(type_of(s) != value_type::cons) return s;
-    if(first(s) == sym_unquote) return eval(first(second(s)));
+    if(first(s) == sym_unquote) return tree_eval(first(second(s)));
+    value      list = NIL, head = NIL, end = NIL;
+    root_guard g(this, s, list, head, end);
     if(type_of(first(s)) == value_type::cons && first(first(s)) == sym_unquote_splicing) {
-        value list = eval(first(second(first(s))));
+        list = tree_eval(first(second(first(s))));
         if(list == NIL) return apply_quasiquote(second(s));
         check_type(list, value_type::cons, "unquote-splicing expression must yield a list");
-        value end = list;
-        while(second(end) != NIL)
-            end = second(end);
-        second(end) = apply_quasiquote(second(s));
-        return list;
+        // copy the spliced list so that the value it came from is left intact
+        head = cons(first(list), NIL);
+        end  = head;
+        for(list = second(list); list != NIL; list = second(list)) {
+            value c = cons(first(list), NIL);
+            set_second(end, c);
+            end = c;
+        }
+        value rest = apply_quasiquote(second(s));
+        set_second(end, rest);
+        return head;
     }
-    return cons(apply_quasiquote(first(s)), apply_quasiquote(second(s)));
+    head       = apply_quasiquote(first(s));
+    value rest = apply_quasiquote(second(s));
+    return cons(head, rest);
 }
 
 value runtime::eval_list(value x) {
-    if(x == NIL) return NIL;
-    return cons(eval(first(x)), eval_list(second(x)));
+    // the values are kept on the stack until they are all evaluated
+    size_t     base = stack.size();
+    root_guard g(this, x);
+    for(; x != NIL; x = second(x)) {
+        value v = tree_eval(first(x));
+        stack.push_back(v);
+    }
+    return list_from_stack(base);
+}
+
+value runtime::call_closure(value fv, std::vector<value>& args) {
+    function* fn = closure_function(fv);
+    scopes.push_back(closure_scope(fv, args));
+    value result = tree_eval(fn->body);
+    scopes.pop_back();
+    return result;
+}
+
+std::vector<value> runtime::bind_arguments(function* fn, value arguments, bool evaluate) {
+    std::vector<value> fr;
+    if(fn->varadic) {
+        fr.push_back(evaluate ? eval_list(arguments) : arguments);
+    } else {
+        // the values are kept on the stack until they are all evaluated
+        size_t     base = stack.size();
+        root_guard g(this, arguments);
+        for(size_t i = 0; i < fn->arguments.size(); ++i) {
+            if(arguments == NIL) {
+                stack.resize(base);
+                throw std::runtime_error("argument count mismatch");
+            }
+            value v = evaluate ? tree_eval(first(arguments)) : first(arguments);
+            stack.push_back(v);
+            arguments = second(arguments);
+        }
+        fr.assign(stack.begin() + base, stack.end());
+        stack.resize(base);
+    }
+    return fr;
 }
 
 value runtime::apply(value fv, value arguments) {
-    value result = NIL;
-    // this->write(std::cout << "!!! ", fv) << "\n";
     if(type_of(fv) == value_type::_extern) {
         extern_func_t fn      = (extern_func_t)(*(uint64_t*)(fv >> 4) >> 4);
-        void*         closure = (frame*)(*((uint64_t*)(fv >> 4) + 1) >> 4);
-        value         a       = eval_list(arguments);
-        result                = (*fn)(this, a, closure);
-    } else {
-        check_type(fv, value_type::closure, "expected function for function call");
-        function* fn = (function*)(*(uint64_t*)(fv >> 4) >> 4);
-        // std::cout << "calling funtion " << std::hex << fn << std::dec << "/" <<
-        // fn->arguments.size() << "\n\tbody = "; this->write(std::cout, fn->body) << "\n";
-        frame*                           closure = (frame*)(*((uint64_t*)(fv >> 4) + 1) >> 4);
-        std::unordered_map<value, value> fr;
-        value                            args = arguments;
-        for(size_t i = 0; i < fn->arguments.size(); ++i) {
-            if(args == NIL) throw std::runtime_error("argument count mismatch");
-            auto arg = fn->arguments[i];
-            // std::cout << "function " << std::hex << fn << std::dec << "| i = " << i << ",
-            // fa[i] = ";
-            //  this->write(std::cout, arg);
-            // std::cout << ", a[i] = ";
-            //  this->write(std::cout, first(args));
-            // std::cout << " →\n";
-            auto val = eval(first(args));  // some how executing this line of code manages to wreck
-                                           // fn->arguments and also somehow takes out scoping info
-                                           // because at it is currently written, it complains that
-                                           // it can't find local variables this->write(std::cout,
-                                           // val); std::cout << "\n";
-            fr.emplace(arg, val);
-            // fr[fn->arguments[i]] = eval(first(args));
-            args = second(args);
+        void*         closure = (void*)(*((uint64_t*)(fv >> 4) + 1) >> 4);
+        return (*fn)(this, arguments, closure);
+    }
+    check_type(fv, value_type::closure, "expected function for function call");
+    function* fn = closure_function(fv);
+    if(is_compiled_closure(fv)) {
+        // the closure and the arguments are kept on the stack while the environment is allocated
+        size_t base = stack.size();
+        stack.push_back(fv);
+        for(; arguments != NIL; arguments = second(arguments))
+            stack.push_back(first(arguments));
+        value env;
+        try {
+            env = bind_env(
+                fn, *((value*)(fv >> 4) + 1), stack.data() + base + 1, stack.size() - base - 1
+            );
+        } catch(...) {
+            stack.resize(base);
+            throw;
         }
-        scopes.push_back(closure->data);
-        scopes.push_back(fr);
-        /*std::cout << "scopes:\n";
-          for(const auto& sc : scopes) {
-          std::cout << "\t{  ";
-          for(const auto&[name, val] : sc) {
-          this->write(std::cout, name) << ": ";
-          this->write(std::cout, val) << "  ";
-          }
-          std::cout << "}\n";
-          }*/
-
-        result = eval(fn->body);
-        scopes.pop_back();
-        closure->data = scopes[scopes.size() - 1];
-        scopes.pop_back();
+        fv = stack[base];
+        stack.resize(base);
+        return execute(*fn->compiled, env, *(value*)(fv >> 4));
     }
-    return result;
+    auto fr = bind_arguments(fn, arguments, false);
+    return call_closure(fv, fr);
 }
 
-std::optional<value> runtime::apply_builtin(value f, value arguments) {
-    value result = NIL;
-    if(f == sym_quote) {
-        result = first(arguments);
-    } else if(f == sym_unique_sym) {
-        value name = first(arguments);
-        check_type(name, value_type::sym, "unique-symbol expected symbol argument");
-        value sym = (uint64_t)(symbols.size() << 4) | (uint64_t)value_type::sym;
-        symbols.push_back(symbols[name >> 4]);
-        return sym;
-    } else if(f == sym_let) {
-        value                            bindings = first(arguments);
-        value                            body     = first(second(arguments));
-        std::unordered_map<value, value> scope;
-        value                            bc = bindings;
+value runtime::enter_let(value kind, value arguments) {
+    value      bindings = first(arguments);
+    value      bc       = bindings;
+    root_guard g(this, arguments, bindings, bc);
+    // the form of the scope around the let holds it, so the names assigned in one cover the other
+    auto enter = [&](tree_scope scope) {
+        if(!scopes.empty()) scope.assigned = scopes.back().assigned;
+        scopes.push_back(std::move(scope));
+    };
+    if(kind == sym_let) {
+        // the values are kept on the stack until they are all evaluated
+        size_t base = stack.size();
         while(bc != NIL) {
-            value name = first(first(bc));
-            value val  = first(second(first(bc)));
-            check_type(name, value_type::sym, "let binding name must be symbol");
-            scope[name] = eval(val);
-            bc          = second(bc);
+            check_type(first(first(bc)), value_type::sym, "let binding name must be symbol");
+            value v = tree_eval(first(second(first(bc))));
+            stack.push_back(v);
+            bc = second(bc);
         }
-        scopes.push_back(scope);
-        result = eval(body);
-        scopes.pop_back();
-    } else if(f == sym_letseq) {
-        value bindings = first(arguments);
-        value body     = first(second(arguments));
-        scopes.emplace_back();
-        value bc = bindings;
+        tree_scope scope(arguments);
+        size_t     i = base;
+        for(bc = bindings; bc != NIL; bc = second(bc))
+            scope.vars[first(first(bc))] = stack[i++];
+        stack.resize(base);
+        enter(std::move(scope));
+    } else if(kind == sym_letseq) {
+        enter(tree_scope(arguments));
         while(bc != NIL) {
             value name = first(first(bc));
             value val  = first(second(first(bc)));
             check_type(name, value_type::sym, "let* binding name must be symbol");
-            scopes[scopes.size() - 1][name] = eval(val);
-            bc                              = second(bc);
-        }
-        result = eval(body);
-        scopes.pop_back();
-    } else if(f == sym_letrec) {
-        value                            bindings = first(arguments);
-        value                            body     = first(second(arguments));
-        std::unordered_map<value, value> scope;
-        value                            bc = bindings;
-        while(bc != NIL) {
-            value name = first(first(bc));
-            check_type(name, value_type::sym, "letrec binding name must be symbol");
-            scope[name] = NIL;
-            bc          = second(bc);
+            define_local(name, tree_eval(val));
+            bc = second(bc);
         }
-        scopes.push_back(scope);
-        bc = bindings;
+    } else {
+        // the bindings are boxed so that closures in the initializers see their final values
+        enter(tree_scope(arguments));
         while(bc != NIL) {
             value name = first(first(bc));
-            value val  = first(second(first(bc)));
             check_type(name, value_type::sym, "letrec binding name must be symbol");
-            scope[name] = eval(val);
-            bc          = second(bc);
-        }
-        // TODO: this doesn't really work as intended because closures copy values
-        //       and so when we reset scopes here with the new values, any captured
-        //       values won't get changed in closures and will simply remain NIL
-        scopes[scopes.size() - 1] = scope;
-        result                    = eval(body);
-        scopes.pop_back();
-    }
-
-    else if(f == sym_begin) {
-        value a = arguments;
-        while(a != NIL) {
-            result = eval(first(a));
-            a      = second(a);
+            scopes.back().vars[name] = make_box(NIL);
+            bc                       = second(bc);
         }
+        for(bc = bindings; bc != NIL; bc = second(bc))
+            define_local(first(first(bc)), tree_eval(first(second(first(bc)))));
     }
+    return first(second(arguments));
+}
 
-    else if(f == sym_lambda) {
-        value args = first(arguments);
-        value body = first(second(arguments));
-        // create function
-        auto fn = create_function(args, body);
-        // TODO: deal with varadic functions
-        frame*          clo = alloc_frame();
-        std::set<value> bound(fn->arguments.begin(), fn->arguments.end());
-        std::set<value> free;
-        bound.insert(reserved_syms.begin(), reserved_syms.end());
-        compute_closure(body, bound, free);
-        for(value free_name : free)
-            clo->set(free_name, look_up(free_name));
-        value closure = cons(
-            ((uint64_t)fn.get() << 4) | (uint64_t)value_type::_extern,
-            (((uint64_t)clo) << 4) | (uint64_t)value_type::_extern
-        );
-        closure -= 1;  // cons -> closure
-        result = closure;
-    }
-
-    else if(f == sym_if) {
-        value cond = eval(first(arguments));
+bool runtime::enter_tail_form(value& x) {
+    value f         = first(x);
+    value arguments = second(x);
+    if(f == sym_if) {
+        value cond     = tree_eval(first(arguments));
+        value branches = second(second(x));
         if(cond != FALSE)
-            result = eval(first(second(arguments)));
+            x = first(branches);
         else
-            result = eval(first(second(second(arguments))));
-    } else if(f == sym_set) {
-        value name = first(arguments);
-        value val  = eval(first(second(arguments)));
-        int   i;
-        for(i = scopes.size() - 1; i >= 0; i--) {
-            auto f = scopes[i].find(name);
-            if(f != scopes[i].end()) f->second = val;
+            x = second(branches) == NIL ? NIL : first(second(branches));
+    } else if(f == sym_begin) {
+        if(arguments == NIL) {
+            x = NIL;
+            return true;
         }
-        scopes[scopes.size() - 1][name] = val;
-        result                          = NIL;
+        root_guard g(this, arguments);
+        for(; second(arguments) != NIL; arguments = second(arguments))
+            tree_eval(first(arguments));
+        x = first(arguments);
+    } else if(f == sym_let || f == sym_letseq || f == sym_letrec) {
+        x = enter_let(f, arguments);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+std::optional<value> runtime::apply_builtin(value f, value arguments) {
+    value result = NIL;
+    if(f == sym_quote) {
+        result = first(arguments);
+    } else if(f == sym_unique_sym) {
+        result = unique_symbol(first(arguments));
+    }
+
+    else if(f == sym_lambda) {
+        result = make_closure(first(arguments), first(second(arguments)));
+    }
+
+    else if(f == sym_set) {
+        assign(first(arguments), tree_eval(first(second(arguments))));
+        result = NIL;
     } else if(f == sym_define) {
         value head = first(arguments);
         if(type_of(head) == value_type::sym) {
-            value val                       = first(second(arguments));
-            scopes[scopes.size() - 1][head] = eval(val);
-            result                          = NIL;
+            define_local(head, tree_eval(first(second(arguments))));
+            result = NIL;
         } else if(type_of(head) == value_type::cons) {
             value name = first(head);
-            value args = second(head);
-            value body = first(second(arguments));
-            // create function
-            auto fn = create_function(args, body);
-            // TODO: deal with varadic functions
-            frame*          clo = alloc_frame();
-            std::set<value> bound(fn->arguments.begin(), fn->arguments.end()), free;
-            bound.insert(reserved_syms.begin(), reserved_syms.end());
-            bound.insert(name);
-            compute_closure(body, bound, free);
-            for(value free_name : free)
-                clo->set(free_name, look_up(free_name));
-            value closure = cons(
-                ((uint64_t)fn.get() << 4) | (uint64_t)value_type::_extern,
-                (((uint64_t)clo) << 4) | (uint64_t)value_type::_extern
-            );
-            closure -= 1;             // cons -> closure
-            clo->set(name, closure);  // enable recursion
-            scopes[scopes.size() - 1][name] = closure;
-            result                          = NIL;
+            define_local(name, make_closure(second(head), first(second(arguments)), name));
+            result = NIL;
         } else {
             throw std::runtime_error("invalid define");
         }
@@ -403,33 +655,70 @@ std::optional<value> runtime::apply_builtin(value f, value arguments) {
 }
 
 value runtime::eval(value x) {
+    if(mode == eval_mode::bytecode) {
+        auto c = compile(x);
+        return execute(*c, NIL);
+    }
+    return tree_eval(x);
+}
+
+value runtime::tree_eval(value x) {
+    // scopes entered by forms in tail position are only left when the whole evaluation is done,
+    // and a call in tail position replaces them, so iterative code runs in constant space
+    size_t     base       = scopes.size();
+    size_t     stack_base = stack.size();
+    value      fv         = NIL;
+    root_guard g(this, x, fv);
+    auto       leave = [&](value result) {
+        scopes.erase(scopes.begin() + base, scopes.end());
+        return result;
+    };
     try {
-        value result = NIL;
-        switch(type_of(x)) {
-            case value_type::nil:
-            case value_type::bool_t:
-            case value_type::int_t:
-            case value_type::float_t:
-            case value_type::str: result = x; break;
-
-            case value_type::sym: result = look_up(x); break;
-
-            case value_type::cons: {
-                auto b = apply_builtin(first(x), second(x));
-                if(b.has_value())
-                    result = b.value();
-                else
-                    result = apply(eval(first(x)), second(x));
-            } break;
-
-            default:
-                std::ostringstream oss;
-                oss << "cannot evaluate value ";
-                write(oss, x);
-                throw std::runtime_error(oss.str());
+        while(true) {
+            switch(type_of(x)) {
+                case value_type::nil:
+                case value_type::bool_t:
+                case value_type::int_t:
+                case value_type::float_t:
+                case value_type::str:
+                case value_type::vector:
+                case value_type::array:
+                case value_type::vec: return leave(x);
+
+                case value_type::sym: return leave(look_up(x));
+
+                case value_type::cons: {
+                    if(enter_tail_form(x)) continue;
+                    auto b = apply_builtin(first(x), second(x));
+                    if(b.has_value()) return leave(b.value());
+                    fv = tree_eval(first(x));
+                    if(type_of(fv) != value_type::closure || is_compiled_closure(fv)) {
+                        value args = eval_list(second(x));
+                        return leave(apply(fv, args));
+                    }
+                    function* fn   = closure_function(fv);
+                    auto      args = bind_arguments(fn, second(x), true);
+                    scopes.erase(scopes.begin() + base, scopes.end());
+                    scopes.push_back(closure_scope(fv, args));
+                    x = fn->body;
+                } break;
+
+                default:
+                    std::ostringstream oss;
+                    oss << "cannot evaluate value ";
+                    write(oss, x);
+                    throw std::runtime_error(oss.str());
+            }
         }
-        return result;
-    } catch(const type_mismatch_error& e) { throw type_mismatch_error(e, this, x); }
+    } catch(const type_mismatch_error& e) {
+        scopes.erase(scopes.begin() + base, scopes.end());
+        stack.resize(stack_base);
+        throw type_mismatch_error(e, this, x);
+    } catch(...) {
+        scopes.erase(scopes.begin() + base, scopes.end());
+        stack.resize(stack_base);
+        throw;
+    }
 }
 
 void runtime::define_fn(std::string_view name, extern_func_t fn, void* data) {
@@ -442,14 +731,19 @@ void runtime::define_fn(std::string_view name, extern_func_t fn, void* data) {
     );
 }
 
-void runtime::define_global(std::string_view name, value val) { scopes[0][symbol(name)] = val; }
+void runtime::define_global(std::string_view name, value val) { set_global(symbol(name), val); }
+
+value runtime::global(std::string_view name) { return look_up_global(symbol(name)); }
 
 value runtime::expand(value v) {
     if(type_of(v) != value_type::cons) return v;
+    // interned code was expanded before it was interned
+    if(in_code_space((void*)(v >> 4))) return v;
+    root_guard g(this, v);
     if(first(v) == sym_defmacro) {
         value head          = first(second(v));
         value body          = first(second(second(v)));
-        macros[first(head)] = create_function(second(head), body);
+        macros[first(head)] = std::make_shared<function>(second(head), body, sym_ellipsis);
         return NIL;
     }
     if(first(v) == sym_macro_error) {
@@ -460,26 +754,42 @@ value runtime::expand(value v) {
     if(type_of(first(v)) == value_type::sym) {
         auto mc = macros.find(first(v));
         if(mc != macros.end()) {
-            auto                             fn = mc->second;
-            std::unordered_map<value, value> arguments;
+            auto fn = mc->second;
+            if(mode == eval_mode::bytecode) {
+                // the arguments are kept on the stack while the environment is allocated
+                size_t base = stack.size();
+                for(value a = second(v); a != NIL; a = second(a))
+                    stack.push_back(first(a));
+                code& body = compiled_body(fn.get());
+                value env;
+                try {
+                    env = bind_env(fn.get(), NIL, stack.data() + base, stack.size() - base);
+                } catch(...) {
+                    stack.resize(base);
+                    throw;
+                }
+                stack.resize(base);
+                return expand(execute(body, env));
+            }
+            // arguments the form leaves out are unbound
+            std::vector<value> args(fn->arguments.size(), UNBOUND);
             if(fn->varadic) {
-                arguments[fn->arguments[0]] = second(v);
+                args[0] = second(v);
             } else {
-                value  a = second(v);
-                size_t i = 0;
-                while(a != NIL) {
-                    arguments[fn->arguments[i++]] = first(a);
-                    a                             = second(a);
-                }
+                value a = second(v);
+                for(size_t i = 0; a != NIL && i < args.size(); ++i, a = second(a))
+                    args[i] = first(a);
             }
-            scopes.push_back(arguments);
-            auto res = eval(fn->body);
+            scopes.emplace_back(fn.get(), std::move(args), NIL);
+            auto res = tree_eval(fn->body);
             scopes.pop_back();
             return expand(res);
         }
     }
-    first(v)  = expand(first(v));
-    second(v) = expand(second(v));
+    value x = expand(first(v));
+    set_first(v, x);
+    x = expand(second(v));
+    set_second(v, x);
     return v;
 }
 }  // namespace emlisp
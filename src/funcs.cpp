@@ -41,6 +41,9 @@ void runtime::define_intrinsics() {
     define_fn("proc?", [](runtime* rt, value args, void* d) {
         return rt->from_bool(type_of(first(args)) == value_type::closure);
     });
+    define_fn("vector?", [](runtime* rt, value args, void* d) {
+        return rt->from_bool(type_of(first(args)) == value_type::vector);
+    });
 
     // bool //
     define_fn("not", [](runtime* rt, value args, void* d) {
@@ -71,6 +74,7 @@ void runtime::define_intrinsics() {
             }                                                                                      \
             return rt->from_float(result);                                                         \
         }                                                                                          \
+        if(ty == value_type::vec) return rt->vec_math(NAME[0], args);                              \
         throw std::runtime_error("expected numerical type to math " NAME);                         \
     })
 
@@ -116,20 +120,75 @@ void runtime::define_intrinsics() {
 
     // string //
     define_fn("string-length", [](runtime* rt, value args, void* d) {
-        value v = first(args);
-        check_type(v, value_type::str);
-        return rt->from_int(*(uint32_t*)(v >> 4));
+        return rt->from_int(rt->to_str(first(args)).size());
     });
 
     define_fn("string->symbol", [](runtime* rt, value args, void* d) {
         return rt->symbol(rt->to_str(first(args)));
     });
 
+    define_fn("string=?", [](runtime* rt, value args, void* d) {
+        value b = first(second(args));
+        if(type_of(b) != value_type::str) return FALSE;
+        return rt->from_bool(rt->to_str(first(args)) == rt->to_str(b));
+    });
+
+    // vector //
+    define_fn("make-vector", [](runtime* rt, value args, void* d) {
+        int64_t length = to_int(first(args));
+        if(length < 0) throw std::out_of_range("negative vector length");
+        return rt->make_vector(length, second(args) == NIL ? NIL : first(second(args)));
+    });
+
+    define_fn("vector", [](runtime* rt, value args, void* d) {
+        size_t base = rt->stack.size();
+        for(; args != NIL; args = second(args))
+            rt->stack.push_back(first(args));
+        return rt->vector_from_stack(base);
+    });
+
+    define_fn("vector-length", [](runtime* rt, value args, void* d) {
+        return rt->from_int(vector_length(first(args)));
+    });
+
+    define_fn("vector-ref", [](runtime* rt, value args, void* d) {
+        return vector_ref(first(args), to_int(first(second(args))));
+    });
+
+    define_fn("vector-set!", [](runtime* rt, value args, void* d) {
+        value v = first(second(second(args)));
+        rt->vector_set(first(args), to_int(first(second(args))), v);
+        return v;
+    });
+
+    define_fn("list->vector", [](runtime* rt, value args, void* d) {
+        size_t base = rt->stack.size();
+        for(value l = first(args); l != NIL; l = second(l))
+            rt->stack.push_back(first(l));
+        return rt->vector_from_stack(base);
+    });
+
+    define_fn("vector->list", [](runtime* rt, value args, void* d) {
+        value  vec  = first(args);
+        size_t base = rt->stack.size();
+        for(size_t i = 0, n = vector_length(vec); i < n; ++i)
+            rt->stack.push_back(object_data(vec)[i]);
+        return rt->list_from_stack(base);
+    });
+
     // symbol //
     define_fn("symbol->string", [](runtime* rt, value args, void* d) {
         return rt->from_str(rt->symbol_str(first(args)));
     });
 }
 
-void runtime::define_std_functions() {}
+void runtime::define_std_functions() {
+    // a runtime attached to a `runtime_pool` replaces these with ones that run the call on a worker
+    // and return a future, here the call is made right away and its value is its own future.
+    // `(future-call 'f f args)` gets the head of the call both as it was written and as a value
+    define_fn("future-call", [](runtime* rt, value args, void* d) {
+        return rt->apply(first(second(args)), first(second(second(args))));
+    });
+    define_fn("touch", [](runtime* rt, value args, void* d) { return first(args); });
+}
 }  // namespace emlisp
@@ -0,0 +1,426 @@
+#include "emlisp.h"
+#include <cstring>
+
+namespace emlisp {
+namespace {
+// the `moves` of a table that is frozen in a base, where nothing moves, and of one that was just
+// copied to new addresses
+constexpr int64_t PERMANENT = -1, MOVED = -2;
+// `flags`: keys compare with `equal?`, and some keys hashed by address are in the nursery, so that
+// minor collections move them too
+constexpr int64_t EQUAL_KEYS = 1, YOUNG_ADDRESS_KEYS = 2;
+// the most nodes of a structure an `equal?` table looks at to hash it, which also stops at cycles
+constexpr size_t HASH_BUDGET = 16;
+
+inline value& word(value h, hash_word w) { return object_data(h)[(size_t)w]; }
+
+inline int64_t int_word(value h, hash_word w) { return (int64_t)word(h, w) >> 4; }
+
+// ints don't refer to the heap, but an incremental collection still has to copy the words again,
+// see `runtime::hash_touch`
+inline void set_int_word(value h, hash_word w, int64_t x) {
+    word(h, w) = ((uint64_t)x << 4) | (uint64_t)value_type::int_t;
+}
+
+inline uint64_t mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+uint64_t hash_bytes(const uint8_t* p, size_t n) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for(size_t i = 0; i < n; ++i)
+        h = (h ^ p[i]) * 0x100000001b3ull;
+    return mix(h);
+}
+
+// `by_address` is set if the hash depends on where something is in the heap
+uint64_t hash_of(value v, bool equal, bool& by_address, size_t& budget) {
+    switch(type_of(v)) {
+        case value_type::str: {
+            auto* o = (value*)(v >> 4);
+            return hash_bytes((const uint8_t*)(o + 1), header_payload_bytes(*o));
+        }
+        case value_type::vec: {
+            // 0 and -0 are equal, so they have to hash the same
+            float xs[4];
+            for(size_t i = 0; i < 4; ++i)
+                xs[i] = vec_data(v)[i] == 0 ? 0.f : vec_data(v)[i];
+            return hash_bytes((const uint8_t*)xs, sizeof(xs)) ^ vec_dim(v);
+        }
+        case value_type::cons:
+            if(!equal) break;
+            {
+                uint64_t h = 0x9e3779b97f4a7c15ull;
+                for(; type_of(v) == value_type::cons && budget > 0; v = second(v)) {
+                    budget--;
+                    h = mix(h ^ hash_of(first(v), true, by_address, budget));
+                }
+                if(type_of(v) != value_type::cons)
+                    h = mix(h ^ hash_of(v, true, by_address, budget));
+                return h;
+            }
+        case value_type::vector:
+            if(!equal) break;
+            {
+                uint64_t h = mix(vector_length(v));
+                for(size_t i = 0, n = vector_length(v); i < n && budget > 0; ++i) {
+                    budget--;
+                    h = mix(h ^ hash_of(vector_ref(v, i), true, by_address, budget));
+                }
+                return h;
+            }
+        default: break;
+    }
+    if(is_heap_type(type_of(v))) by_address = true;
+    return mix(v);
+}
+
+inline uint64_t hash_key(value key, bool equal, bool& by_address) {
+    size_t budget = HASH_BUDGET;
+    return hash_of(key, equal, by_address, budget);
+}
+
+bool same_key(value a, value b, bool equal) {
+    if(a == b) return true;
+    if(!equal || type_of(a) != type_of(b)) return false;
+    switch(type_of(a)) {
+        case value_type::str: {
+            auto *x = (value*)(a >> 4), *y = (value*)(b >> 4);
+            return header_payload_bytes(*x) == header_payload_bytes(*y)
+                   && std::memcmp(x + 1, y + 1, header_payload_bytes(*x)) == 0;
+        }
+        case value_type::vec:
+            if(vec_dim(a) != vec_dim(b)) return false;
+            for(size_t i = 0; i < 4; ++i)
+                if(vec_data(a)[i] != vec_data(b)[i]) return false;
+            return true;
+        case value_type::cons:
+            for(; type_of(a) == value_type::cons && type_of(b) == value_type::cons;
+                a = second(a), b = second(b))
+                if(!same_key(first(a), first(b), true)) return false;
+            return same_key(a, b, true);
+        case value_type::vector:
+            if(vector_length(a) != vector_length(b)) return false;
+            for(size_t i = 0, n = vector_length(a); i < n; ++i)
+                if(!same_key(vector_ref(a, i), vector_ref(b, i), true)) return false;
+            return true;
+        default: return false;
+    }
+}
+
+inline size_t slot_count(value h) { return vector_length(word(h, hash_word::entries)) / 2; }
+
+std::vector<std::pair<value, value>> entries_of(value h) {
+    std::vector<std::pair<value, value>> pairs;
+    pairs.reserve(hash_count(h));
+    value* e = object_data(word(h, hash_word::entries));
+    for(size_t i = 0, n = slot_count(h); i < n; ++i)
+        if(e[2 * i] != UNBOUND) pairs.emplace_back(e[2 * i], e[2 * i + 1]);
+    return pairs;
+}
+
+// put `pairs` into the entries of `h`, which are all free, storing with `store(slot, v)`.
+// `young(k)` says whether a key is in the nursery
+template<typename Store, typename Young>
+void fill_entries(
+    value h, const std::vector<std::pair<value, value>>& pairs, Store&& store, Young&& young
+) {
+    bool    equal = (int_word(h, hash_word::flags) & EQUAL_KEYS) != 0;
+    value*  e     = object_data(word(h, hash_word::entries));
+    size_t  mask  = slot_count(h) - 1;
+    int64_t address_keys = 0, flags = equal ? EQUAL_KEYS : 0;
+    for(auto& [k, v] : pairs) {
+        bool   by_address = false;
+        size_t i          = hash_key(k, equal, by_address) & mask;
+        while(e[2 * i] != UNBOUND)
+            i = (i + 1) & mask;
+        store(&e[2 * i], k);
+        store(&e[2 * i + 1], v);
+        if(!by_address) continue;
+        address_keys++;
+        if(young(k)) flags |= YOUNG_ADDRESS_KEYS;
+    }
+    set_int_word(h, hash_word::count, (int64_t)pairs.size());
+    set_int_word(h, hash_word::address_keys, address_keys);
+    set_int_word(h, hash_word::flags, flags);
+}
+}  // namespace
+
+void mark_hash_table_moved(value* obj) {
+    obj[1 + (size_t)hash_word::moves] = ((uint64_t)MOVED << 4) | (uint64_t)value_type::int_t;
+}
+
+void freeze_hash_table(value* obj) {
+    value h       = ((value)obj << 4) | (value)value_type::hash;
+    auto  pairs   = entries_of(h);
+    value entries = word(h, hash_word::entries);
+    std::fill(object_data(entries), object_data(entries) + 2 * slot_count(h), UNBOUND);
+    fill_entries(h, pairs, [](value* slot, value v) { *slot = v; }, [](value) { return false; });
+    set_int_word(h, hash_word::moves, PERMANENT);
+    set_int_word(h, hash_word::full_moves, PERMANENT);
+}
+
+value runtime::make_hash(bool equal, size_t capacity) {
+    // tables are at most half full
+    size_t slots = 8;
+    while(slots < 2 * capacity)
+        slots *= 2;
+    value entries = make_vector(2 * slots, UNBOUND);
+    auto* o       = (value*)alloc((1 + (size_t)hash_word::size) * sizeof(value), entries);
+    o[0]          = make_header(object_kind::hash_table, (size_t)hash_word::size * sizeof(value));
+    value h       = (((uint64_t)o) << 4) | (uint64_t)value_type::hash;
+    set_int_word(h, hash_word::count, 0);
+    set_int_word(h, hash_word::flags, equal ? EQUAL_KEYS : 0);
+    set_int_word(h, hash_word::address_keys, 0);
+    set_int_word(h, hash_word::moves, (int64_t)collections);
+    set_int_word(h, hash_word::full_moves, (int64_t)full_collections);
+    word(h, hash_word::entries) = entries;
+    return h;
+}
+
+size_t runtime::hash_slot(value h, value key, bool& found, bool& by_address) {
+    bool   equal = (int_word(h, hash_word::flags) & EQUAL_KEYS) != 0;
+    value* e     = object_data(word(h, hash_word::entries));
+    size_t mask  = slot_count(h) - 1;
+    by_address   = false;
+    for(size_t i = hash_key(key, equal, by_address) & mask;; i = (i + 1) & mask) {
+        if(e[2 * i] == UNBOUND) {
+            found = false;
+            return i;
+        }
+        if(same_key(e[2 * i], key, equal)) {
+            found = true;
+            return i;
+        }
+    }
+}
+
+void runtime::hash_touch(value h) {
+    for(size_t w = 0; w < (size_t)hash_word::entries; ++w)
+        write_barrier(&word(h, (hash_word)w), word(h, (hash_word)w));
+}
+
+void runtime::hash_fill(value h, const std::vector<std::pair<value, value>>& pairs) {
+    value* e = object_data(word(h, hash_word::entries));
+    for(size_t i = 0, n = 2 * slot_count(h); i < n; ++i) {
+        e[i] = UNBOUND;
+        write_barrier(&e[i], UNBOUND);
+    }
+    bool equal = (int_word(h, hash_word::flags) & EQUAL_KEYS) != 0;
+    fill_entries(
+        h,
+        pairs,
+        [&](value* slot, value v) {
+            *slot = v;
+            write_barrier(slot, v);
+        },
+        // what an `equal?` key holds could be younger than the key
+        [&](value k) { return equal || in_nursery((void*)(k >> 4)); }
+    );
+    set_int_word(h, hash_word::moves, (int64_t)collections);
+    set_int_word(h, hash_word::full_moves, (int64_t)full_collections);
+    hash_touch(h);
+}
+
+void runtime::hash_prepare(value h) {
+    int64_t moves = int_word(h, hash_word::moves);
+    if(moves == PERMANENT) return;
+    if(int_word(h, hash_word::address_keys) == 0) {
+        if(moves != MOVED) return;
+        set_int_word(h, hash_word::moves, (int64_t)collections);
+        set_int_word(h, hash_word::full_moves, (int64_t)full_collections);
+        hash_touch(h);
+        return;
+    }
+    if(moves != MOVED) {
+        // keys in the old space only move in full collections
+        if((int_word(h, hash_word::flags) & YOUNG_ADDRESS_KEYS) != 0
+               ? moves == (int64_t)collections
+               : int_word(h, hash_word::full_moves) == (int64_t)full_collections)
+            return;
+    }
+    hash_fill(h, entries_of(h));
+}
+
+std::optional<value> runtime::hash_ref(value h, value key) {
+    check_type(h, value_type::hash);
+    hash_prepare(h);
+    bool   found, by_address;
+    size_t i = hash_slot(h, key, found, by_address);
+    if(!found) return std::nullopt;
+    return object_data(word(h, hash_word::entries))[2 * i + 1];
+}
+
+void runtime::hash_set(value h, value key, value v) {
+    check_type(h, value_type::hash);
+    if(in_base((void*)(h >> 4))) throw std::runtime_error("can't change the values of a base");
+    hash_prepare(h);
+    bool   found, by_address;
+    size_t i = hash_slot(h, key, found, by_address);
+    if(!found && 2 * (hash_count(h) + 1) > slot_count(h)) {
+        root_guard g(this, h, key, v);
+        value      bigger = make_vector(4 * slot_count(h), UNBOUND);
+        // the old entries are read after the allocation, which could have moved them
+        auto pairs                  = entries_of(h);
+        word(h, hash_word::entries) = bigger;
+        write_barrier(&word(h, hash_word::entries), bigger);
+        hash_fill(h, pairs);
+        i = hash_slot(h, key, found, by_address);
+    }
+    value* e = object_data(word(h, hash_word::entries));
+    if(!found) {
+        e[2 * i] = key;
+        write_barrier(&e[2 * i], key);
+        set_int_word(h, hash_word::count, (int64_t)hash_count(h) + 1);
+        if(by_address) {
+            set_int_word(h, hash_word::address_keys, int_word(h, hash_word::address_keys) + 1);
+            int64_t flags = int_word(h, hash_word::flags);
+            if((flags & EQUAL_KEYS) != 0 || in_nursery((void*)(key >> 4)))
+                set_int_word(h, hash_word::flags, flags | YOUNG_ADDRESS_KEYS);
+        }
+    }
+    e[2 * i + 1] = v;
+    write_barrier(&e[2 * i + 1], v);
+    hash_touch(h);
+}
+
+bool runtime::hash_remove(value h, value key) {
+    check_type(h, value_type::hash);
+    if(in_base((void*)(h >> 4))) throw std::runtime_error("can't change the values of a base");
+    hash_prepare(h);
+    bool   found, by_address;
+    size_t i = hash_slot(h, key, found, by_address);
+    if(!found) return false;
+    // shift back the entries after it that would no longer be found past the free slot, so that
+    // probing needs no markers for removed keys
+    bool   equal = (int_word(h, hash_word::flags) & EQUAL_KEYS) != 0;
+    value* e     = object_data(word(h, hash_word::entries));
+    size_t mask  = slot_count(h) - 1;
+    for(size_t j = (i + 1) & mask; e[2 * j] != UNBOUND; j = (j + 1) & mask) {
+        bool   unused;
+        size_t home = hash_key(e[2 * j], equal, unused) & mask;
+        if(((j - home) & mask) < ((j - i) & mask)) continue;
+        e[2 * i]     = e[2 * j];
+        e[2 * i + 1] = e[2 * j + 1];
+        write_barrier(&e[2 * i], e[2 * i]);
+        write_barrier(&e[2 * i + 1], e[2 * i + 1]);
+        i = j;
+    }
+    e[2 * i] = e[2 * i + 1] = UNBOUND;
+    write_barrier(&e[2 * i], UNBOUND);
+    write_barrier(&e[2 * i + 1], UNBOUND);
+    set_int_word(h, hash_word::count, (int64_t)hash_count(h) - 1);
+    if(by_address)
+        set_int_word(h, hash_word::address_keys, int_word(h, hash_word::address_keys) - 1);
+    hash_touch(h);
+    return true;
+}
+
+void runtime::define_hash_functions() {
+    define_fn("hash?", [](runtime* rt, value args, void* d) {
+        return rt->from_bool(type_of(first(args)) == value_type::hash);
+    });
+
+    // (make-hash ['eq or 'equal] [capacity])
+    define_fn("make-hash", [](runtime* rt, value args, void* d) {
+        bool equal = false;
+        if(args != NIL) {
+            const auto& kind = rt->symbol_str(first(args));
+            if(kind == "equal")
+                equal = true;
+            else if(kind != "eq")
+                throw std::runtime_error("hash tables compare keys with eq or equal");
+        }
+        int64_t capacity = args != NIL && second(args) != NIL ? to_int(first(second(args))) : 0;
+        if(capacity < 0) throw std::out_of_range("negative hash table capacity");
+        return rt->make_hash(equal, capacity);
+    });
+
+    define_fn("hash-count", [](runtime* rt, value args, void* d) {
+        return rt->from_int(hash_count(first(args)));
+    });
+
+    // (hash-ref table key [default]), the default is nil
+    define_fn("hash-ref", [](runtime* rt, value args, void* d) {
+        auto v = rt->hash_ref(first(args), first(second(args)));
+        if(v.has_value()) return v.value();
+        return second(second(args)) == NIL ? NIL : first(second(second(args)));
+    });
+
+    define_fn("hash-contains?", [](runtime* rt, value args, void* d) {
+        return rt->from_bool(rt->hash_ref(first(args), first(second(args))).has_value());
+    });
+
+    define_fn("hash-set!", [](runtime* rt, value args, void* d) {
+        value v = first(second(second(args)));
+        // growing the table allocates, which can move the value that is returned
+        root_guard g(rt, v);
+        rt->hash_set(first(args), first(second(args)), v);
+        return v;
+    });
+
+    define_fn("hash-remove!", [](runtime* rt, value args, void* d) {
+        return rt->from_bool(rt->hash_remove(first(args), first(second(args))));
+    });
+
+    // the entries are copied to the stack first, so that the table can change while they are used
+    define_fn("hash-keys", [](runtime* rt, value args, void* d) {
+        size_t base = rt->stack.size();
+        for(auto& [k, v] : entries_of(first(args)))
+            rt->stack.push_back(k);
+        return rt->list_from_stack(base);
+    });
+
+    define_fn("hash-values", [](runtime* rt, value args, void* d) {
+        size_t base = rt->stack.size();
+        for(auto& [k, v] : entries_of(first(args)))
+            rt->stack.push_back(v);
+        return rt->list_from_stack(base);
+    });
+
+    // a list of (key . value) pairs
+    define_fn("hash->list", [](runtime* rt, value args, void* d) {
+        size_t base = rt->stack.size();
+        for(auto& [k, v] : entries_of(first(args))) {
+            rt->stack.push_back(k);
+            rt->stack.push_back(v);
+        }
+        size_t n = (rt->stack.size() - base) / 2;
+        // each pair goes where its key was, which has been read by then
+        for(size_t i = 0; i < n; ++i) {
+            value pair          = rt->cons(rt->stack[base + 2 * i], rt->stack[base + 2 * i + 1]);
+            rt->stack[base + i] = pair;
+        }
+        rt->stack.resize(base + n);
+        return rt->list_from_stack(base);
+    });
+
+    // (hash-for-each table f) calls (f key value) for each entry
+    define_fn("hash-for-each", [](runtime* rt, value args, void* d) {
+        value      f = first(second(args));
+        root_guard g(rt, f);
+        size_t     base = rt->stack.size();
+        for(auto& [k, v] : entries_of(first(args))) {
+            rt->stack.push_back(k);
+            rt->stack.push_back(v);
+        }
+        try {
+            // `f` is only read once the arguments are built, since `cons` can move it
+            for(size_t i = base; i < rt->stack.size(); i += 2) {
+                value call = rt->cons(rt->stack[i + 1]);
+                call       = rt->cons(rt->stack[i], call);
+                rt->apply(f, call);
+            }
+        } catch(...) {
+            rt->stack.resize(base);
+            throw;
+        }
+        rt->stack.resize(base);
+        return NIL;
+    });
+}
+}  // namespace emlisp
@@ -0,0 +1,222 @@
+#include "emlisp.h"
+#include <cstring>
+
+namespace emlisp {
+// An image is a sequence of 64 bit words:
+//
+//     magic, symbol count, data words, macro count, program
+//     symbols: (length << 1 | unique) followed by the name padded to a word
+//     macros: name, varadic, argument count, arguments..., body
+//     data: the conses and strings of the program, laid out as in the code space
+//
+// Conses and strings are written as their word offset into the data in place of an address, and
+// symbols as their position in the image's symbol list, so loading only has to copy the data into
+// the code space and fix those up.
+constexpr uint64_t IMAGE_MAGIC = 0x31676d69706c6d65;  // "emlpimg1"
+
+namespace {
+struct image_writer {
+    runtime*                         rt;
+    std::vector<uint64_t>            data;
+    std::unordered_map<value, value> offsets;
+    std::unordered_map<value, value> symbols;
+    std::vector<value>               symbol_order;
+    // words of `data` that still hold values of the runtime
+    std::vector<size_t> unwritten;
+
+    value sym(value s) {
+        auto e = symbols.find(s);
+        if(e != symbols.end()) return e->second;
+        value v = (symbol_order.size() << 4) | (uint64_t)value_type::sym;
+        symbols.emplace(s, v);
+        symbol_order.push_back(s);
+        return v;
+    }
+
+    // the image value for `v`, making room in the data for conses and strings seen the first time
+    value write(value v) {
+        switch(type_of(v)) {
+            case value_type::nil:
+            case value_type::bool_t:
+            case value_type::int_t:
+            case value_type::float_t: return v;
+            case value_type::sym: return sym(v);
+            case value_type::cons:
+            case value_type::str:
+            case value_type::vector:
+            case value_type::array:
+            case value_type::vec: break;
+            default: throw std::runtime_error("image can only hold program text");
+        }
+        auto e = offsets.find(v);
+        if(e != offsets.end()) return e->second;
+        value off = (data.size() << 4) | (uint64_t)type_of(v);
+        offsets.emplace(v, off);
+        if(type_of(v) == value_type::cons) {
+            data.push_back(first(v));
+            data.push_back(second(v));
+            unwritten.push_back(data.size() - 2);
+            unwritten.push_back(data.size() - 1);
+        } else {
+            value* o     = (value*)(v >> 4);
+            size_t words = object_size(*o) / sizeof(value);
+            size_t at    = data.size();
+            data.resize(at + words, 0);
+            std::memcpy(&data[at], o, sizeof(value) + header_payload_bytes(*o));
+            if(type_of(v) == value_type::vector)
+                for(size_t i = 1; i < words; ++i)
+                    unwritten.push_back(at + i);
+        }
+        return off;
+    }
+
+    void finish() {
+        while(!unwritten.empty()) {
+            size_t at = unwritten.back();
+            unwritten.pop_back();
+            data[at] = write(data[at]);
+        }
+    }
+};
+
+struct image_reader {
+    const uint8_t* at;
+    const uint8_t* end;
+
+    uint64_t word() {
+        if(end - at < (ptrdiff_t)sizeof(uint64_t)) throw std::runtime_error("truncated image");
+        uint64_t w;
+        std::memcpy(&w, at, sizeof(w));
+        at += sizeof(w);
+        return w;
+    }
+
+    std::string_view bytes(size_t n) {
+        size_t padded = (n + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+        if((size_t)(end - at) < padded) throw std::runtime_error("truncated image");
+        std::string_view s((const char*)at, n);
+        at += padded;
+        return s;
+    }
+};
+}  // namespace
+
+std::vector<uint8_t> runtime::make_image(std::string_view contents) {
+    // macros defined by the file are found by what the expansion changed in the table
+    auto  macros_before = macros;
+    value code          = expand(read_all(contents));
+
+    // nothing below allocates in the heap, so the program stays where it is
+    image_writer w{this};
+    value        program = w.write(code);
+    std::vector<uint64_t> macro_words;
+    size_t                macro_count = 0;
+    for(auto& [name, fn] : macros) {
+        auto before = macros_before.find(name);
+        if(before != macros_before.end() && before->second == fn) continue;
+        macro_count++;
+        macro_words.push_back(w.sym(name));
+        macro_words.push_back(fn->varadic ? 1 : 0);
+        macro_words.push_back(fn->arguments.size());
+        for(auto a : fn->arguments)
+            macro_words.push_back(w.sym(a));
+        macro_words.push_back(w.write(fn->body));
+    }
+    w.finish();
+
+    std::vector<uint64_t> words
+        = {IMAGE_MAGIC, w.symbol_order.size(), w.data.size(), macro_count, program};
+    for(auto s : w.symbol_order) {
+        const auto& name = symbol_name(s >> 4);
+        // unique symbols are made again when the image is loaded rather than looked up by name
+        bool unique = symbol(name) != s;
+        words.push_back((name.size() << 1) | (unique ? 1 : 0));
+        size_t at = words.size();
+        words.resize(at + (name.size() + sizeof(uint64_t) - 1) / sizeof(uint64_t), 0);
+        std::memcpy(&words[at], name.data(), name.size());
+    }
+    words.insert(words.end(), macro_words.begin(), macro_words.end());
+    words.insert(words.end(), w.data.begin(), w.data.end());
+
+    std::vector<uint8_t> image(words.size() * sizeof(uint64_t));
+    std::memcpy(image.data(), words.data(), image.size());
+    return image;
+}
+
+void runtime::eval_image(const uint8_t* image, size_t size) {
+    image_reader r{image, image + size};
+    if(r.word() != IMAGE_MAGIC) throw std::runtime_error("not an image");
+    size_t symbol_count = r.word();
+    size_t data_words   = r.word();
+    size_t macro_count  = r.word();
+    value  program      = r.word();
+
+    std::vector<value> syms;
+    syms.reserve(symbol_count);
+    for(size_t i = 0; i < symbol_count; ++i) {
+        uint64_t entry = r.word();
+        value    s     = symbol(r.bytes(entry >> 1));
+        syms.push_back((entry & 1) != 0 ? unique_symbol(s) : s);
+    }
+
+    struct macro_def {
+        value              name;
+        bool               varadic;
+        std::vector<value> arguments;
+        value              body;
+    };
+    std::vector<macro_def> defs(macro_count);
+    for(auto& m : defs) {
+        m.name    = r.word();
+        m.varadic = r.word() != 0;
+        m.arguments.resize(r.word());
+        for(auto& a : m.arguments)
+            a = r.word();
+        m.body = r.word();
+    }
+
+    if((size_t)(r.end - r.at) != data_words * sizeof(value))
+        throw std::runtime_error("image data has the wrong size");
+    auto* data = (value*)code_alloc(data_words * sizeof(value));
+    std::memcpy(data, r.at, data_words * sizeof(value));
+
+    auto relocate = [&](value v) {
+        switch(type_of(v)) {
+            case value_type::cons:
+            case value_type::str:
+            case value_type::vector:
+            case value_type::array:
+            case value_type::vec:
+                return ((((uint64_t)(data + (v >> 4))) << 4)) | (uint64_t)type_of(v);
+            case value_type::sym: return syms.at(v >> 4);
+            default: return v;
+        }
+    };
+    // the data is a run of strings, vectors, arrays and vecs, which start with a header, and conses
+    for(size_t i = 0; i < data_words;) {
+        if((data[i] & 0xf) == HEADER_TAG) {
+            size_t words = object_size(data[i]) / sizeof(value);
+            if(header_kind(data[i]) == object_kind::vector)
+                for(size_t j = 1; j < words; ++j)
+                    data[i + j] = relocate(data[i + j]);
+            i += words;
+        } else {
+            data[i]     = relocate(data[i]);
+            data[i + 1] = relocate(data[i + 1]);
+            i += 2;
+        }
+    }
+
+    for(auto& m : defs) {
+        auto fn     = std::make_shared<function>(NIL, relocate(m.body), sym_ellipsis);
+        fn->varadic = m.varadic;
+        for(auto a : m.arguments)
+            fn->arguments.push_back(relocate(a));
+        fn->slot_arguments();
+        macros[relocate(m.name)] = fn;
+    }
+
+    for(value code = relocate(program); code != NIL; code = second(code))
+        eval(first(code));
+}
+}  // namespace emlisp
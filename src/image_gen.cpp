@@ -0,0 +1,29 @@
+#include "emlisp.h"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+// this program is built without an image, so its runtime reads the std lib from source
+const uint8_t* emlisp::EMLISP_STD_IMAGE      = nullptr;
+const size_t   emlisp::EMLISP_STD_IMAGE_SIZE = 0;
+
+int main(int argc, char* argv[]) {
+    if(argc < 3) return -1;
+    std::ifstream     source(argv[2]);
+    std::stringstream contents;
+    contents << source.rdbuf();
+
+    // the std lib's macros can call its functions while they expand it
+    emlisp::runtime rt{1024 * 1024, true};
+    auto            image = rt.make_image(contents.str());
+
+    std::ofstream output(argv[1]);
+    output << "#include \"emlisp.h\"\n\n";
+    output << "alignas(8) static const uint8_t image[] = {";
+    for(size_t i = 0; i < image.size(); ++i)
+        output << (i % 16 == 0 ? "\n    " : " ") << (int)image[i] << ",";
+    output << "\n};\n\n";
+    output << "const uint8_t* emlisp::EMLISP_STD_IMAGE      = image;\n";
+    output << "const size_t   emlisp::EMLISP_STD_IMAGE_SIZE = sizeof(image);\n";
+    return 0;
+}
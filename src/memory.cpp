@@ -1,47 +1,203 @@
 #include "emlisp.h"
 #include <algorithm>
+#include <climits>
 #include <cstring>
 #include <iostream>
 
 namespace emlisp {
 value runtime::cons(value fst, value snd) {
-    if(heap_next - heap > heap_size) throw std::runtime_error("out of memory");
-    auto* addr = (value*)heap_next;
+    auto* addr = (value*)alloc(2 * sizeof(value), fst, snd);
     addr[0]    = fst;
     addr[1]    = snd;
-    heap_next += 2 * sizeof(value);
     return (((uint64_t)addr) << 4) | (uint64_t)value_type::cons;
 }
 
-frame* runtime::alloc_frame() {
-    if(heap_next - heap > heap_size) throw std::runtime_error("out of memory");
-    auto* f = (frame*)heap_next;
-    heap_next += sizeof(frame);
-    new(f) frame();
-    return f;
+void runtime::set_first(value cell, value v) {
+    if(in_code_space((void*)(cell >> 4))) throw std::runtime_error("can't change interned code");
+    if(in_base((void*)(cell >> 4))) throw std::runtime_error("can't change the values of a base");
+    first(cell) = v;
+    write_barrier(&first(cell), v);
+}
+
+void runtime::set_second(value cell, value v) {
+    if(in_code_space((void*)(cell >> 4))) throw std::runtime_error("can't change interned code");
+    if(in_base((void*)(cell >> 4))) throw std::runtime_error("can't change the values of a base");
+    second(cell) = v;
+    write_barrier(&second(cell), v);
+}
+
+value runtime::make_vector(size_t length, value fill) {
+    auto* o = (value*)alloc((length + 1) * sizeof(value), fill);
+    o[0]    = make_header(object_kind::vector, length * sizeof(value));
+    std::fill(o + 1, o + 1 + length, fill);
+    return (((uint64_t)o) << 4) | (uint64_t)value_type::vector;
+}
+
+void runtime::vector_set(value vec, size_t i, value v) {
+    if(i >= vector_length(vec)) throw std::out_of_range("vector index out of range");
+    if(in_code_space((void*)(vec >> 4))) throw std::runtime_error("can't change interned code");
+    if(in_base((void*)(vec >> 4))) throw std::runtime_error("can't change the values of a base");
+    object_data(vec)[i] = v;
+    write_barrier(&object_data(vec)[i], v);
+}
+
+static value init_object(uint8_t* addr, object_kind kind, size_t words) {
+    auto* o = (value*)addr;
+    o[0]    = make_header(kind, words * sizeof(value));
+    std::fill(o + 1, o + 1 + words, NIL);
+    return (((uint64_t)o) << 4) | (uint64_t)value_type::_object;
+}
+
+value runtime::alloc_object(object_kind kind, size_t words) {
+    return init_object(alloc((words + 1) * sizeof(value)), kind, words);
+}
+
+value runtime::alloc_env(size_t slots, value parent) {
+    value env =
+        init_object(alloc((slots + 2) * sizeof(value), parent), object_kind::frame, 1 + slots);
+    object_data(env)[0] = parent;
+    return env;
+}
+
+value runtime::make_box(value v) {
+    value box           = init_object(alloc(2 * sizeof(value), v), object_kind::box, 1);
+    object_data(box)[0] = v;
+    return box;
+}
+
+value runtime::make_function_object(std::shared_ptr<function> fn) {
+    auto* o = (value*)alloc(sizeof(value) + sizeof(std::shared_ptr<function>), fn->body);
+    o[0]    = make_header(object_kind::function, sizeof(std::shared_ptr<function>));
+    new(o + 1) std::shared_ptr<function>(std::move(fn));
+    young_function_objects.push_back((size_t)o);
+    return (((uint64_t)o) << 4) | (uint64_t)value_type::_object;
+}
+
+void runtime::set_box(value box, value v) {
+    if(in_base((void*)(box >> 4))) throw std::runtime_error("can't change the values of a base");
+    object_data(box)[0] = v;
+    write_barrier(object_data(box), v);
 }
 
 value runtime::from_str(std::string_view src) {
-    if(heap_next - heap > heap_size) throw std::runtime_error("out of memory");
-    char* str = (char*)heap_next;
-    heap_next += src.size() + sizeof(uint32_t);
-    std::copy(src.begin(), src.end(), str + sizeof(uint32_t));
-    *((uint32_t*)str) = src.size();
-    return (((uint64_t)str) << 4) | (uint64_t)value_type::str;
+    auto* addr = (value*)alloc(src.size() + sizeof(value));
+    addr[0]    = make_header(object_kind::string, src.size());
+    std::copy(src.begin(), src.end(), (char*)(addr + 1));
+    return (((uint64_t)addr) << 4) | (uint64_t)value_type::str;
 }
 
 std::string_view runtime::to_str(value v) {
     check_type(v, value_type::str, "get string from value");
-    auto length = *(uint32_t*)(v >> 4);
-    auto data   = (char*)((v >> 4) + sizeof(uint32_t));
-    return {data, length};
+    return {(char*)object_data(v), header_payload_bytes(*(value*)(v >> 4))};
+}
+
+uint8_t* runtime::code_alloc(size_t bytes) {
+    bytes = (bytes + sizeof(value) - 1) & ~(sizeof(value) - 1);
+    if(bytes > (size_t)(code_limit - code_next)) {
+        // the rest of the last chunk is left unused, so its size becomes what it holds, and
+        // nothing in it ever moves
+        if(!code_chunks.empty())
+            code_chunks.back().second = code_next - code_chunks.back().first.get();
+        size_t size = std::max(bytes, (size_t)64 * 1024);
+        code_chunks.emplace_back(new uint8_t[size], size);
+        code_next  = code_chunks.back().first.get();
+        code_limit = code_next + size;
+    }
+    auto* addr = code_next;
+    code_next += bytes;
+    code_size += bytes;
+    return addr;
+}
+
+bool runtime::in_code_space(const void* p) const {
+    for(const auto& [chunk, size] : code_chunks)
+        if(p >= chunk.get() && p < chunk.get() + size) return true;
+    return false;
+}
+
+std::vector<std::pair<uint8_t*, size_t>> runtime::code_in_use() const {
+    // chunks before the last one end at their last object, see `code_alloc`
+    std::vector<std::pair<uint8_t*, size_t>> chunks;
+    for(const auto& [chunk, size] : code_chunks) {
+        size_t used = &chunk == &code_chunks.back().first ? code_next - chunk.get() : size;
+        chunks.emplace_back(chunk.get(), used);
+    }
+    return chunks;
+}
+
+value runtime::intern_code(value v) {
+    // each cons is copied before what it holds, and filled in from `unfilled` afterwards, so that
+    // long lists don't recurse and shared or circular structure is only copied once
+    std::unordered_map<value, value> copies;
+    std::vector<value*>              unfilled;
+    auto                             copy = [&](value x) {
+        auto ty = type_of(x);
+        if(ty != value_type::cons && ty != value_type::str && ty != value_type::vector
+           && ty != value_type::array && ty != value_type::vec)
+            return x;
+        if(in_code_space((void*)(x >> 4))) return x;
+        auto c = copies.find(x);
+        if(c != copies.end()) return c->second;
+        value y;
+        if(ty == value_type::str || ty == value_type::array || ty == value_type::vec) {
+            size_t bytes = sizeof(value) + header_payload_bytes(*(value*)(x >> 4));
+            auto*  addr  = code_alloc(bytes);
+            std::memcpy(addr, (void*)(x >> 4), bytes);
+            y = (((uint64_t)addr) << 4) | (uint64_t)ty;
+        } else if(ty == value_type::vector) {
+            size_t length = vector_length(x);
+            auto*  addr   = (value*)code_alloc((length + 1) * sizeof(value));
+            std::memcpy(addr, (void*)(x >> 4), (length + 1) * sizeof(value));
+            for(size_t i = 1; i <= length; ++i)
+                unfilled.push_back(addr + i);
+            y = (((uint64_t)addr) << 4) | (uint64_t)value_type::vector;
+        } else {
+            auto* addr = (value*)code_alloc(2 * sizeof(value));
+            addr[0]    = first(x);
+            addr[1]    = second(x);
+            unfilled.push_back(addr);
+            unfilled.push_back(addr + 1);
+            y = (((uint64_t)addr) << 4) | (uint64_t)value_type::cons;
+        }
+        copies.emplace(x, y);
+        return y;
+    };
+    // nothing here allocates in the heap, so the originals stay put while they are copied
+    v = copy(v);
+    while(!unfilled.empty()) {
+        value* slot = unfilled.back();
+        unfilled.pop_back();
+        *slot = copy(*slot);
+        // anything else, like a closure spliced in by a macro, stays in the heap
+        if(is_heap_type(type_of(*slot)) && !in_code_space((void*)(*slot >> 4)))
+            code_roots.push_back(slot);
+    }
+    return v;
+}
+
+value runtime::list_from_stack(size_t base) {
+    value list = NIL;
+    for(size_t i = stack.size(); i > base; --i)
+        list = cons(stack[i - 1], list);
+    stack.resize(base);
+    return list;
+}
+
+value runtime::vector_from_stack(size_t base) {
+    size_t length = stack.size() - base;
+    auto*  o      = (value*)alloc((length + 1) * sizeof(value));
+    o[0]          = make_header(object_kind::vector, length * sizeof(value));
+    std::copy(stack.begin() + base, stack.end(), o + 1);
+    stack.resize(base);
+    return (((uint64_t)o) << 4) | (uint64_t)value_type::vector;
 }
 
 value runtime::from_vec(const std::vector<value>& vec) {
-    value n = NIL;
-    for(auto i = vec.rbegin(); i != vec.rend(); ++i)
-        n = cons(*i, n);
-    return n;
+    // the elements are kept on the stack so that they are updated if the list's allocation
+    // collects garbage
+    size_t base = stack.size();
+    stack.insert(stack.end(), vec.begin(), vec.end());
+    return list_from_stack(base);
 }
 
 std::vector<value> runtime::to_vec(value list) {
@@ -55,221 +211,607 @@ std::vector<value> runtime::to_vec(value list) {
     return vals;
 }
 
-value frame::get(value name) {
-    check_type(name, value_type::sym);
-    auto v = data.find(name);
-    if(v != data.end()) return v->second;
-    throw std::runtime_error("unknown name " + std::to_string(name));
+void runtime::index_symbol(uint32_t ix) {
+    size_t mask = symbol_table.size() - 1;
+    size_t i    = symbol_hashes[ix] & mask;
+    while(symbol_table[i] != 0)
+        i = (i + 1) & mask;
+    symbol_table[i] = ix + 1;
 }
 
-void frame::set(value name, value val) {
-    check_type(name, value_type::sym);
-    data[name] = val;
+// the index of the interned symbol named `s` in `names`, or -1
+static size_t find_symbol(
+    const std::vector<uint32_t>& table, const std::vector<size_t>& hashes,
+    const std::vector<std::string>& names, size_t hash, std::string_view s
+) {
+    if(table.empty()) return (size_t)-1;
+    size_t mask = table.size() - 1;
+    for(size_t i = hash & mask; table[i] != 0; i = (i + 1) & mask) {
+        size_t ix = table[i] - 1;
+        if(hashes[ix] == hash && names[ix] == s) return ix;
+    }
+    return (size_t)-1;
 }
 
 value runtime::symbol(std::string_view s) {
-    auto ix = std::find(std::begin(symbols), std::end(symbols), s);
-    if(ix == std::end(symbols)) {
-        auto i = symbols.size();
-        symbols.emplace_back(s);
-        return (i << 4) | (uint64_t)value_type::sym;
+    size_t hash = std::hash<std::string_view>{}(s);
+    if(base != nullptr) {
+        size_t ix = find_symbol(base->symbol_table, base->symbol_hashes, base->symbols, hash, s);
+        if(ix != (size_t)-1) return (ix << 4) | (uint64_t)value_type::sym;
     }
-    return (std::distance(std::begin(symbols), ix) << 4) | (uint64_t)value_type::sym;
+    size_t found = find_symbol(symbol_table, symbol_hashes, symbols, hash, s);
+    if(found != (size_t)-1) return ((base_symbols + found) << 4) | (uint64_t)value_type::sym;
+
+    // keep the table at most half full so that probe sequences stay short
+    if(2 * (interned_symbol_count + 1) > symbol_table.size()) {
+        auto old = std::move(symbol_table);
+        symbol_table.assign(std::max(old.size() * 2, (size_t)256), 0);
+        for(auto e : old)
+            if(e != 0) index_symbol(e - 1);
+    }
+    auto ix = symbols.size();
+    symbols.emplace_back(s);
+    symbol_hashes.push_back(hash);
+    index_symbol(ix);
+    interned_symbol_count++;
+    return ((base_symbols + ix) << 4) | (uint64_t)value_type::sym;
 }
 
 const std::string& runtime::symbol_str(value sym) const {
     check_type(sym, value_type::sym);
-    return symbols[sym >> 4];
+    return symbol_name(sym >> 4);
 }
 
-struct gc_state {
-    runtime*                          rt;
-    std::unordered_map<value, value>& live_vals;
-    uint8_t*&                         new_next;
-    std::unordered_set<size_t>        old_owned_externs, new_owned_externs;
-    uint8_t*                          gc_copy_limit;
-
-  private:
-    inline void copy_conslike(value& c, value_type ty) {
-        auto new_addr = ((uint64_t)(new_next) << 4) | (uint64_t)ty;
-        live_vals[c]  = new_addr;
-        memcpy((void*)new_next, (void*)(c >> 4), sizeof(value) * 2);
-        c = new_addr;
-        new_next += 2 * sizeof(value);
-        if(new_next > gc_copy_limit) {
-#ifdef GC_LOG
-            std::cout << "!!! copying cons/closure/extern value " << ty << " " << std::hex << c
-                      << std::dec << "\n\t";
-            this->write(std::cout, c);
-            std::cout << "\n";
-#endif
-            throw std::runtime_error("garbage collector has allocated more than the previous heap");
-        }
+static std::shared_ptr<function>* function_at(value* ob) {
+    return (std::shared_ptr<function>*)(ob + 1);
+}
+
+template<typename F>
+void runtime::trace_function(function& fn, F&& f) {
+    f(fn.body);
+    if(fn.compiled != nullptr) trace_code(*fn.compiled, f);
+}
+
+template<typename F>
+void runtime::trace_code(code& c, F&& f) {
+    for(auto& k : c.consts)
+        f(k);
+    f(c.source);
+    for(auto& obj : c.child_objects)
+        f(obj);
+    // nested functions that don't have their objects yet are only reachable from here
+    for(size_t i = c.child_objects.size(); i < c.children.size(); ++i)
+        trace_function(*c.children[i], f);
+}
+
+template<typename F>
+void runtime::rebuild_function_index(F&& moved) {
+    std::unordered_multimap<value, value> index;
+    for(auto& [body, obj] : function_index) {
+        value f = moved(obj);
+        if(f != NIL) index.emplace(object_function(f)->body, f);
     }
+    function_index = std::move(index);
+}
 
-    inline void copy_str(value& c, value old_c) {
-        uint32_t* p   = (uint32_t*)(c >> 4);
-        uint32_t  len = *p;
-        memcpy(new_next, p, len + sizeof(uint32_t));
-        c = (((uint64_t)new_next) << 4) | (uint64_t)value_type::str;
-        new_next += len + sizeof(uint32_t);
-        live_vals[old_c] = c;
-        if(new_next > gc_copy_limit) {
-#ifdef GC_LOG
-            std::cout << "!!! copying string\n";
-#endif
-            throw std::runtime_error("garbage collector has allocated more than the previous heap");
-        }
+// Values are copied breadth first: the roots are forwarded into the to-space, then the to-space is
+// scanned from the first copied object, forwarding every value it holds, until the scan catches up
+// with the copying. A copied object's first word is overwritten with its new address tagged with
+// FORWARD_TAG, so later references to it find the copy without any extra bookkeeping.
+struct gc_state {
+    runtime* rt;
+    // a full collection evacuates the old space as well as the nursery
+    bool     full;
+    uint8_t* to_next;
+    uint8_t* to_limit;
+    size_t   promoted;
+
+    bool in_from_space(const void* p) const {
+        return rt->in_nursery(p) || (full && rt->in_old_space(p));
     }
 
-    inline void process_closure_internals(value c, value old_c) {
-        function* fn = (function*)(*(uint64_t*)(c >> 4) >> 4);
-        process(fn->body);
-        auto old_frv = *((value*)(c >> 4) + 1);
+    value forward(value v) {
+        auto ty = type_of(v);
+        // values outside of the spaces being collected stay where they are, references from
+        // the old space into the nursery are found through the remembered set
+        if(!is_heap_type(ty) || !in_from_space((void*)(v >> 4))) return v;
 
-        auto exi_fr = live_vals.find(old_frv);
-        if(exi_fr != live_vals.end()) {
-#ifdef GC_LOG
-            std::cout << "\tframe already collected\n";
-#endif
-            *((value*)(c >> 4) + 1) = exi_fr->second;
-            return;
-        }
+        auto* p = (value*)(v >> 4);
+        if((*p & 0xf) == FORWARD_TAG) return (*p & ~0xf) | (value)ty;
 
-        auto* fr     = (frame*)(old_frv >> 4);
-        auto* new_fr = (frame*)new_next;
-        new_next += sizeof(frame);
-        if(new_next > gc_copy_limit) {
+        // anything without a header is a two word cell
+        bool   has_header = (*p & 0xf) == HEADER_TAG;
+        size_t size       = has_header ? object_size(*p) : 2 * sizeof(value);
+        if(to_next + size > to_limit) {
 #ifdef GC_LOG
-            std::cout << "!!! copying frame\n";
+            std::cout << "!!! copying " << size << " bytes\n";
 #endif
-            throw std::runtime_error("garbage collector has allocated more than the previous heap");
+            throw std::runtime_error("garbage collector ran out of space to copy into");
         }
-        new(new_fr) frame(fr->data);
-        // memcpy(new_fr, fr, sizeof(frame));
-        auto new_frv = (value)((((uint64_t)new_fr) << 4) | (uint64_t)value_type::_extern);
-        *((value*)(c >> 4) + 1) = new_frv;
-        live_vals[old_frv]      = new_frv;
-
-        for(auto& [name, val] : new_fr->data) {
-            if(val == old_c) {  // this is sus?
-                val = c;
-                continue;
-            }
+        auto* dst = to_next;
+        to_next += size;
+        memcpy(dst, p, size);
+        if(rt->in_nursery(p)) promoted += size;
+
+        if(has_header && header_kind(*p) == object_kind::owned_extern) {
+            // C++ values must be moved by their own constructor
+            auto* h = (owned_extern_header*)(p + 1);
 #ifdef GC_LOG
-            std::cout << "\tcollecting frame value " << symbols[name >> 4] << " → ";
-            this->write(std::cout, val);
-            std::cout << "\n";
+            std::cout << "\tmoving C++ type, size = " << h->size << "\n";
 #endif
-            process(val);
+            h->move(dst + sizeof(value) + sizeof(owned_extern_header), h + 1);
+        } else if(has_header && header_kind(*p) == object_kind::function) {
+            new(dst + sizeof(value)) std::shared_ptr<function>(std::move(*function_at(p)));
         }
+
+        *p = ((value)dst << 4) | FORWARD_TAG;
+        return ((value)dst << 4) | (value)ty;
     }
 
-    inline void process_owned_extern(value c) {
-        void* p = *(void**)(c >> 4);
-        if(p >= rt->heap && p < rt->heap + rt->heap_size) {
-            // we own this value
-            auto* h = (owned_extern_header*)((char*)p - sizeof(owned_extern_header));
-#ifdef GC_LOG
-            std::cout << "\tmoving C++ type, size = " << h->size << "\n";
-#endif
-            auto* t = new_next + sizeof(owned_extern_header);
-            old_owned_externs.erase((size_t)p);
-            new_owned_externs.insert((size_t)t);
-            *(void**)(c >> 4)                 = t;
-            *((owned_extern_header*)new_next) = *h;
-            h->move(t, p);
-            new_next += h->size;
+    // forward everything referenced by the objects copied since `from`
+    void scan(uint8_t* from) {
+        while(from < to_next) {
+            auto* p = (value*)from;
+            if((*p & 0xf) == HEADER_TAG) {
+                auto kind = header_kind(*p);
+                if(kind == object_kind::function) {
+                    rt->trace_function(**function_at(p), [&](value& v) { v = forward(v); });
+                } else if(!holds_bytes(kind)) {
+                    size_t count = header_payload_bytes(*p) / sizeof(value);
+                    for(size_t i = 1; i <= count; ++i)
+                        p[i] = forward(p[i]);
+                }
+                from += object_size(*p);
+            } else {
+                // conses, closures and extern cells, the native pointers that externs hold are
+                // never in the heap so forwarding leaves them alone
+                p[0] = forward(p[0]);
+                p[1] = forward(p[1]);
+                from += 2 * sizeof(value);
+            }
         }
     }
+};
+
+// An incremental collection evacuates the old space while the program keeps running. Objects are
+// replicated into a new space, but the program goes on using the originals, so the replicas can be
+// copied and scanned a slice at a time and minor collections keep promoting into the old space.
+// Where each word of the old space was copied to is kept in a table rather than in the originals,
+// and the write barrier logs every store into the old space. Once the scan catches up the
+// collection finishes by copying the logged slots into their replicas, forwarding the roots and
+// evacuating the nursery into the new space, which then replaces the old space.
+struct incremental_gc {
+    runtime* rt;
+    uint8_t* from;
+    uint8_t* from_end;
+    uint8_t* to_space;
+    uint8_t* to_next;
+    uint8_t* to_limit;
+    uint8_t* scan;
+    size_t   to_capacity;
+    /// the size of the nursery when the collection started, which the new space has room for
+    size_t nursery_size;
+    /// the replica of each word of the old space, null where nothing has been copied
+    std::vector<value*> replicas;
+    /// templates of the function objects scanned before the collection started finishing, the
+    /// program still uses their values in the old space until then
+    std::vector<function*> functions;
+    size_t              copied = 0, scanned = 0, promoted = 0;
+
+    incremental_gc(runtime* rt, size_t to_capacity)
+        : rt(rt), from(rt->old_space), from_end(rt->old_space + rt->old_capacity),
+          to_space(new uint8_t[to_capacity]), to_next(to_space), to_limit(to_space + to_capacity),
+          scan(to_space), to_capacity(to_capacity), nursery_size(rt->heap_size),
+          replicas(rt->old_capacity / sizeof(value)) {}
+
+    bool in_from(const void* p) const { return p >= from && p < from_end; }
+
+    uint8_t* reserve(size_t size) {
+        if(to_next + size > to_limit)
+            throw std::runtime_error("garbage collector ran out of space to copy into");
+        auto* dst = to_next;
+        to_next += size;
+        return dst;
+    }
 
-  public:
-    void process(value& c) {
-        auto ty = type_of(c);
-        // only proceed if the value is on the heap
-        if(!(ty == value_type::cons || ty == value_type::closure || ty == value_type::_extern
-             || ty == value_type::str))
-            return;
-
-        auto old_c = c;
-
-        // check to see if we've already processed this value
-        auto existing_copy = live_vals.find(c);
-        if(existing_copy != live_vals.end()) {
-            c = existing_copy->second;
-            return;
+    /// nursery values are only moved once the collection is `finishing`
+    value forward(value v, bool finishing) {
+        auto ty = type_of(v);
+        if(!is_heap_type(ty)) return v;
+        auto* p = (value*)(v >> 4);
+
+        if(in_from(p)) {
+            size_t ix = ((uint8_t*)p - from) / sizeof(value);
+            if(replicas[ix] != nullptr) return ((value)replicas[ix] << 4) | (value)ty;
+            size_t size = (*p & 0xf) == HEADER_TAG ? object_size(*p) : 2 * sizeof(value);
+            auto*  dst  = (value*)reserve(size);
+            // C++ values are moved into their replicas when the collection finishes
+            memcpy(dst, p, size);
+            for(size_t i = 0; i < size / sizeof(value); ++i)
+                replicas[ix + i] = dst + i;
+            copied += size;
+            return ((value)dst << 4) | (value)ty;
         }
 
-#ifdef GC_LOG
-        std::cout << "collecting ";
-        this->write(std::cout, c);
-        std::cout << " @ " << std::hex << c << std::dec << "\n";
-#endif
+        if(!finishing || !rt->in_nursery(p)) return v;
+        if((*p & 0xf) == FORWARD_TAG) return (*p & ~0xf) | (value)ty;
+        bool   has_header = (*p & 0xf) == HEADER_TAG;
+        size_t size       = has_header ? object_size(*p) : 2 * sizeof(value);
+        auto*  dst        = reserve(size);
+        memcpy(dst, p, size);
+        promoted += size;
+        if(has_header && header_kind(*p) == object_kind::owned_extern) {
+            auto* h = (owned_extern_header*)(p + 1);
+            h->move(dst + sizeof(value) + sizeof(owned_extern_header), h + 1);
+        } else if(has_header && header_kind(*p) == object_kind::function) {
+            new(dst + sizeof(value)) std::shared_ptr<function>(std::move(*function_at(p)));
+        }
+        *p = ((value)dst << 4) | FORWARD_TAG;
+        return ((value)dst << 4) | (value)ty;
+    }
 
-        // copy the value itself to the new heap, replacing c so it points to the new heap
-        if(ty == value_type::cons || ty == value_type::closure || ty == value_type::_extern)
-            copy_conslike(c, ty);
-        else if(ty == value_type::str)
-            copy_str(c, old_c);
-
-        // recursively process any internal references for compound structures
-        if(ty == value_type::cons) {
-            process(first(c));
-            process(second(c));
-        } else if(ty == value_type::closure) {
-            process_closure_internals(c, old_c);
-        } else if(ty == value_type::_extern) {
-            process_owned_extern(c);
+    /// scan the replicas until about `budget` bytes have been copied and scanned
+    void scan_some(size_t budget, bool finishing) {
+        size_t start = copied + scanned;
+        while(scan < to_next && copied + scanned - start < budget) {
+            auto*  p = (value*)scan;
+            size_t size;
+            if((*p & 0xf) == HEADER_TAG) {
+                auto kind = header_kind(*p);
+                if(kind == object_kind::function) {
+                    function* fn = function_at(p)->get();
+                    if(finishing) {
+                        rt->trace_function(*fn, [&](value& v) { v = forward(v, true); });
+                    } else {
+                        rt->trace_function(*fn, [&](value& v) { forward(v, false); });
+                        functions.push_back(fn);
+                    }
+                } else if(!holds_bytes(kind)) {
+                    size_t count = header_payload_bytes(*p) / sizeof(value);
+                    for(size_t i = 1; i <= count; ++i)
+                        p[i] = forward(p[i], finishing);
+                }
+                size = object_size(*p);
+            } else {
+                p[0] = forward(p[0], finishing);
+                p[1] = forward(p[1], finishing);
+                size = 2 * sizeof(value);
+            }
+            scan += size;
+            scanned += size;
         }
     }
 };
 
-void runtime::collect_garbage(heap_info* res_info) {
-    std::unordered_map<value, value> live_vals;
+template<typename F>
+void runtime::for_each_root(F&& f) {
+    for(auto& val : globals)
+        if(val != UNBOUND) f(val);
+
+    for(auto& sc : scopes) {
+        for(auto& val : sc.args)
+            if(val != UNBOUND) f(val);
+        for(auto& [name, val] : sc.vars)
+            f(val);
+        f(sc.form);
+        f(sc.captured);
+    }
 
-    auto* new_heap = new uint8_t[heap_size];
-    assert(new_heap != nullptr);
-    auto* new_heap_next = new_heap;
+    // the templates of a base only refer to values in the base, and are shared with other threads
+    for(auto& [name, fn] : macros)
+        if(base == nullptr || base->templates.count(fn.get()) == 0) trace_function(*fn, f);
 
-    gc_state st{
-        .rt                = this,
-        .live_vals         = live_vals,
-        .new_next          = new_heap_next,
-        .old_owned_externs = owned_externs,
-        .new_owned_externs = {},
-        .gc_copy_limit     = new_heap + (heap_next - heap)};
+    for(auto& fr : frames) {
+        f(fr.fn);
+        if(base == nullptr || base->templates.count(fr.c) == 0) trace_code(*fr.c, f);
+    }
+
+    for(auto* c : compiling)
+        trace_code(*c, f);
 
-    for(auto& sc : scopes)
-        for(auto& [name, val] : sc)
-            st.process(val);
+    for(auto& v : stack)
+        f(v);
 
     for(auto& p : value_handles)
-        st.process(p.second.first);
+        f(p.second.first);
 
-    if(res_info != nullptr) {
-        res_info->old_size = heap_next - heap;
-        res_info->new_size = new_heap_next - new_heap;
+    for(auto* v : c_roots)
+        f(*v);
+
+    for(auto* v : code_roots)
+        f(*v);
+}
+
+void runtime::fill_heap_info(heap_info* res_info, size_t promoted) {
+    if(res_info == nullptr) return;
+    res_info->new_size   = heap_next - heap;
+    res_info->old_size   = old_next - old_space;
+    res_info->code_size  = code_size;
+    res_info->promoted   = promoted;
+    res_info->collecting = incremental != nullptr;
+    res_info->copied     = incremental != nullptr ? incremental->copied : 0;
+    res_info->scanned    = incremental != nullptr ? incremental->scanned : 0;
+}
+
+void runtime::collect_garbage(heap_info* res_info, bool full) {
+    size_t nursery_used = heap_next - heap;
+    size_t old_used     = old_next - old_space;
+    // a minor collection promotes everything that survives in the nursery, which must fit
+    if(old_used + nursery_used > old_capacity) full = true;
+
+    // finishing an incremental collection evacuates the old space and the nursery
+    if(incremental != nullptr && full) {
+        fill_heap_info(res_info, finish_incremental());
+        return;
+    }
+    collections++;
+    if(full) full_collections++;
+
+    // a full collection copies all live values into a new old space with room to spare
+    uint8_t* to_space    = old_space;
+    uint8_t* to_next     = old_next;
+    size_t   to_capacity = old_capacity;
+    if(full) {
+        size_t worst = old_used + nursery_used;
+        to_capacity  = (size_t)(policy.old_space_growth * worst) + heap_size;
+        if(policy.max_heap_size > heap_size)
+            to_capacity = std::min(to_capacity, policy.max_heap_size - heap_size);
+        to_capacity = std::max(to_capacity, worst + old_space_reserve);
+        to_space    = new uint8_t[to_capacity];
+        to_next     = to_space;
     }
 
-    // run deconstructors for any collected C++ values
-    for(auto x : st.old_owned_externs) {
-        auto* h = (owned_extern_header*)(x - sizeof(owned_extern_header));
+    gc_state st{
+        .rt       = this,
+        .full     = full,
+        .to_next  = to_next,
+        .to_limit = to_space + to_capacity,
+        .promoted = 0
+    };
+
+    for_each_root([&](value& v) { v = st.forward(v); });
+
+    // a full collection reaches everything in the old space from the roots anyway
+    if(!full)
+        for(auto* slot : remembered)
+            *slot = st.forward(*slot);
+    remembered.clear();
+
+    st.scan(to_next);
+
+    // C++ values that were not copied are garbage, run their deconstructors
+    std::unordered_set<size_t> live_owned_externs;
+    for(auto x : owned_externs) {
+        if(!st.in_from_space((void*)x)) {
+            live_owned_externs.insert(x);
+            continue;
+        }
+        auto* ob = (value*)(x - sizeof(owned_extern_header) - sizeof(value));
+        if((*ob & 0xf) == FORWARD_TAG) {
+            live_owned_externs.insert(x - (size_t)ob + (size_t)(*ob >> 4));
+        } else {
+            auto* h = (owned_extern_header*)(ob + 1);
 #ifdef GC_LOG
-        std::cout << "deconstructing value at " << std::hex << x << std::dec
-                  << " size = " << h->size << "\n";
+            std::cout << "deconstructing value at " << std::hex << x << std::dec
+                      << " size = " << h->size << "\n";
 #endif
-        h->deconstructor((void*)x);
+            h->deconstructor((void*)x);
+        }
     }
+    owned_externs = std::move(live_owned_externs);
+
+    // templates of function objects that were not copied are garbage as well
+    auto moved = [&](value obj) {
+        auto* ob = (value*)(obj >> 4);
+        if(!st.in_from_space(ob)) return obj;
+        return (*ob & 0xf) == FORWARD_TAG ? (*ob & ~0xf) | (value)value_type::_object : NIL;
+    };
+    if(full || young_functions_indexed) rebuild_function_index(moved);
+    young_functions_indexed = false;
+    std::unordered_set<size_t> live_function_objects;
+    auto                       sweep = [&](size_t x) {
+        value f = moved(((value)x << 4) | (value)value_type::_object);
+        if(f != NIL)
+            live_function_objects.insert(f >> 4);
+        else
+            function_at((value*)x)->~shared_ptr();
+    };
+    if(full) {
+        for(auto x : function_objects)
+            sweep(x);
+        function_objects.clear();
+    }
+    for(auto x : young_function_objects)
+        sweep(x);
+    young_function_objects.clear();
+    function_objects.merge(live_function_objects);
 
 #ifdef _DEBUG
     // make it abundantly clear if we still have pointers to the old heap
-    memset(heap, 0xcdcdcdcd, heap_size);
+    memset(heap, 0xcd, heap_size);
+    if(full) memset(old_space, 0xcd, old_capacity);
+#endif
+
+    heap_next = heap;
+    if(full) {
+        delete[] old_space;
+        old_space    = to_space;
+        old_capacity = to_capacity;
+    }
+    old_next = st.to_next;
+
+    fill_heap_info(res_info, st.promoted);
+}
+
+void runtime::make_room(size_t bytes) {
+    heap_info info;
+    collect_garbage(&info);
+
+    size_t new_size = heap_size;
+    if(info.promoted > policy.grow_threshold * heap_size)
+        new_size = 2 * heap_size;
+    else if(info.promoted < policy.shrink_threshold * heap_size && heap_size / 2 >= min_heap_size)
+        new_size = heap_size / 2;
+    while(new_size < bytes)
+        new_size *= 2;
+    if(policy.max_heap_size != 0) {
+        // the nursery gets whatever the old space leaves
+        size_t room = policy.max_heap_size > old_capacity ? policy.max_heap_size - old_capacity : 0;
+        new_size    = std::min(new_size, room);
+        if(new_size < bytes) throw std::runtime_error("out of memory");
+    }
+    if(new_size != heap_size) {
+        // the new space of an incremental collection only has room for the nursery it started with
+        if(incremental != nullptr && new_size > incremental->nursery_size) finish_incremental();
+#ifdef GC_LOG
+        std::cout << "resizing nursery from " << heap_size << " to " << new_size << " bytes\n";
+#endif
+        // the collection left the nursery empty
+        delete[] heap;
+        heap      = new uint8_t[new_size];
+        heap_next = heap;
+        heap_size = new_size;
+    }
+}
+
+bool runtime::collect_garbage_step(size_t budget, heap_info* res_info) {
+    if(incremental == nullptr) {
+        // the new space must hold everything that could be promoted while the collection runs,
+        // as well as the nursery when it finishes
+        size_t used     = (old_next - old_space) + (heap_next - heap);
+        size_t capacity = std::max(
+            (size_t)(policy.old_space_growth * used) + heap_size, old_capacity + heap_size
+        );
+        incremental = new incremental_gc(this, capacity);
+        // slots that already refer to the nursery have to be copied again at the end, like
+        // the ones written from now on
+        mutation_log.assign(remembered.begin(), remembered.end());
+        for_each_root([&](value& v) { incremental->forward(v, false); });
+    }
+    incremental->scan_some(budget, false);
+    size_t copied = incremental->copied, scanned = incremental->scanned;
+    if(incremental->scan < incremental->to_next) {
+        fill_heap_info(res_info, 0);
+        return false;
+    }
+    size_t promoted = finish_incremental();
+    fill_heap_info(res_info, promoted);
+    if(res_info != nullptr) {
+        res_info->copied  = copied;
+        res_info->scanned = scanned;
+    }
+    return true;
+}
+
+bool runtime::collect_garbage_step(std::chrono::microseconds budget, heap_info* res_info) {
+    auto deadline = std::chrono::steady_clock::now() + budget;
+    do {
+        if(collect_garbage_step((size_t)(16 * 1024), res_info)) return true;
+    } while(std::chrono::steady_clock::now() < deadline);
+    return false;
+}
+
+runtime::~runtime() {
+    // until an incremental collection finishes, the C++ values are still owned by the originals
+    // in the old space rather than by their replicas
+    if(incremental != nullptr) {
+        delete[] incremental->to_space;
+        delete incremental;
+    }
+    for(auto x : owned_externs) {
+        auto* h = (owned_extern_header*)(x - sizeof(owned_extern_header));
+        h->deconstructor((void*)x);
+    }
+    for(auto x : function_objects)
+        function_at((value*)x)->~shared_ptr();
+    for(auto x : young_function_objects)
+        function_at((value*)x)->~shared_ptr();
+    delete[] heap;
+    delete[] old_space;
+}
+
+size_t runtime::finish_incremental() {
+    auto* inc = incremental;
+    collections++;
+    full_collections++;
+    for_each_root([&](value& v) { v = inc->forward(v, true); });
+    for(auto* slot : mutation_log) {
+        if(!inc->in_from(slot)) continue;
+        value* r = inc->replicas[((uint8_t*)slot - inc->from) / sizeof(value)];
+        if(r != nullptr) *r = inc->forward(*slot, true);
+    }
+    inc->scan_some(SIZE_MAX, true);
+    // the templates of function objects scanned earlier still refer to the old space
+    for(auto* fn : inc->functions)
+        trace_function(*fn, [&](value& v) { v = inc->forward(v, true); });
+    inc->scan_some(SIZE_MAX, true);
+
+    // the replicas of C++ values take them over, the ones left behind are garbage
+    std::unordered_set<size_t> live_owned_externs;
+    for(auto x : owned_externs) {
+        auto* ob = (value*)(x - sizeof(owned_extern_header) - sizeof(value));
+        auto* h  = (owned_extern_header*)(ob + 1);
+        if(in_nursery(ob) && (*ob & 0xf) == FORWARD_TAG) {
+            live_owned_externs.insert(x - (size_t)ob + (size_t)(*ob >> 4));
+            continue;
+        }
+        value* r = inc->in_from(ob) ? inc->replicas[((uint8_t*)ob - inc->from) / sizeof(value)]
+                                    : nullptr;
+        if(r != nullptr) {
+            size_t t = (size_t)r + sizeof(value) + sizeof(owned_extern_header);
+            h->move((void*)t, (void*)x);
+            live_owned_externs.insert(t);
+        } else {
+            h->deconstructor((void*)x);
+        }
+    }
+    owned_externs = std::move(live_owned_externs);
+
+    // so are the templates, whose replicas take over from the original function objects
+    auto moved = [&](value obj) {
+        auto*  ob = (value*)(obj >> 4);
+        value* r  = nullptr;
+        if(in_nursery(ob))
+            r = (*ob & 0xf) == FORWARD_TAG ? (value*)(*ob >> 4) : nullptr;
+        else
+            r = inc->replicas[((uint8_t*)ob - inc->from) / sizeof(value)];
+        return r != nullptr ? ((value)r << 4) | (value)value_type::_object : NIL;
+    };
+    rebuild_function_index(moved);
+    young_functions_indexed = false;
+    std::unordered_set<size_t> live_function_objects;
+    for(auto x : young_function_objects)
+        function_objects.insert(x);
+    young_function_objects.clear();
+    for(auto x : function_objects) {
+        auto* ob = (value*)x;
+        value f  = moved(((value)x << 4) | (value)value_type::_object);
+        if(f == NIL) {
+            function_at(ob)->~shared_ptr();
+            continue;
+        }
+        auto* r = (value*)(f >> 4);
+        if(!in_nursery(ob)) new(r + 1) std::shared_ptr<function>(std::move(*function_at(ob)));
+        live_function_objects.insert((size_t)r);
+    }
+    function_objects = std::move(live_function_objects);
+
+#ifdef _DEBUG
+    memset(heap, 0xcd, heap_size);
+    memset(old_space, 0xcd, old_capacity);
 #endif
 
-    delete heap;
-    heap          = new_heap;
-    heap_next     = new_heap_next;
-    owned_externs = st.new_owned_externs;
+    heap_next = heap;
+    delete[] old_space;
+    old_space    = inc->to_space;
+    old_next     = inc->to_next;
+    old_capacity = inc->to_capacity;
+    remembered.clear();
+    mutation_log.clear();
+    incremental     = nullptr;
+    size_t promoted = inc->promoted;
+    delete inc;
+    return promoted;
 }
 
 value_handle runtime::handle_for(value v) {
@@ -0,0 +1,263 @@
+#include "emlisp_pool.h"
+#include <algorithm>
+
+namespace emlisp {
+packed_value packed_value::pack(runtime& rt, value v) { return {rt.pack(v)}; }
+
+value packed_value::unpack(runtime& rt) const { return rt.unpack(words.data(), words.size()); }
+
+channel::channel(size_t capacity) {
+    size_t size = 1;
+    while(size < capacity)
+        size *= 2;
+    slots = std::make_unique<slot[]>(size);
+    mask  = size - 1;
+    for(size_t i = 0; i < size; ++i)
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+// A slot at position `pos` is free to fill when its sequence is `pos`, and full once it is
+// `pos + 1`. Taking the value makes it `pos + capacity`, free for the next time around the ring.
+bool channel::try_send(packed_value& v) {
+    size_t pos = tail.load(std::memory_order_relaxed);
+    for(;;) {
+        slot&     s    = slots[pos & mask];
+        size_t    seq  = s.sequence.load(std::memory_order_acquire);
+        ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)pos;
+        if(diff == 0) {
+            if(tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                s.value = std::move(v);
+                s.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if(diff < 0) {
+            // the receivers haven't taken the value of the last time around yet
+            return false;
+        } else {
+            pos = tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool channel::try_receive(packed_value& v) {
+    size_t pos = head.load(std::memory_order_relaxed);
+    for(;;) {
+        slot&     s    = slots[pos & mask];
+        size_t    seq  = s.sequence.load(std::memory_order_acquire);
+        ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)(pos + 1);
+        if(diff == 0) {
+            if(head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                v = std::move(s.value);
+                s.sequence.store(pos + mask + 1, std::memory_order_release);
+                return true;
+            }
+        } else if(diff < 0) {
+            return false;
+        } else {
+            pos = head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+namespace {
+// spin for a while before giving up the thread, since the other side is usually about to act
+template<typename F>
+void wait_until(F&& done) {
+    for(size_t tries = 0; !done(); ++tries) {
+        if(tries < 64)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+}
+}  // namespace
+
+void channel::send(packed_value v) {
+    wait_until([&] { return try_send(v); });
+}
+
+packed_value channel::receive() {
+    packed_value v;
+    wait_until([&] { return try_receive(v); });
+    return v;
+}
+
+void channel::define_functions(runtime& rt) {
+    rt.define_fn("send", [](runtime* rt, value args, void* d) {
+        value v = first(second(args));
+        rt->get_extern_reference<channel>(first(args))->send(packed_value::pack(*rt, v));
+        return v;
+    });
+    rt.define_fn("receive", [](runtime* rt, value args, void* d) {
+        return rt->get_extern_reference<channel>(first(args))->receive().unpack(*rt);
+    });
+}
+
+namespace {
+packed_value apply_global(runtime& rt, const std::string& fn, const packed_value& args) {
+    value      a = args.unpack(rt);
+    root_guard g(&rt, a);
+    return packed_value::pack(rt, rt.apply(rt.global(fn), a));
+}
+
+// a call made by `future-call`, which is run by whichever of a worker and `touch` gets to it first
+struct future_state {
+    std::string                      fn;
+    packed_value                     args;
+    std::atomic<bool>                claimed{false};
+    std::promise<packed_value>       promise;
+    std::shared_future<packed_value> result = promise.get_future().share();
+
+    void run(runtime& rt) {
+        if(claimed.exchange(true)) return;
+        try {
+            promise.set_value(apply_global(rt, fn, args));
+        } catch(...) { promise.set_exception(std::current_exception()); }
+    }
+};
+using future_ref = std::shared_ptr<future_state>;
+
+// the pool and the index of the worker running on this thread, if it is one
+thread_local const runtime_pool* current_pool   = nullptr;
+thread_local size_t              current_worker = 0;
+}  // namespace
+
+runtime_pool::runtime_pool(
+    std::shared_ptr<const runtime_base> base, size_t count, size_t heap_size, eval_mode mode
+)
+    : base(base), heap_size(heap_size), mode(mode) {
+    if(count == 0) count = std::max(std::thread::hardware_concurrency(), 1u);
+    for(size_t i = 0; i < count; ++i) {
+        workers.push_back(std::make_unique<worker>());
+        workers.back()->rt = std::make_unique<runtime>(base, heap_size, mode);
+        // a worker is built on the base already, so it runs what it touches itself
+        attach(*workers.back()->rt, *workers.back()->rt);
+    }
+    // every worker exists before any of them starts looking for jobs to steal
+    for(size_t i = 0; i < count; ++i)
+        workers[i]->thread = std::thread([this, i] { work(i); });
+}
+
+runtime_pool::~runtime_pool() {
+    {
+        std::lock_guard<std::mutex> l(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(auto& w : workers)
+        w->thread.join();
+}
+
+void runtime_pool::post(std::function<void(runtime&)> job) {
+    size_t target = current_pool == this ? current_worker : next_worker++ % workers.size();
+    {
+        std::lock_guard<std::mutex> l(workers[target]->lock);
+        workers[target]->jobs.push_back(std::move(job));
+    }
+    // counted under the mutex so that a worker going to sleep either sees the job or is woken
+    {
+        std::lock_guard<std::mutex> l(mutex);
+        queued++;
+    }
+    wake.notify_one();
+}
+
+bool runtime_pool::take(size_t self, std::function<void(runtime&)>& job) {
+    {
+        auto&                       own = *workers[self];
+        std::lock_guard<std::mutex> l(own.lock);
+        if(!own.jobs.empty()) {
+            job = std::move(own.jobs.back());
+            own.jobs.pop_back();
+            queued--;
+            return true;
+        }
+    }
+    for(size_t i = 1; i < workers.size(); ++i) {
+        auto&                       victim = *workers[(self + i) % workers.size()];
+        std::lock_guard<std::mutex> l(victim.lock);
+        if(!victim.jobs.empty()) {
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void runtime_pool::work(size_t self) {
+    current_pool   = this;
+    current_worker = self;
+    std::function<void(runtime&)> job;
+    for(;;) {
+        if(take(self, job)) {
+            job(*workers[self]->rt);
+            job = nullptr;
+            continue;
+        }
+        std::unique_lock<std::mutex> l(mutex);
+        wake.wait(l, [&] { return stopping || queued > 0; });
+        if(stopping && queued == 0) return;
+    }
+}
+
+std::future<packed_value> runtime_pool::submit(std::string_view fn, packed_value args) {
+    return run([fn = std::string(fn), args = std::move(args)](runtime& rt) {
+        return apply_global(rt, fn, args);
+    });
+}
+
+std::future<packed_value> runtime_pool::submit(runtime& from, std::string_view fn, value args) {
+    return submit(fn, packed_value::pack(from, args));
+}
+
+void runtime_pool::attach(runtime& rt) {
+    // `rt` could have globals that the base doesn't, or define them differently
+    runtime* runner;
+    {
+        std::lock_guard<std::mutex> l(runners_lock);
+        runners.push_back(std::make_unique<runtime>(base, heap_size, mode));
+        runner = runners.back().get();
+    }
+    attach(*runner, *runner);
+    attach(rt, *runner);
+}
+
+void runtime_pool::attach(runtime& rt, runtime& runner) {
+    // (future-call 'f f args), where the name is the head of the call as it was written
+    rt.define_fn(
+        "future-call",
+        [](runtime* rt, value args, void* d) {
+            value name = first(args), f = first(second(args));
+            value call_args = first(second(second(args)));
+            bool  is_global = false;
+            if(type_of(name) == value_type::sym) {
+                try {
+                    is_global = rt->global(rt->symbol_str(name)) == f;
+                } catch(const std::runtime_error&) {}
+            }
+            if(!is_global) return rt->apply(f, call_args);
+            auto state  = std::make_shared<future_state>();
+            state->fn   = rt->symbol_str(name);
+            state->args = packed_value::pack(*rt, call_args);
+            ((runtime_pool*)d)->post([state](runtime& w) { state->run(w); });
+            return rt->make_owned_extern<future_ref>(state);
+        },
+        this
+    );
+    rt.define_fn(
+        "touch",
+        [](runtime* rt, value args, void* d) {
+            value v = first(args);
+            // like the single runtime `touch`, anything that isn't a future is its own value
+            if(!rt->is_extern_reference<future_ref>(v)) return v;
+            future_ref state = *rt->get_extern_reference<future_ref>(v);
+            state->run(*(runtime*)d);
+            return state->result.get().unpack(*rt);
+        },
+        &runner
+    );
+    channel::define_functions(rt);
+}
+}  // namespace emlisp
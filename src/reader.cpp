@@ -3,14 +3,6 @@
 #include <iostream>
 
 namespace emlisp {
-value reverse_list(value head) {
-    if(head == NIL || second(head) == NIL) return head;
-    value rest           = reverse_list(second(head));
-    second(second(head)) = head;
-    second(head)         = NIL;
-    return rest;
-}
-
 value runtime::parse_value(std::string_view src, size_t& i, bool quasimode) {
     for(; i < src.size(); ++i) {
         if(std::isspace(src[i]) != 0) continue;
@@ -18,13 +10,15 @@ value runtime::parse_value(std::string_view src, size_t& i, bool quasimode) {
         if(src[i] == '(' || src[i] == '[') {
             char end = src[i] == '[' ? ']' : ')';
             i++;
-            value res = NIL;
+            // the elements wait on the stack, where the collector can find them, until the list
+            // can be built from the back
+            size_t base = stack.size();
             while(i < src.size() && src[i] != end) {
                 value e = parse_value(src, i, quasimode);
-                res     = cons(e, res);
+                stack.push_back(e);
             }
             i++;
-            return reverse_list(res);
+            return list_from_stack(base);
         } else if(src[i] == '\'') {
             i++;
             return cons(sym_quote, cons(parse_value(src, i)));
@@ -58,7 +52,8 @@ value runtime::parse_value(std::string_view src, size_t& i, bool quasimode) {
             }
             i++;
             return this->from_str(s);
-        } else if(src[i] == '-' || std::isdigit(src[i]) != 0) {
+        } else if((src[i] == '-' && i + 1 < src.size() && std::isdigit(src[i + 1]) != 0)
+                  || std::isdigit(src[i]) != 0) {
             size_t start    = i;
             bool   is_float = false;
             if(src[i] == '-') i++;
@@ -67,8 +62,7 @@ value runtime::parse_value(std::string_view src, size_t& i, bool quasimode) {
                 i++;
             }
             if(is_float) {
-                auto v = (float)std::atof(src.data() + start);
-                return ((*(uint64_t*)&v) << 4) | (uint64_t)value_type::float_t;
+                return from_float((float)std::atof(src.data() + start));
             }
             auto v = std::atoll(src.data() + start);
             return (v << 4) | (uint64_t)value_type::int_t;
@@ -78,7 +72,7 @@ value runtime::parse_value(std::string_view src, size_t& i, bool quasimode) {
                 i++;
                 return TRUE;
             }
-            if(src[i] == 'f') {
+            if(src[i] == 'f' && src.substr(i, 4) != "f32(" && src.substr(i, 4) != "f64(") {
                 i++;
                 return FALSE;
             }
@@ -86,32 +80,78 @@ value runtime::parse_value(std::string_view src, size_t& i, bool quasimode) {
                 i++;
                 return NIL;
             }
-            // if(src[i] == 'v') {
-            //     i++;
-            //     if(src[i++] != '(') throw std::runtime_error("unknown #v");
-            //     std::vector<float> vals;
-            //     while(i < src.size() && src[i] != ')') {
-            //         if(std::isspace(src[i]) != 0) {
-            //             i++;
-            //             continue;
-            //         }
-            //         size_t start = i;
-            //         if(src[i] == '-') i++;
-            //         while(i < src.size() && (std::isdigit(src[i]) != 0 || src[i] == '.'))
-            //             i++;
-            //         auto v = (float)std::atof(src.data() + start);
-            //         vals.push_back(v);
-            //     }
-            //     i++;
-            //     return this->from_fvec(vals.size(), vals.data());
-            // }
-            throw std::runtime_error("unknown #");
+            if(src[i] == '(') {
+                i++;
+                size_t base = stack.size();
+                while(i < src.size() && src[i] != ')') {
+                    value e = parse_value(src, i);
+                    stack.push_back(e);
+                }
+                i++;
+                return vector_from_stack(base);
+            }
+            // vecs: #vec2, #vec3 or #vec4 followed by as many numbers
+            if(src.substr(i, 3) == "vec" && i + 4 < src.size() && src[i + 3] >= '2'
+               && src[i + 3] <= '4' && src[i + 4] == '(') {
+                size_t dim = src[i + 3] - '0', n = 0;
+                float  xs[4];
+                i += 5;
+                while(i < src.size() && src[i] != ')') {
+                    if(std::isspace(src[i]) != 0) {
+                        i++;
+                        continue;
+                    }
+                    value v = parse_value(src, i);
+                    if(n == dim
+                       || (type_of(v) != value_type::int_t && type_of(v) != value_type::float_t))
+                        throw std::runtime_error("a vec literal holds as many numbers as its size");
+                    xs[n++] = type_of(v) == value_type::int_t ? (float)to_int(v) : to_float(v);
+                }
+                i++;
+                if(n != dim)
+                    throw std::runtime_error("a vec literal holds as many numbers as its size");
+                return make_vec(dim, xs);
+            }
+            // packed arrays: #v or #f32 for floats, #f64 for doubles and #i64 for integers
+            object_kind kind = object_kind::f32_array;
+            if(src.substr(i, 2) == "v(") {
+                i += 1;
+            } else if(src.substr(i, 4) == "f32(") {
+                i += 3;
+            } else if(src.substr(i, 4) == "f64(") {
+                kind = object_kind::f64_array;
+                i += 3;
+            } else if(src.substr(i, 4) == "i64(") {
+                kind = object_kind::i64_array;
+                i += 3;
+            } else {
+                throw std::runtime_error("unknown #");
+            }
+            i++;
+            // numbers never allocate, so they can wait outside of the heap
+            std::vector<value> vals;
+            while(i < src.size() && src[i] != ')') {
+                if(std::isspace(src[i]) != 0) {
+                    i++;
+                    continue;
+                }
+                value v = parse_value(src, i);
+                if(type_of(v) != value_type::int_t && type_of(v) != value_type::float_t)
+                    throw std::runtime_error("arrays can only hold numbers");
+                vals.push_back(v);
+            }
+            i++;
+            value arr = make_array(kind, vals.size());
+            for(size_t j = 0; j < vals.size(); ++j)
+                array_set(arr, j, vals[j]);
+            return arr;
         } else if(src[i] == ';') {
             while(i < src.size() && src[i] != '\n')
                 i++;
         } else {
             size_t start = i;
-            while(i < src.size() && (std::isspace(src[i]) == 0) && src[i] != '(' && src[i] != ')')
+            while(i < src.size() && (std::isspace(src[i]) == 0) && src[i] != '(' && src[i] != ')'
+                  && src[i] != '[' && src[i] != ']')
                 i++;
             return this->symbol(src.substr(start, i - start));
         }
@@ -120,16 +160,29 @@ value runtime::parse_value(std::string_view src, size_t& i, bool quasimode) {
 }
 
 value runtime::read(std::string_view src) {
-    size_t i = 0;
-    return parse_value(src, i);
+    size_t i    = 0;
+    size_t base = stack.size();
+    try {
+        return parse_value(src, i);
+    } catch(...) {
+        stack.resize(base);
+        throw;
+    }
 }
 
 value runtime::read_all(std::string_view src) {
     size_t i    = 0;
-    value  vals = NIL;
-    while(i < src.size())
-        vals = cons(parse_value(src, i), vals);
-    return reverse_list(vals);
+    size_t base = stack.size();
+    try {
+        while(i < src.size()) {
+            value v = parse_value(src, i);
+            stack.push_back(v);
+        }
+    } catch(...) {
+        stack.resize(base);
+        throw;
+    }
+    return list_from_stack(base);
 }
 
 std::ostream& runtime::write(std::ostream& os, value v) {
@@ -142,20 +195,59 @@ std::ostream& runtime::write(std::ostream& os, value v) {
             auto* vf = (float*)&vv;
             os << *vf;
         } break;
-        case value_type::sym: os << this->symbols[v >> 4]; break;
+        case value_type::sym: os << symbol_name(v >> 4); break;
         case value_type::str: {
             os << '"' << to_str(v) << '"';
         } break;
-        // case value_type::fvec: {
-        //     auto len  = *((uint32_t*)(v >> 4));
-        //     auto data = (float*)((v >> 4) + sizeof(uint32_t));
-        //     os << "#v(";
-        //     for(auto i = 0; i < len; ++i) {
-        //         os << data[i];
-        //         if(i < len - 1) os << " ";
-        //     }
-        //     os << ")";
-        // } break;
+        case value_type::vector: {
+            os << "#(";
+            for(size_t i = 0, n = vector_length(v); i < n; ++i) {
+                if(i > 0) os << " ";
+                write(os, vector_ref(v, i));
+            }
+            os << ")";
+        } break;
+        case value_type::array: {
+            auto kind = array_kind(v);
+            os << (kind == object_kind::f32_array   ? "#v("
+                   : kind == object_kind::f64_array ? "#f64("
+                                                    : "#i64(");
+            for(size_t i = 0, n = array_length(v); i < n; ++i) {
+                if(i > 0) os << " ";
+                if(kind == object_kind::f32_array)
+                    os << array_data<float>(v)[i];
+                else if(kind == object_kind::f64_array)
+                    os << array_data<double>(v)[i];
+                else
+                    os << array_data<int64_t>(v)[i];
+            }
+            os << ")";
+        } break;
+        case value_type::vec: {
+            os << "#vec" << vec_dim(v) << "(";
+            for(size_t i = 0, n = vec_dim(v); i < n; ++i) {
+                if(i > 0) os << " ";
+                os << vec_data(v)[i];
+            }
+            os << ")";
+        } break;
+        case value_type::hash: {
+            // in the order of the slots, which the reader has no syntax for
+            os << "#hash(";
+            value  entries = object_data(v)[(size_t)hash_word::entries];
+            bool   any     = false;
+            for(size_t i = 0, n = vector_length(entries); i < n; i += 2) {
+                if(vector_ref(entries, i) == UNBOUND) continue;
+                if(any) os << " ";
+                os << "(";
+                write(os, vector_ref(entries, i));
+                os << " . ";
+                write(os, vector_ref(entries, i + 1));
+                os << ")";
+                any = true;
+            }
+            os << ")";
+        } break;
         case value_type::cons: {
             os << "(";
             write(os, first(v));
@@ -176,6 +268,7 @@ std::ostream& runtime::write(std::ostream& os, value v) {
                << "<" << std::hex << v << std::dec << ">";
             break;
         case value_type::_extern: os << "<" << std::hex << v << std::dec << ">"; break;
+        case value_type::_object: os << "#object<" << std::hex << v << std::dec << ">"; break;
     }
     return os;
 }
@@ -188,13 +281,13 @@ std::ostream& operator<<(std::ostream& os, value_type vt) {
            "float",
            "symbol",
            "string",
+           "vector",
            "?",
            "?",
-           "?",
-           "?",
-           "?",
-           "?",
-           "?",
+           "array",
+           "vec",
+           "hash",
+           "object",
            "extern",
            "closure",
            "cons"};
@@ -0,0 +1,516 @@
+#include "emlisp.h"
+#include <cstring>
+#include <ostream>
+
+namespace emlisp {
+// Serialized values start with `SER_MAGIC` and a version byte, followed by
+//
+//     symbol count, then each symbol as (length << 1 | unique) and its name
+//     the number of conses and the bytes the strings, vectors, arrays and vecs take in the heap
+//     the value
+//
+// A value is a `ser_tag` byte and its operand. Conses, vectors, arrays and strings are written
+// where they are first reached, a cons as its tag followed by its first and then its second value,
+// a vector as its tag and length followed by its elements, and an array as its tag, kind and size
+// in bytes followed by its elements in the byte order of the machine. A vec is its tag and
+// dimension followed by all four of its floats, also in the byte order of the machine. Nodes are
+// numbered in the order they are written so that later references to the same node are written as
+// `ser_tag::node` with its number, which keeps shared structure and cycles intact. Counts, lengths
+// and operands are LEB128 varints.
+constexpr char    SER_MAGIC[4] = {'e', 'm', 'l', 'v'};
+constexpr uint8_t SER_VERSION  = 1;
+
+namespace {
+enum class ser_tag : uint8_t {
+    nil,
+    false_v,
+    true_v,
+    int_v,
+    float_v,
+    sym,
+    cons,
+    str,
+    node,
+    vector,
+    array,
+    vec
+};
+
+struct ser_writer {
+    std::string& out;
+
+    void byte(uint8_t b) { out.push_back((char)b); }
+
+    void varint(uint64_t x) {
+        while(x >= 0x80) {
+            byte((uint8_t)(x | 0x80));
+            x >>= 7;
+        }
+        byte((uint8_t)x);
+    }
+
+    void tagged(ser_tag t, uint64_t x) {
+        byte((uint8_t)t);
+        varint(x);
+    }
+};
+
+struct ser_reader {
+    const uint8_t* at;
+    const uint8_t* end;
+
+    uint8_t byte() {
+        if(at == end) throw std::runtime_error("truncated serialized value");
+        return *at++;
+    }
+
+    uint64_t varint() {
+        uint64_t x = 0;
+        for(int shift = 0; shift < 64; shift += 7) {
+            uint8_t b = byte();
+            x |= (uint64_t)(b & 0x7f) << shift;
+            if((b & 0x80) == 0) return x;
+        }
+        throw std::runtime_error("invalid serialized value");
+    }
+
+    std::string_view bytes(uint64_t n) {
+        if((uint64_t)(end - at) < n) throw std::runtime_error("truncated serialized value");
+        std::string_view s((const char*)at, n);
+        at += n;
+        return s;
+    }
+};
+
+// the numbers of nodes that can't be marked in place, open addressing on the address
+struct node_numbers {
+    std::vector<std::pair<value, uint64_t>> entries = std::vector<std::pair<value, uint64_t>>(64);
+    size_t                                  count   = 0;
+
+    size_t slot(value v) const {
+        size_t mask = entries.size() - 1;
+        size_t i    = (size_t)((v >> 4) * 0x9e3779b97f4a7c15ull >> 20) & mask;
+        while(entries[i].first != 0 && entries[i].first != v)
+            i = (i + 1) & mask;
+        return i;
+    }
+
+    std::optional<uint64_t> find(value v) const {
+        auto& e = entries[slot(v)];
+        if(e.first == v) return e.second;
+        return std::nullopt;
+    }
+
+    void add(value v, uint64_t n) {
+        entries[slot(v)] = {v, n};
+        if(2 * ++count > entries.size()) {
+            auto old = std::move(entries);
+            entries.assign(old.size() * 2, {0, 0});
+            for(auto& e : old)
+                if(e.first != 0) entries[slot(e.first)] = e;
+        }
+    }
+};
+}  // namespace
+
+void runtime::serialize(std::ostream& out, value v) {
+    std::string body;
+    ser_writer  w{body};
+    // symbols by index plus one, the index into `syms`
+    std::vector<uint32_t> sym_ids(symbol_count(), 0);
+    std::vector<value>    syms;
+    size_t                cons_count = 0, object_bytes = 0;
+    // nodes in the heap are marked as written by replacing their first word with their number,
+    // the way a collection forwards them, which is put back once the value is written. Nodes
+    // elsewhere are looked up instead
+    std::vector<std::pair<value*, value>> marked;
+    node_numbers                          unmarked;
+    uint64_t                              node_count = 0;
+    auto                                  number     = [&](value x) -> std::optional<uint64_t> {
+        auto* p = (value*)(x >> 4);
+        if(in_nursery(p) || in_old_space(p)) {
+            if((*p & 0xf) == FORWARD_TAG) return *p >> 4;
+            marked.emplace_back(p, *p);
+            *p = (node_count++ << 4) | FORWARD_TAG;
+            return std::nullopt;
+        }
+        auto n = unmarked.find(x);
+        if(!n.has_value()) unmarked.add(x, node_count++);
+        return n;
+    };
+
+    // the values still to be written, the first of a cons is pushed last so it is written first
+    std::vector<value> todo = {v};
+    try {
+        while(!todo.empty()) {
+            value x = todo.back();
+            todo.pop_back();
+            switch(type_of(x)) {
+                case value_type::nil: w.byte((uint8_t)ser_tag::nil); continue;
+                case value_type::bool_t:
+                    w.byte((uint8_t)(x == FALSE ? ser_tag::false_v : ser_tag::true_v));
+                    continue;
+                case value_type::int_t: {
+                    // zigzag, so that small negative numbers stay short
+                    int64_t i = (int64_t)x >> 4;
+                    w.tagged(ser_tag::int_v, ((uint64_t)i << 1) ^ (uint64_t)(i >> 63));
+                }
+                    continue;
+                case value_type::float_t: w.tagged(ser_tag::float_v, x >> 4); continue;
+                case value_type::sym: {
+                    auto& id = sym_ids[x >> 4];
+                    if(id == 0) {
+                        syms.push_back(x);
+                        id = syms.size();
+                    }
+                    w.tagged(ser_tag::sym, id - 1);
+                }
+                    continue;
+                case value_type::cons:
+                case value_type::str:
+                case value_type::vector:
+                case value_type::array:
+                case value_type::vec: break;
+                default: throw std::runtime_error("only data can be serialized");
+            }
+            // read the node before `number` marks it
+            value* p = (value*)(x >> 4);
+            value  a = p[0], b = type_of(x) == value_type::cons ? p[1] : NIL;
+            auto   n = number(x);
+            if(n.has_value()) {
+                w.tagged(ser_tag::node, n.value());
+            } else if(type_of(x) == value_type::cons) {
+                w.byte((uint8_t)ser_tag::cons);
+                cons_count++;
+                todo.push_back(b);
+                todo.push_back(a);
+            } else if(type_of(x) == value_type::vector) {
+                // marking only replaced the header, the elements are still there
+                size_t length = header_payload_bytes(a) / sizeof(value);
+                w.tagged(ser_tag::vector, length);
+                object_bytes += object_size(a);
+                for(size_t i = length; i > 0; --i)
+                    todo.push_back(p[i]);
+            } else if(type_of(x) == value_type::array) {
+                w.tagged(ser_tag::array, (uint8_t)header_kind(a));
+                w.varint(header_payload_bytes(a));
+                body.append((const char*)(p + 1), header_payload_bytes(a));
+                object_bytes += object_size(a);
+            } else if(type_of(x) == value_type::vec) {
+                w.tagged(ser_tag::vec, (size_t)header_kind(a) - (size_t)object_kind::vec2 + 2);
+                body.append((const char*)(p + 1), 4 * sizeof(float));
+                object_bytes += object_size(a);
+            } else {
+                std::string_view s((const char*)(p + 1), header_payload_bytes(a));
+                w.tagged(ser_tag::str, s.size());
+                body.append(s);
+                object_bytes += object_size(a);
+            }
+        }
+    } catch(...) {
+        for(auto& [p, word] : marked)
+            *p = word;
+        throw;
+    }
+    for(auto& [p, word] : marked)
+        *p = word;
+
+    std::string head;
+    ser_writer  h{head};
+    head.append(SER_MAGIC, sizeof(SER_MAGIC));
+    h.byte(SER_VERSION);
+    h.varint(syms.size());
+    for(auto s : syms) {
+        const auto& name = symbol_name(s >> 4);
+        // unique symbols are made again when the value is read, not looked up by name
+        bool unique = symbol(name) != s;
+        h.varint((name.size() << 1) | (unique ? 1 : 0));
+        head.append(name);
+    }
+    h.varint(cons_count);
+    h.varint(object_bytes);
+    out.write(head.data(), (std::streamsize)head.size());
+    out.write(body.data(), (std::streamsize)body.size());
+}
+
+value runtime::deserialize(const uint8_t* data, size_t size) {
+    ser_reader r{data, data + size};
+    if(r.bytes(sizeof(SER_MAGIC)) != std::string_view(SER_MAGIC, sizeof(SER_MAGIC)))
+        throw std::runtime_error("not a serialized value");
+    if(r.byte() != SER_VERSION) throw std::runtime_error("unsupported serialized value version");
+
+    std::vector<value> syms(r.varint());
+    for(auto& s : syms) {
+        uint64_t entry = r.varint();
+        s              = symbol(r.bytes(entry >> 1));
+        if((entry & 1) != 0) s = unique_symbol(s);
+    }
+    uint64_t cons_count   = r.varint();
+    uint64_t object_bytes = r.varint();
+    // every cons takes at least a byte, and every string or vector element its header or tag
+    if(cons_count > size || object_bytes / sizeof(value) > size)
+        throw std::runtime_error("invalid serialized value");
+
+    // all of the nodes are allocated at once, so nothing moves while they are read, and the stores
+    // into them need no write barrier since they are all in the nursery
+    uint8_t* next  = alloc(cons_count * 2 * sizeof(value) + object_bytes);
+    uint8_t* limit = next + cons_count * 2 * sizeof(value) + object_bytes;
+    auto     take  = [&](size_t bytes) {
+        if((size_t)(limit - next) < bytes) throw std::runtime_error("invalid serialized value");
+        auto* p = next;
+        next += bytes;
+        return p;
+    };
+
+    value              result;
+    std::vector<value> nodes;
+    // the slots still to be read into, in the order the writer wrote their values
+    std::vector<value*> todo = {&result};
+    while(!todo.empty()) {
+        value* slot = todo.back();
+        todo.pop_back();
+        switch((ser_tag)r.byte()) {
+            case ser_tag::nil: *slot = NIL; break;
+            case ser_tag::false_v: *slot = FALSE; break;
+            case ser_tag::true_v: *slot = TRUE; break;
+            case ser_tag::int_v: {
+                uint64_t z = r.varint();
+                *slot      = from_int((int64_t)(z >> 1) ^ -(int64_t)(z & 1));
+            } break;
+            case ser_tag::float_v: *slot = (r.varint() << 4) | (uint64_t)value_type::float_t; break;
+            case ser_tag::sym: {
+                uint64_t ix = r.varint();
+                if(ix >= syms.size()) throw std::runtime_error("invalid serialized value");
+                *slot = syms[ix];
+            } break;
+            case ser_tag::cons: {
+                auto* c = (value*)take(2 * sizeof(value));
+                c[0] = c[1] = NIL;
+                *slot       = (((uint64_t)c) << 4) | (uint64_t)value_type::cons;
+                nodes.push_back(*slot);
+                todo.push_back(c + 1);
+                todo.push_back(c);
+            } break;
+            case ser_tag::str: {
+                auto  s = r.bytes(r.varint());
+                auto* o = (value*)take(object_size(make_header(object_kind::string, s.size())));
+                o[0]    = make_header(object_kind::string, s.size());
+                std::memcpy(o + 1, s.data(), s.size());
+                *slot = (((uint64_t)o) << 4) | (uint64_t)value_type::str;
+                nodes.push_back(*slot);
+            } break;
+            case ser_tag::vector: {
+                uint64_t length = r.varint();
+                if(length > size) throw std::runtime_error("invalid serialized value");
+                auto* o = (value*)take((length + 1) * sizeof(value));
+                o[0]    = make_header(object_kind::vector, length * sizeof(value));
+                std::fill(o + 1, o + 1 + length, NIL);
+                *slot = (((uint64_t)o) << 4) | (uint64_t)value_type::vector;
+                nodes.push_back(*slot);
+                for(size_t i = length; i > 0; --i)
+                    todo.push_back(o + i);
+            } break;
+            case ser_tag::array: {
+                auto kind = (object_kind)r.varint();
+                if(kind != object_kind::f32_array && kind != object_kind::f64_array
+                   && kind != object_kind::i64_array)
+                    throw std::runtime_error("invalid serialized value");
+                auto s = r.bytes(r.varint());
+                if(s.size() % array_element_size(kind) != 0)
+                    throw std::runtime_error("invalid serialized value");
+                auto* o = (value*)take(object_size(make_header(kind, s.size())));
+                o[0]    = make_header(kind, s.size());
+                std::memcpy(o + 1, s.data(), s.size());
+                *slot = (((uint64_t)o) << 4) | (uint64_t)value_type::array;
+                nodes.push_back(*slot);
+            } break;
+            case ser_tag::vec: {
+                uint64_t dim = r.varint();
+                if(dim < 2 || dim > 4) throw std::runtime_error("invalid serialized value");
+                auto  kind = (object_kind)((size_t)object_kind::vec2 + dim - 2);
+                auto  s    = r.bytes(4 * sizeof(float));
+                auto* o    = (value*)take(object_size(make_header(kind, s.size())));
+                o[0]       = make_header(kind, s.size());
+                std::memcpy(o + 1, s.data(), s.size());
+                *slot = (((uint64_t)o) << 4) | (uint64_t)value_type::vec;
+                nodes.push_back(*slot);
+            } break;
+            case ser_tag::node: {
+                uint64_t ix = r.varint();
+                if(ix >= nodes.size()) throw std::runtime_error("invalid serialized value");
+                *slot = nodes[ix];
+            } break;
+            default: throw std::runtime_error("invalid serialized value");
+        }
+    }
+    if(next != limit) throw std::runtime_error("invalid serialized value");
+    return result;
+}
+
+// A packed value is a sequence of 64 bit words:
+//
+//     symbol count, data words, the value
+//     data: the conses, vectors, arrays and strings of the value, laid out as in the heap
+//     symbols: (length << 1 | unique) followed by the name padded to a word
+//
+// Nodes are written as their word offset into the data in place of an address, and symbols as their
+// position in the symbol list, so unpacking copies the data into the nursery with a single
+// allocation and fixes those up in one pass over it.
+std::vector<uint64_t> runtime::pack(value v) {
+    constexpr size_t      HEAD = 3;
+    std::vector<uint64_t> words(HEAD, 0);
+    words.reserve(256);
+    std::vector<uint32_t> sym_ids(symbol_count(), 0);
+    std::vector<value>    syms;
+    // nodes in the heap are marked with their offset in place, like `serialize` does
+    std::vector<std::pair<value*, value>> marked;
+    node_numbers                          unmarked;
+
+    auto write = [&](value x) -> value {
+        switch(type_of(x)) {
+            case value_type::nil:
+            case value_type::bool_t:
+            case value_type::int_t:
+            case value_type::float_t: return x;
+            case value_type::sym: {
+                auto& id = sym_ids[x >> 4];
+                if(id == 0) {
+                    syms.push_back(x);
+                    id = syms.size();
+                }
+                return ((value)(id - 1) << 4) | (value)value_type::sym;
+            }
+            case value_type::cons:
+            case value_type::str:
+            case value_type::vector:
+            case value_type::array:
+            case value_type::vec: break;
+            default: throw std::runtime_error("only data can be packed");
+        }
+        auto* p    = (value*)(x >> 4);
+        bool  heap = in_nursery(p) || in_old_space(p);
+        value off  = ((value)(words.size() - HEAD) << 4) | (x & 0xf);
+        if(heap) {
+            if((*p & 0xf) == FORWARD_TAG) return (*p & ~0xf) | (x & 0xf);
+        } else {
+            auto n = unmarked.find(x);
+            if(n.has_value()) return ((value)n.value() << 4) | (x & 0xf);
+        }
+        if(type_of(x) == value_type::cons) {
+            words.push_back(p[0]);
+            words.push_back(p[1]);
+        } else {
+            size_t at = words.size();
+            words.resize(at + object_size(*p) / sizeof(value), 0);
+            std::memcpy(&words[at], p, sizeof(value) + header_payload_bytes(*p));
+        }
+        if(heap) {
+            marked.emplace_back(p, *p);
+            *p = (off & ~0xf) | FORWARD_TAG;
+        } else {
+            unmarked.add(x, off >> 4);
+        }
+        return off;
+    };
+
+    // nodes are copied as they are reached and then scanned in order like a collection does, so the
+    // conses that are copied still hold values of the runtime until the scan gets to them
+    try {
+        words[2] = write(v);
+        for(size_t i = HEAD; i < words.size();) {
+            if((words[i] & 0xf) == HEADER_TAG) {
+                size_t size = object_size(words[i]) / sizeof(value);
+                if(header_kind(words[i]) == object_kind::vector) {
+                    for(size_t j = 1; j < size; ++j) {
+                        value e      = write(words[i + j]);
+                        words[i + j] = e;
+                    }
+                }
+                i += size;
+            } else {
+                value a  = write(words[i]);
+                words[i] = a;
+                value b  = write(words[i + 1]);
+                words[i + 1] = b;
+                i += 2;
+            }
+        }
+    } catch(...) {
+        for(auto& [p, word] : marked)
+            *p = word;
+        throw;
+    }
+    for(auto& [p, word] : marked)
+        *p = word;
+
+    words[0] = syms.size();
+    words[1] = words.size() - HEAD;
+    for(auto s : syms) {
+        const auto& name = symbol_name(s >> 4);
+        // unique symbols are made again when the value is unpacked, not looked up by name
+        bool unique = symbol(name) != s;
+        words.push_back((name.size() << 1) | (unique ? 1 : 0));
+        size_t at = words.size();
+        words.resize(at + (name.size() + sizeof(uint64_t) - 1) / sizeof(uint64_t), 0);
+        std::memcpy(&words[at], name.data(), name.size());
+    }
+    return words;
+}
+
+value runtime::unpack(const uint64_t* words, size_t count) {
+    const uint64_t* end  = words + count;
+    auto            word = [&]() {
+        if(words == end) throw std::runtime_error("truncated packed value");
+        return *words++;
+    };
+    size_t symbol_count = word(), data_words = word();
+    value  root         = word();
+    if((size_t)(end - words) < data_words) throw std::runtime_error("truncated packed value");
+    const uint64_t* packed = words;
+    words += data_words;
+    std::vector<value> syms;
+    syms.reserve(symbol_count);
+    for(size_t i = 0; i < symbol_count; ++i) {
+        uint64_t entry  = word();
+        size_t   padded = ((entry >> 1) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+        if((size_t)(end - words) < padded) throw std::runtime_error("truncated packed value");
+        value s = symbol(std::string_view((const char*)words, entry >> 1));
+        syms.push_back((entry & 1) != 0 ? unique_symbol(s) : s);
+        words += padded;
+    }
+    if(words != end) throw std::runtime_error("invalid packed value");
+
+    // all in the nursery, so the stores need no write barrier
+    auto* data = data_words == 0 ? nullptr : (value*)alloc(data_words * sizeof(value));
+    if(data_words != 0) std::memcpy(data, packed, data_words * sizeof(value));
+    auto relocate = [&](value x) {
+        switch(type_of(x)) {
+            case value_type::cons:
+            case value_type::str:
+            case value_type::vector:
+            case value_type::array:
+            case value_type::vec:
+                if((x >> 4) >= data_words) throw std::runtime_error("invalid packed value");
+                return (((uint64_t)(data + (x >> 4))) << 4) | (uint64_t)type_of(x);
+            case value_type::sym:
+                if((x >> 4) >= syms.size()) throw std::runtime_error("invalid packed value");
+                return syms[x >> 4];
+            default: return x;
+        }
+    };
+    for(size_t i = 0; i < data_words;) {
+        bool   header = (data[i] & 0xf) == HEADER_TAG;
+        size_t size   = header ? object_size(data[i]) / sizeof(value) : 2;
+        if(size > data_words - i) throw std::runtime_error("invalid packed value");
+        if(!header) {
+            data[i]     = relocate(data[i]);
+            data[i + 1] = relocate(data[i + 1]);
+        } else if(header_kind(data[i]) == object_kind::vector) {
+            for(size_t j = 1; j < size; ++j)
+                data[i + j] = relocate(data[i + j]);
+        }
+        i += size;
+    }
+    return relocate(root);
+}
+}  // namespace emlisp
@@ -0,0 +1,689 @@
+#include "bytecode.h"
+#include "emlisp.h"
+#include <cstring>
+#include <fstream>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define EMLISP_MMAP_SNAPSHOTS
+#endif
+
+namespace emlisp {
+// A snapshot is a sequence of 64 bit words:
+//
+//     magic, version, then the counts of symbols, globals, macros, templates, builtins and code
+//     roots, and the bytes of old space and code space data
+//     symbols: (length << 1 | unique) followed by the name padded to a word
+//     globals: symbol, value
+//     macros: symbol, template
+//     templates: varadic, argument count, arguments..., body, then 0 or 1 followed by the code:
+//         frame size, source, instruction count, instructions packed two to a word, constant
+//         count, constants..., child count, child templates..., child objects...
+//     builtins: offset of the cell, the name of the global it was bound to
+//     code roots: offset of the slot
+//     the old space, then the code space
+//
+// Values that refer to objects hold their offset from the start of the old space, where the code
+// space is taken to follow it, in place of an address. Symbols keep the index they had in the
+// runtime that saved them, which the snapshot's symbol list maps to the names. Function objects
+// hold the number of their template, and builtin cells are left empty.
+constexpr uint64_t SNAPSHOT_MAGIC   = 0x70616e736c6d65;  // "emlsnap"
+constexpr uint64_t SNAPSHOT_VERSION = 1;
+
+namespace {
+struct snapshot_reader {
+    const uint8_t* at;
+    const uint8_t* end;
+
+    uint64_t word() {
+        if(end - at < (ptrdiff_t)sizeof(uint64_t)) throw std::runtime_error("truncated snapshot");
+        uint64_t w;
+        std::memcpy(&w, at, sizeof(w));
+        at += sizeof(w);
+        return w;
+    }
+
+    const uint8_t* bytes(size_t n) {
+        size_t padded = (n + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+        if((size_t)(end - at) < padded) throw std::runtime_error("truncated snapshot");
+        auto* p = at;
+        at += padded;
+        return p;
+    }
+};
+
+// the contents of a snapshot file, mapped into memory where that is possible
+struct snapshot_file {
+    const uint8_t*       data = nullptr;
+    size_t               size = 0;
+    std::vector<uint8_t> buffer;
+#ifdef EMLISP_MMAP_SNAPSHOTS
+    void* mapping = MAP_FAILED;
+
+    explicit snapshot_file(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0) throw std::runtime_error("can't open snapshot " + path);
+        struct stat st;
+        if(fstat(fd, &st) == 0 && st.st_size > 0) {
+            size    = (size_t)st.st_size;
+            mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if(mapping == MAP_FAILED) throw std::runtime_error("can't map snapshot " + path);
+        data = (const uint8_t*)mapping;
+    }
+
+    ~snapshot_file() {
+        if(mapping != MAP_FAILED) munmap(mapping, size);
+    }
+#else
+    explicit snapshot_file(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        if(!in) throw std::runtime_error("can't open snapshot " + path);
+        buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        data = buffer.data();
+        size = buffer.size();
+    }
+#endif
+    snapshot_file(const snapshot_file&)            = delete;
+    snapshot_file& operator=(const snapshot_file&) = delete;
+};
+
+inline bool is_builtin(value v) {
+    return type_of(v) == value_type::_extern
+           && type_of(*((value*)(v >> 4) + 1)) == value_type::_extern;
+}
+}  // namespace
+
+void runtime::save_snapshot(const std::string& path) {
+    if(!frames.empty() || !scopes.empty() || !compiling.empty())
+        throw std::runtime_error("can't save a snapshot while code is running");
+    if(base != nullptr)
+        throw std::runtime_error("can't save a snapshot of a runtime built on a base");
+    // afterwards everything lives compacted in the old space or in the code space
+    collect_garbage(nullptr, true);
+
+    size_t old_bytes  = old_next - old_space;
+    auto   chunks     = code_in_use();
+    size_t code_bytes = 0;
+    for(auto& [chunk, used] : chunks)
+        code_bytes += used;
+
+    auto offset = [&](value v) -> value {
+        if(!is_heap_type(type_of(v))) return v;
+        auto* p = (uint8_t*)(v >> 4);
+        if(in_old_space(p)) return ((value)(p - old_space) << 4) | (v & 0xf);
+        size_t base = old_bytes;
+        for(auto& [chunk, used] : chunks) {
+            if(p >= chunk && p < chunk + used)
+                return ((value)(base + (p - chunk)) << 4) | (v & 0xf);
+            base += used;
+        }
+        throw std::runtime_error("can't save a snapshot that refers to C++ values");
+    };
+
+    // builtins are saved by name, they have to be bound to a global
+    std::unordered_map<value*, value> builtins;
+    for(size_t i = 0; i < globals.size(); ++i)
+        if(globals[i] != UNBOUND && is_builtin(globals[i]))
+            builtins.emplace((value*)(globals[i] >> 4), (value)(i << 4) | (value)value_type::sym);
+
+    std::unordered_map<function*, uint64_t> template_ids;
+    std::vector<function*>                  templates;
+    auto                                    template_id = [&](function* fn) {
+        auto e = template_ids.find(fn);
+        if(e != template_ids.end()) return e->second;
+        template_ids.emplace(fn, templates.size());
+        templates.push_back(fn);
+        return (uint64_t)templates.size() - 1;
+    };
+
+    std::vector<uint64_t> data((old_bytes + code_bytes) / sizeof(value));
+    std::vector<uint64_t> builtin_words;
+    size_t                builtin_count = 0;
+    std::memcpy(data.data(), old_space, old_bytes);
+    for(size_t i = 0, n = old_bytes / sizeof(value); i < n;) {
+        value* p = (value*)old_space + i;
+        if((*p & 0xf) == HEADER_TAG) {
+            auto kind  = header_kind(*p);
+            auto words = object_size(*p) / sizeof(value);
+            if(kind == object_kind::owned_extern) {
+                throw std::runtime_error("can't save a snapshot that holds C++ values");
+            } else if(kind == object_kind::function) {
+                value obj   = ((value)p << 4) | (value)value_type::_object;
+                data[i + 1] = template_id(object_function(obj));
+                data[i + 2] = 0;
+            } else if(!holds_bytes(kind)) {
+                for(size_t j = 1; j < words; ++j)
+                    data[i + j] = offset(p[j]);
+                if(kind == object_kind::hash_table) mark_hash_table_moved((value*)&data[i]);
+            }
+            i += words;
+        } else {
+            auto b = builtins.find(p);
+            if(b != builtins.end()) {
+                data[i] = data[i + 1] = NIL;
+                builtin_words.push_back(i * sizeof(value));
+                builtin_words.push_back(b->second);
+                builtin_count++;
+            } else {
+                data[i]     = offset(p[0]);
+                data[i + 1] = offset(p[1]);
+            }
+            i += 2;
+        }
+    }
+    size_t at = old_bytes / sizeof(value);
+    for(auto& [chunk, used] : chunks) {
+        std::memcpy(&data[at], chunk, used);
+        for(size_t i = 0, n = used / sizeof(value); i < n;) {
+            value* p = (value*)chunk + i;
+            if((*p & 0xf) == HEADER_TAG) {
+                size_t words = object_size(*p) / sizeof(value);
+                if(header_kind(*p) == object_kind::vector)
+                    for(size_t j = 1; j < words; ++j)
+                        data[at + i + j] = offset(p[j]);
+                i += words;
+            } else {
+                data[at + i]     = offset(p[0]);
+                data[at + i + 1] = offset(p[1]);
+                i += 2;
+            }
+        }
+        at += used / sizeof(value);
+    }
+
+    std::vector<uint64_t> global_words, macro_words, template_words, root_words;
+    for(size_t i = 0; i < globals.size(); ++i) {
+        if(globals[i] == UNBOUND) continue;
+        global_words.push_back((i << 4) | (value)value_type::sym);
+        global_words.push_back(offset(globals[i]));
+    }
+    for(auto& [name, fn] : macros) {
+        macro_words.push_back(name);
+        macro_words.push_back(template_id(fn.get()));
+    }
+    // templates found while writing these are added to the end
+    for(size_t t = 0; t < templates.size(); ++t) {
+        function* fn = templates[t];
+        template_words.push_back(fn->varadic ? 1 : 0);
+        template_words.push_back(fn->arguments.size());
+        template_words.insert(template_words.end(), fn->arguments.begin(), fn->arguments.end());
+        template_words.push_back(offset(fn->body));
+        template_words.push_back(fn->compiled != nullptr ? 1 : 0);
+        if(fn->compiled == nullptr) continue;
+        code& c = *fn->compiled;
+        template_words.push_back(c.frame_size);
+        template_words.push_back(offset(c.source));
+        template_words.push_back(c.instrs.size());
+        for(size_t i = 0; i < c.instrs.size(); i += 2)
+            template_words.push_back(
+                c.instrs[i] | (i + 1 < c.instrs.size() ? (uint64_t)c.instrs[i + 1] << 32 : 0)
+            );
+        template_words.push_back(c.consts.size());
+        for(auto k : c.consts)
+            template_words.push_back(offset(k));
+        template_words.push_back(c.children.size());
+        for(auto& child : c.children)
+            template_words.push_back(template_id(child.get()));
+        for(auto obj : c.child_objects)
+            template_words.push_back(offset(obj));
+    }
+    for(auto* slot : code_roots)
+        root_words.push_back(offset(((value)slot << 4) | (value)value_type::cons) >> 4);
+
+    std::vector<uint64_t> words
+        = {SNAPSHOT_MAGIC,
+           SNAPSHOT_VERSION,
+           symbol_count(),
+           global_words.size() / 2,
+           macro_words.size() / 2,
+           templates.size(),
+           builtin_count,
+           root_words.size(),
+           old_bytes,
+           code_bytes};
+    for(size_t i = 0; i < symbol_count(); ++i) {
+        const auto& name   = symbol_name(i);
+        bool        unique = symbol(name) != ((i << 4) | (value)value_type::sym);
+        words.push_back((name.size() << 1) | (unique ? 1 : 0));
+        size_t w = words.size();
+        words.resize(w + (name.size() + sizeof(uint64_t) - 1) / sizeof(uint64_t), 0);
+        std::memcpy(&words[w], name.data(), name.size());
+    }
+    for(auto* section :
+        {&global_words, &macro_words, &template_words, &builtin_words, &root_words, &data})
+        words.insert(words.end(), section->begin(), section->end());
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write((const char*)words.data(), (std::streamsize)(words.size() * sizeof(uint64_t)));
+    if(!out) throw std::runtime_error("can't write snapshot " + path);
+}
+
+void runtime::load_snapshot(const std::string& path) {
+    if(!frames.empty() || !scopes.empty() || !compiling.empty())
+        throw std::runtime_error("can't load a snapshot while code is running");
+    snapshot_file   file(path);
+    snapshot_reader r{file.data, file.data + file.size};
+    if(r.word() != SNAPSHOT_MAGIC) throw std::runtime_error("not a snapshot");
+    if(r.word() != SNAPSHOT_VERSION) throw std::runtime_error("unsupported snapshot version");
+    size_t symbol_count = r.word(), global_count = r.word(), macro_count = r.word();
+    size_t template_count = r.word(), builtin_count = r.word(), root_count = r.word();
+    size_t old_bytes = r.word(), code_bytes = r.word();
+
+    std::vector<value> syms;
+    syms.reserve(symbol_count);
+    for(size_t i = 0; i < symbol_count; ++i) {
+        uint64_t entry = r.word();
+        value    s     = symbol(std::string_view((const char*)r.bytes(entry >> 1), entry >> 1));
+        syms.push_back((entry & 1) != 0 ? unique_symbol(s) : s);
+    }
+    auto sym = [&](value s) {
+        if((s >> 4) >= syms.size()) throw std::runtime_error("invalid snapshot");
+        return syms[s >> 4];
+    };
+
+    const uint8_t* global_words   = r.bytes(global_count * 2 * sizeof(uint64_t));
+    const uint8_t* macro_words    = r.bytes(macro_count * 2 * sizeof(uint64_t));
+    const uint8_t* template_words = r.at;
+    // templates have to be read to find where they end, they are made once the heap is in place
+    for(size_t t = 0; t < template_count; ++t) {
+        r.word();
+        r.bytes(r.word() * sizeof(uint64_t));
+        r.word();
+        if(r.word() == 0) continue;
+        r.word();
+        r.word();
+        r.bytes((r.word() + 1) / 2 * sizeof(uint64_t));
+        r.bytes(r.word() * sizeof(uint64_t));
+        r.bytes(r.word() * 2 * sizeof(uint64_t));
+    }
+
+    // builtins come from this runtime, so that the functions and their data belong to this process
+    std::unordered_map<uint64_t, std::pair<value, value>> builtins;
+    for(size_t i = 0; i < builtin_count; ++i) {
+        uint64_t off  = r.word();
+        value    name = sym(r.word());
+        value    here = (name >> 4) < globals.size() ? globals[name >> 4] : UNBOUND;
+        if(here == UNBOUND || !is_builtin(here))
+            throw std::runtime_error("snapshot needs the builtin " + symbol_name(name >> 4));
+        auto* cell = (value*)(here >> 4);
+        builtins.emplace(off, std::make_pair(cell[0], cell[1]));
+    }
+    std::vector<uint64_t> roots(root_count);
+    for(auto& off : roots)
+        off = r.word();
+    if(old_bytes % sizeof(value) != 0 || code_bytes % sizeof(value) != 0
+       || (size_t)(r.end - r.at) != old_bytes + code_bytes)
+        throw std::runtime_error("invalid snapshot");
+    const uint8_t* old_data  = r.at;
+    const uint8_t* code_data = r.at + old_bytes;
+
+    // make room in the old space for the snapshot's, the first collection finishes any incremental
+    // one so that the second gets to size the old space
+    collect_garbage(nullptr, true);
+    if((size_t)(old_space + old_capacity - old_next) < old_bytes) {
+        old_space_reserve = old_bytes;
+        collect_garbage(nullptr, true);
+        old_space_reserve = 0;
+    }
+    uint8_t* old_base = old_next;
+    std::memcpy(old_base, old_data, old_bytes);
+    old_next += old_bytes;
+    uint8_t* code_base = code_bytes > 0 ? code_alloc(code_bytes) : nullptr;
+    std::memcpy(code_base, code_data, code_bytes);
+
+    auto relocate = [&](value v) -> value {
+        if(type_of(v) == value_type::sym) return sym(v);
+        if(!is_heap_type(type_of(v))) return v;
+        size_t off = v >> 4;
+        if(off < old_bytes) return ((value)(old_base + off) << 4) | (v & 0xf);
+        if(off - old_bytes < code_bytes)
+            return ((value)(code_base + off - old_bytes) << 4) | (v & 0xf);
+        throw std::runtime_error("invalid snapshot");
+    };
+
+    std::vector<std::pair<value*, uint64_t>> function_objects_loaded;
+    for(size_t i = 0, n = old_bytes / sizeof(value); i < n;) {
+        value* p = (value*)old_base + i;
+        if((*p & 0xf) == HEADER_TAG) {
+            auto kind  = header_kind(*p);
+            auto words = object_size(*p) / sizeof(value);
+            if(kind == object_kind::function) {
+                function_objects_loaded.emplace_back(p, p[1]);
+            } else if(!holds_bytes(kind)) {
+                for(size_t j = 1; j < words; ++j)
+                    p[j] = relocate(p[j]);
+            }
+            i += words;
+        } else {
+            auto b = builtins.find(i * sizeof(value));
+            if(b != builtins.end()) {
+                p[0] = b->second.first;
+                p[1] = b->second.second;
+            } else {
+                p[0] = relocate(p[0]);
+                p[1] = relocate(p[1]);
+            }
+            i += 2;
+        }
+    }
+    for(size_t i = 0, n = code_bytes / sizeof(value); i < n;) {
+        value* p = (value*)code_base + i;
+        if((*p & 0xf) == HEADER_TAG) {
+            size_t words = object_size(*p) / sizeof(value);
+            if(header_kind(*p) == object_kind::vector)
+                for(size_t j = 1; j < words; ++j)
+                    p[j] = relocate(p[j]);
+            i += words;
+        } else {
+            p[0] = relocate(p[0]);
+            p[1] = relocate(p[1]);
+            i += 2;
+        }
+    }
+
+    // every template is made before any code refers to its children
+    snapshot_reader                        tr{template_words, r.end};
+    std::vector<std::shared_ptr<function>> templates;
+    std::vector<std::vector<uint64_t>>     children(template_count);
+    for(size_t t = 0; t < template_count; ++t) {
+        bool   varadic = tr.word() != 0;
+        size_t argc    = tr.word();
+        auto   fn      = std::make_shared<function>(NIL, NIL, sym_ellipsis);
+        fn->varadic    = varadic;
+        for(size_t i = 0; i < argc; ++i)
+            fn->arguments.push_back(sym(tr.word()));
+        fn->slot_arguments();
+        fn->body = relocate(tr.word());
+        templates.push_back(fn);
+        if(tr.word() == 0) continue;
+        fn->compiled     = std::make_shared<code>();
+        code& c          = *fn->compiled;
+        c.frame_size     = (uint32_t)tr.word();
+        c.source         = relocate(tr.word());
+        size_t instr_count = tr.word();
+        for(size_t i = 0; i < instr_count; i += 2) {
+            uint64_t w = tr.word();
+            c.instrs.push_back((uint32_t)w);
+            if(i + 1 < instr_count) c.instrs.push_back((uint32_t)(w >> 32));
+        }
+        // globals are addressed by symbol index, which is different in this runtime
+        for(auto& instr : c.instrs) {
+            auto op = instr_op(instr);
+            if(op != opcode::load_global && op != opcode::store_global) continue;
+            value s = sym(((value)instr_operand(instr) << 4) | (value)value_type::sym);
+            if((s >> 4) >= (1 << 24)) throw std::runtime_error("too many symbols to load snapshot");
+            instr = make_instr(op, s >> 4);
+        }
+        c.consts.resize(tr.word());
+        for(auto& k : c.consts)
+            k = relocate(tr.word());
+        children[t].resize(tr.word());
+        for(auto& child : children[t])
+            child = tr.word();
+        c.child_objects.resize(children[t].size());
+        for(auto& obj : c.child_objects)
+            obj = relocate(tr.word());
+    }
+    auto template_at = [&](uint64_t id) {
+        if(id >= templates.size()) throw std::runtime_error("invalid snapshot");
+        return templates[id];
+    };
+    for(size_t t = 0; t < template_count; ++t)
+        for(auto id : children[t])
+            templates[t]->compiled->children.push_back(template_at(id));
+
+    // the function objects that `create_function` made are found from their bodies again, the
+    // ones compiled code made for its children are only reached through that code
+    std::unordered_set<value> child_objects;
+    for(auto& fn : templates)
+        if(fn->compiled != nullptr) {
+            auto& children = fn->compiled->child_objects;
+            child_objects.insert(children.begin(), children.end());
+        }
+    for(auto [p, id] : function_objects_loaded) {
+        new(p + 1) std::shared_ptr<function>(template_at(id));
+        function_objects.insert((size_t)p);
+        value obj = ((value)p << 4) | (value)value_type::_object;
+        if(child_objects.count(obj) == 0) function_index.emplace(template_at(id)->body, obj);
+    }
+    for(auto off : roots) {
+        if(off < old_bytes || off - old_bytes >= code_bytes)
+            throw std::runtime_error("invalid snapshot");
+        code_roots.push_back((value*)(code_base + off - old_bytes));
+    }
+
+    snapshot_reader gr{global_words, macro_words};
+    for(size_t i = 0; i < global_count; ++i) {
+        value name = sym(gr.word());
+        set_global(name, relocate(gr.word()));
+    }
+    snapshot_reader mr{macro_words, template_words};
+    for(size_t i = 0; i < macro_count; ++i) {
+        value name   = sym(mr.word());
+        macros[name] = template_at(mr.word());
+    }
+}
+
+
+namespace {
+// copies the old space and code space of a runtime whose nursery is empty to `old_dest` and
+// `code_dest`, relocating the values in them, and the templates of the function objects in the
+// copy. Symbols keep their indices, and builtins and C++ references their addresses, since the
+// copy is in the same process. Templates and values of the base the runtime is built on are shared
+struct heap_copy {
+    uint8_t*                                 old_space;
+    size_t                                   old_bytes;
+    std::vector<std::pair<uint8_t*, size_t>> chunks;
+    uint8_t*                                 old_dest;
+    uint8_t*                                 code_dest;
+    const runtime_base*                      base;
+
+    std::unordered_map<function*, std::shared_ptr<function>> templates;
+    // the templates still to be relocated once every one reachable from the copy is found
+    std::vector<function*> unfilled;
+    std::vector<value*>    function_objects;
+    std::vector<value*>    hash_tables;
+
+    value relocate(value v) const {
+        if(!is_heap_type(type_of(v))) return v;
+        auto* p = (uint8_t*)(v >> 4);
+        if(p >= old_space && p < old_space + old_bytes)
+            return ((value)(old_dest + (p - old_space)) << 4) | (v & 0xf);
+        uint8_t* at = code_dest;
+        for(auto& [chunk, used] : chunks) {
+            if(p >= chunk && p < chunk + used) return ((value)(at + (p - chunk)) << 4) | (v & 0xf);
+            at += used;
+        }
+        return v;
+    }
+
+    std::shared_ptr<function> copy_template(const std::shared_ptr<function>& fn) {
+        if(base != nullptr && base->templates.count(fn.get()) != 0) return fn;
+        auto& t = templates[fn.get()];
+        if(t == nullptr) {
+            t = std::make_shared<function>(*fn);
+            unfilled.push_back(t.get());
+        }
+        return t;
+    }
+
+    void relocate_cells(value* p, size_t words) const {
+        for(size_t i = 0; i < words;) {
+            if((p[i] & 0xf) == HEADER_TAG) {
+                size_t words = object_size(p[i]) / sizeof(value);
+                if(header_kind(p[i]) == object_kind::vector)
+                    for(size_t j = 1; j < words; ++j)
+                        p[i + j] = relocate(p[i + j]);
+                i += words;
+            } else {
+                p[i]     = relocate(p[i]);
+                p[i + 1] = relocate(p[i + 1]);
+                i += 2;
+            }
+        }
+    }
+
+    void copy() {
+        std::memcpy(old_dest, old_space, old_bytes);
+        for(size_t i = 0, n = old_bytes / sizeof(value); i < n;) {
+            value* p = (value*)old_dest + i;
+            if((*p & 0xf) == HEADER_TAG) {
+                auto kind  = header_kind(*p);
+                auto words = object_size(*p) / sizeof(value);
+                if(kind == object_kind::owned_extern) {
+                    throw std::runtime_error("can't copy a runtime that holds C++ values");
+                } else if(kind == object_kind::function) {
+                    auto& fn = *(std::shared_ptr<function>*)((value*)old_space + i + 1);
+                    new(p + 1) std::shared_ptr<function>(copy_template(fn));
+                    function_objects.push_back(p);
+                } else if(!holds_bytes(kind)) {
+                    for(size_t j = 1; j < words; ++j)
+                        p[j] = relocate(p[j]);
+                    if(kind == object_kind::hash_table) {
+                        mark_hash_table_moved(p);
+                        hash_tables.push_back(p);
+                    }
+                }
+                i += words;
+            } else {
+                p[0] = relocate(p[0]);
+                p[1] = relocate(p[1]);
+                i += 2;
+            }
+        }
+        uint8_t* at = code_dest;
+        for(auto& [chunk, used] : chunks) {
+            std::memcpy(at, chunk, used);
+            relocate_cells((value*)at, used / sizeof(value));
+            at += used;
+        }
+    }
+
+    void finish() {
+        while(!unfilled.empty()) {
+            function* fn = unfilled.back();
+            unfilled.pop_back();
+            fn->body = relocate(fn->body);
+            if(fn->compiled == nullptr) continue;
+            fn->compiled = std::make_shared<code>(*fn->compiled);
+            code& c      = *fn->compiled;
+            c.source     = relocate(c.source);
+            for(auto& k : c.consts)
+                k = relocate(k);
+            for(auto& child : c.children)
+                child = copy_template(child);
+            for(auto& obj : c.child_objects)
+                obj = relocate(obj);
+        }
+    }
+};
+}  // namespace
+
+std::unique_ptr<runtime> runtime::clone() {
+    if(!frames.empty() || !scopes.empty() || !compiling.empty())
+        throw std::runtime_error("can't clone a runtime while code is running");
+    // with an empty nursery everything lives in the old space or in the code space already
+    if(heap_next != heap || incremental != nullptr) collect_garbage(nullptr, true);
+    if(!owned_externs.empty())
+        throw std::runtime_error("can't clone a runtime that holds owned externs");
+
+    std::unique_ptr<runtime> rt(new runtime(*this, old_capacity));
+    heap_copy                hc{
+        old_space, (size_t)(old_next - old_space), code_in_use(), rt->old_space, nullptr, base.get()
+    };
+    // the code space is copied into a single chunk of the clone
+    size_t code_bytes = 0;
+    for(auto& [chunk, used] : hc.chunks)
+        code_bytes += used;
+    if(code_bytes > 0) hc.code_dest = rt->code_alloc(code_bytes);
+    hc.copy();
+    rt->old_next = rt->old_space + hc.old_bytes;
+    for(auto* p : hc.function_objects)
+        rt->function_objects.insert((size_t)p);
+    for(auto* slot : code_roots) {
+        value root = hc.relocate(((value)slot << 4) | (value)value_type::cons);
+        rt->code_roots.push_back((value*)(root >> 4));
+    }
+
+    rt->globals = globals;
+    for(auto& g : rt->globals)
+        g = hc.relocate(g);
+    for(auto& [name, fn] : macros)
+        rt->macros.emplace(name, hc.copy_template(fn));
+    for(auto& [body, obj] : function_index)
+        rt->function_index.emplace(hc.relocate(body), hc.relocate(obj));
+    hc.finish();
+    return rt;
+}
+
+runtime_base::~runtime_base() {
+    if(data == nullptr) return;
+#ifdef EMLISP_MMAP_SNAPSHOTS
+    mprotect(data, size, PROT_READ | PROT_WRITE);
+#endif
+    for(auto* p : function_objects)
+        ((std::shared_ptr<function>*)(p + 1))->~shared_ptr();
+#ifdef EMLISP_MMAP_SNAPSHOTS
+    munmap(data, size);
+#else
+    delete[] data;
+#endif
+}
+
+std::shared_ptr<const runtime_base> runtime::make_base() {
+    if(!frames.empty() || !scopes.empty() || !compiling.empty())
+        throw std::runtime_error("can't make a base while code is running");
+    if(base != nullptr) throw std::runtime_error("can't make a base of a runtime built on a base");
+    // compiling a macro later would make the function objects of its code outside the base
+    for(auto& [name, fn] : macros)
+        compiled_body(fn.get());
+    collect_garbage(nullptr, true);
+    if(!owned_externs.empty())
+        throw std::runtime_error("can't make a base that holds owned externs");
+
+    auto   b         = std::make_shared<runtime_base>();
+    size_t old_bytes = old_next - old_space;
+    auto   chunks    = code_in_use();
+    b->size          = old_bytes;
+    for(auto& [chunk, used] : chunks)
+        b->size += used;
+    if(b->size > 0) {
+#ifdef EMLISP_MMAP_SNAPSHOTS
+        void* m =
+            mmap(nullptr, b->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(m == MAP_FAILED) throw std::bad_alloc();
+        b->data = (uint8_t*)m;
+#else
+        b->data = new uint8_t[b->size];
+#endif
+    }
+    heap_copy hc{old_space, old_bytes, std::move(chunks), b->data, b->data + old_bytes, nullptr};
+    hc.copy();
+    b->function_objects = std::move(hc.function_objects);
+    // nothing in a base moves, so its tables never have to be hashed again
+    for(auto* p : hc.hash_tables)
+        freeze_hash_table(p);
+
+    b->symbols       = symbols;
+    b->symbol_hashes = symbol_hashes;
+    b->symbol_table  = symbol_table;
+    b->globals       = globals;
+    for(auto& g : b->globals)
+        g = hc.relocate(g);
+    for(auto& [name, fn] : macros)
+        b->macros.emplace(name, hc.copy_template(fn));
+    hc.finish();
+    for(auto& [orig, fn] : hc.templates) {
+        b->templates.insert(fn.get());
+        if(fn->compiled != nullptr) b->templates.insert(fn->compiled.get());
+    }
+#ifdef EMLISP_MMAP_SNAPSHOTS
+    if(b->data != nullptr) mprotect(b->data, b->size, PROT_READ);
+#endif
+    return b;
+}
+}  // namespace emlisp
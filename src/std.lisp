@@ -16,7 +16,24 @@
           (equal? (cdr a) (cdr b))
           #f)
         #f)
-      (eq? a b)))
+      (if (vector? a)
+        (if (vector? b)
+          (if (eq? (vector-length a) (vector-length b))
+            (%vector-elements-equal? a b 0)
+            #f)
+          #f)
+        (if (vec? a)
+          (vec-equal? a b)
+          (if (str? a)
+            (string=? a b)
+            (eq? a b))))))
+
+(define (%vector-elements-equal? a b i)
+    (if (eq? i (vector-length a))
+      #t
+      (if (equal? (vector-ref a i) (vector-ref b i))
+        (%vector-elements-equal? a b (+ i 1))
+        #f)))
 
 (define (memv el list)
     (if (nil? list)
@@ -79,3 +96,11 @@
   (if (nil? list)
     init
     (proc (car list) (fold proc init (cdr list)))))
+
+(defmacro (future call)
+  `(future-call (quote ,(car call)) ,(car call)
+    ,(fold (lambda (arg rest) (cons 'cons (cons arg (cons rest #n)))) #n (cdr call))))
+
+(defmacro (pmap proc list)
+  (let ([X (unique-symbol x)])
+    `(map touch (map (lambda (,X) (future (,proc ,X))) ,list))))
@@ -0,0 +1,213 @@
+#include "emlisp.h"
+#include <cmath>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace emlisp {
+namespace {
+// A vec is always four floats, so every operation is one SSE instruction on one register. The
+// unused elements are zero, which keeps them out of dot products and lengths, and `make_vec`
+// clears them again after operations such as division that could have filled them.
+#if defined(__SSE2__) || defined(_M_X64)
+using lanes = __m128;
+
+inline lanes load(const float* p) { return _mm_loadu_ps(p); }
+inline void  store(float* p, lanes r) { _mm_storeu_ps(p, r); }
+inline lanes splat(float x) { return _mm_set1_ps(x); }
+inline lanes add(lanes a, lanes b) { return _mm_add_ps(a, b); }
+inline lanes sub(lanes a, lanes b) { return _mm_sub_ps(a, b); }
+inline lanes mul(lanes a, lanes b) { return _mm_mul_ps(a, b); }
+inline lanes div(lanes a, lanes b) { return _mm_div_ps(a, b); }
+
+inline float dot(lanes a, lanes b) {
+    lanes p = _mm_mul_ps(a, b);
+    lanes s = _mm_add_ps(p, _mm_movehl_ps(p, p));
+    s       = _mm_add_ss(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(s);
+}
+
+// a × b = (a * b.yzx - a.yzx * b).yzx, which leaves w as 0 * 0 - 0 * 0
+inline lanes cross(lanes a, lanes b) {
+    lanes a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+    lanes b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    lanes c     = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+    return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+#else
+struct lanes {
+    float x[4];
+};
+
+inline lanes load(const float* p) { return {p[0], p[1], p[2], p[3]}; }
+inline void  store(float* p, lanes r) { std::memcpy(p, r.x, sizeof(r.x)); }
+inline lanes splat(float x) { return {x, x, x, x}; }
+
+#define LANES_OP(NAME, OP)                                                                         \
+    inline lanes NAME(lanes a, lanes b) {                                                          \
+        return {a.x[0] OP b.x[0], a.x[1] OP b.x[1], a.x[2] OP b.x[2], a.x[3] OP b.x[3]};           \
+    }
+LANES_OP(add, +)
+LANES_OP(sub, -)
+LANES_OP(mul, *)
+LANES_OP(div, /)
+#undef LANES_OP
+
+inline float dot(lanes a, lanes b) {
+    return a.x[0] * b.x[0] + a.x[1] * b.x[1] + a.x[2] * b.x[2] + a.x[3] * b.x[3];
+}
+
+inline lanes cross(lanes a, lanes b) {
+    return {a.x[1] * b.x[2] - a.x[2] * b.x[1], a.x[2] * b.x[0] - a.x[0] * b.x[2],
+            a.x[0] * b.x[1] - a.x[1] * b.x[0], 0};
+}
+#endif
+
+value vec_of(runtime* rt, size_t dim, lanes r) {
+    float xs[4];
+    store(xs, r);
+    return rt->make_vec(dim, xs);
+}
+
+float number_of(value v) {
+    if(type_of(v) == value_type::int_t) return (float)to_int(v);
+    if(type_of(v) == value_type::float_t) return to_float(v);
+    throw type_mismatch_error("expected a number for vec math", value_type::float_t, type_of(v));
+}
+
+void check_same_dim(value a, value b) {
+    if(vec_dim(a) != vec_dim(b))
+        throw std::runtime_error("vecs must have the same number of elements");
+}
+
+// the constructor for vecs of `dim` elements, which takes that many numbers
+value vec_from_args(runtime* rt, value args, void* d) {
+    auto   dim = (size_t)d;
+    float  xs[4];
+    size_t n = 0;
+    for(; args != NIL; args = second(args), ++n) {
+        if(n == dim) break;
+        xs[n] = number_of(first(args));
+    }
+    if(n != dim || args != NIL)
+        throw std::runtime_error("vec" + std::to_string(dim) + " takes " + std::to_string(dim)
+                                 + " numbers");
+    return rt->make_vec(dim, xs);
+}
+
+value vec_component(runtime* rt, value args, void* d) {
+    auto i = (size_t)d;
+    if(i >= vec_dim(first(args))) throw std::out_of_range("vec has no such element");
+    return rt->from_float(vec_data(first(args))[i]);
+}
+}  // namespace
+
+value runtime::make_vec(size_t dim, const float* xs) {
+    if(dim < 2 || dim > 4) throw std::runtime_error("vecs have 2, 3 or 4 elements");
+    auto  kind = (object_kind)((size_t)object_kind::vec2 + dim - 2);
+    auto* o    = (value*)alloc(sizeof(value) + 4 * sizeof(float));
+    o[0]       = make_header(kind, 4 * sizeof(float));
+    auto* data = (float*)(o + 1);
+    for(size_t i = 0; i < 4; ++i)
+        data[i] = i < dim ? xs[i] : 0.f;
+    return (((uint64_t)o) << 4) | (uint64_t)value_type::vec;
+}
+
+value runtime::vec_math(char op, value args) {
+    value  v   = first(args);
+    size_t dim = vec_dim(v);
+    lanes  r   = load(vec_data(v));
+    // nothing is allocated until the result, so the arguments can't move
+    for(args = second(args); args != NIL; args = second(args)) {
+        value x = first(args);
+        lanes y;
+        if(type_of(x) == value_type::vec) {
+            check_same_dim(v, x);
+            y = load(vec_data(x));
+        } else {
+            y = splat(number_of(x));
+        }
+        switch(op) {
+            case '+': r = add(r, y); break;
+            case '-': r = sub(r, y); break;
+            case '*': r = mul(r, y); break;
+            case '/': r = div(r, y); break;
+            default: throw std::runtime_error("unknown vec operation");
+        }
+    }
+    return vec_of(this, dim, r);
+}
+
+void runtime::define_vec_functions() {
+    define_fn("vec?", [](runtime* rt, value args, void* d) {
+        return rt->from_bool(type_of(first(args)) == value_type::vec);
+    });
+
+    define_fn("vec2", vec_from_args, (void*)2);
+    define_fn("vec3", vec_from_args, (void*)3);
+    define_fn("vec4", vec_from_args, (void*)4);
+
+    define_fn("vec-dim", [](runtime* rt, value args, void* d) {
+        return rt->from_int(vec_dim(first(args)));
+    });
+
+    define_fn("vec-x", vec_component, (void*)0);
+    define_fn("vec-y", vec_component, (void*)1);
+    define_fn("vec-z", vec_component, (void*)2);
+    define_fn("vec-w", vec_component, (void*)3);
+
+    define_fn("vec-ref", [](runtime* rt, value args, void* d) {
+        return vec_component(rt, args, (void*)(size_t)to_int(first(second(args))));
+    });
+
+    define_fn("vec->list", [](runtime* rt, value args, void* d) {
+        value  v    = first(args);
+        size_t base = rt->stack.size();
+        for(size_t i = 0, n = vec_dim(v); i < n; ++i)
+            rt->stack.push_back(rt->from_float(vec_data(v)[i]));
+        return rt->list_from_stack(base);
+    });
+
+    define_fn("vec-equal?", [](runtime* rt, value args, void* d) {
+        value a = first(args), b = first(second(args));
+        if(type_of(b) != value_type::vec || vec_dim(a) != vec_dim(b)) return FALSE;
+        for(size_t i = 0; i < 4; ++i)
+            if(vec_data(a)[i] != vec_data(b)[i]) return FALSE;
+        return TRUE;
+    });
+
+    define_fn("vec-dot", [](runtime* rt, value args, void* d) {
+        value a = first(args), b = first(second(args));
+        check_same_dim(a, b);
+        return rt->from_float(dot(load(vec_data(a)), load(vec_data(b))));
+    });
+
+    define_fn("vec-cross", [](runtime* rt, value args, void* d) {
+        value a = first(args), b = first(second(args));
+        if(vec_dim(a) != 3 || vec_dim(b) != 3)
+            throw std::runtime_error("the cross product is only defined for vec3s");
+        return vec_of(rt, 3, cross(load(vec_data(a)), load(vec_data(b))));
+    });
+
+    define_fn("vec-length", [](runtime* rt, value args, void* d) {
+        lanes a = load(vec_data(first(args)));
+        return rt->from_float(std::sqrt(dot(a, a)));
+    });
+
+    // like dividing floats, normalizing a zero vec gives NaNs rather than an error
+    define_fn("vec-normalize", [](runtime* rt, value args, void* d) {
+        value v = first(args);
+        lanes a = load(vec_data(v));
+        return vec_of(rt, vec_dim(v), div(a, splat(std::sqrt(dot(a, a)))));
+    });
+
+    // a + (b - a) * t
+    define_fn("vec-lerp", [](runtime* rt, value args, void* d) {
+        value a = first(args), b = first(second(args));
+        check_same_dim(a, b);
+        float t  = number_of(first(second(second(args))));
+        lanes ra = load(vec_data(a));
+        return vec_of(rt, vec_dim(a), add(ra, mul(sub(load(vec_data(b)), ra), splat(t))));
+    });
+}
+}  // namespace emlisp
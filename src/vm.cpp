@@ -0,0 +1,240 @@
+#include "bytecode.h"
+#include "emlisp.h"
+
+namespace emlisp {
+value runtime::bind_env(
+    function* fn, value parent, const value* args, size_t argc, value reuse
+) {
+    value env;
+    if(reuse != NIL && env_slot_count(reuse) >= fn->compiled->frame_size) {
+        env = reuse;
+        for(size_t i = 0; i < env_slot_count(env); ++i) {
+            env_slot(env, i) = NIL;
+            write_barrier(&env_slot(env, i), NIL);
+        }
+        env_parent(env) = parent;
+        write_barrier(&env_parent(env), parent);
+    } else {
+        env = alloc_env(fn->compiled->frame_size, parent);
+    }
+    if(fn->varadic) {
+        // building the list can collect garbage, which moves the environment
+        root_guard g(this, env);
+        value      rest = NIL;
+        for(size_t i = argc; i > 0; --i)
+            rest = cons(args[i - 1], rest);
+        env_slot(env, 0) = rest;
+        write_barrier(&env_slot(env, 0), rest);
+    } else {
+        if(argc < fn->arguments.size()) throw std::runtime_error("argument count mismatch");
+        for(size_t i = 0; i < fn->arguments.size(); ++i) {
+            env_slot(env, i) = args[i];
+            write_barrier(&env_slot(env, i), args[i]);
+        }
+    }
+    return env;
+}
+
+value runtime::execute(code& c, value env, value fn) {
+    // calls between compiled closures push a frame here rather than recursing on the native
+    // stack, so only the frames above `entry` belong to this invocation
+    size_t entry = frames.size();
+    code*  cp    = &c;
+    size_t pc    = 0;
+    size_t base  = stack.size();
+    frames.push_back({cp, 0, base, fn});
+    // the environment lives in the stack so that the collector can find and move it
+    stack.push_back(env);
+    try {
+        // top level code gets its frame here, where the collector can find the code's constants
+        if(env == NIL) stack[base] = env = alloc_env(cp->frame_size, NIL);
+        while(true) {
+            uint32_t instr = cp->instrs[pc++];
+            switch(instr_op(instr)) {
+                case opcode::constant: stack.push_back(cp->consts[instr_operand(instr)]); break;
+
+                case opcode::pop: stack.pop_back(); break;
+
+                case opcode::load_local: {
+                    auto  operand = instr_operand(instr);
+                    value e       = env;
+                    for(auto d = local_depth(operand); d > 0; --d)
+                        e = env_parent(e);
+                    stack.push_back(env_slot(e, local_slot(operand)));
+                } break;
+
+                case opcode::store_local: {
+                    auto  operand = instr_operand(instr);
+                    value e       = env;
+                    for(auto d = local_depth(operand); d > 0; --d)
+                        e = env_parent(e);
+                    // frames that are still young can't be in the code space or a base
+                    auto* frame = (void*)(e >> 4);
+                    if(!in_nursery(frame)) {
+                        if(in_code_space(frame))
+                            throw std::runtime_error("can't change interned code");
+                        if(in_base(frame))
+                            throw std::runtime_error("can't change the values of a base");
+                    }
+                    value& slot = env_slot(e, local_slot(operand));
+                    slot        = stack.back();
+                    write_barrier(&slot, slot);
+                    stack.pop_back();
+                } break;
+
+                case opcode::load_global: {
+                    auto ix = instr_operand(instr);
+                    if(ix >= globals.size() || globals[ix] == UNBOUND)
+                        throw std::runtime_error("unknown name " + symbol_name(ix));
+                    stack.push_back(globals[ix]);
+                } break;
+
+                case opcode::store_global:
+                    set_global(((value)instr_operand(instr) << 4) | (value)value_type::sym,
+                               stack.back());
+                    stack.pop_back();
+                    break;
+
+                case opcode::closure: {
+                    value closure = cons(cp->child_objects[instr_operand(instr)], env);
+                    closure -= 1;  // cons -> closure
+                    stack.push_back(closure);
+                    // anything that allocates can collect garbage and move our environment
+                    env = stack[base];
+                } break;
+
+                case opcode::jump: pc = instr_operand(instr); break;
+
+                case opcode::jump_if_false: {
+                    value cond = stack.back();
+                    stack.pop_back();
+                    if(cond == FALSE) pc = instr_operand(instr);
+                } break;
+
+                case opcode::call: {
+                    size_t fi = stack.size() - instr_operand(instr) - 1;
+                    value  f  = stack[fi];
+                    if(type_of(f) == value_type::closure && is_compiled_closure(f)) {
+                        if(frames.size() >= max_call_depth)
+                            throw std::runtime_error("maximum call depth exceeded");
+                        function* fn     = closure_function(f);
+                        value     parent = *((value*)(f >> 4) + 1);
+                        env = bind_env(fn, parent, stack.data() + fi + 1, stack.size() - fi - 1);
+                        // the callee's frame replaces the function and its arguments, and holds on
+                        // to the function object so that its code outlives the closure
+                        value fo         = *(value*)(stack[fi] >> 4);
+                        frames.back().pc = pc;
+                        stack.resize(fi);
+                        stack.push_back(env);
+                        cp   = fn->compiled.get();
+                        pc   = 0;
+                        base = fi;
+                        frames.push_back({cp, 0, base, fo});
+                        break;
+                    }
+                    value args = NIL;
+                    for(size_t i = stack.size(); i > fi + 1; --i)
+                        args = cons(stack[i - 1], args);
+                    value result = apply(stack[fi], args);
+                    stack.resize(fi);
+                    stack.push_back(result);
+                    env = stack[base];
+                } break;
+
+                case opcode::tail_call: {
+                    size_t fi = stack.size() - instr_operand(instr) - 1;
+                    value  f  = stack[fi];
+                    if(type_of(f) == value_type::closure && is_compiled_closure(f)) {
+                        function* fn = closure_function(f);
+                        // code that makes no closures can't have let its frame escape, so the
+                        // callee can take the frame over
+                        env = bind_env(
+                            fn,
+                            *((value*)(f >> 4) + 1),
+                            stack.data() + fi + 1,
+                            stack.size() - fi - 1,
+                            cp->children.empty() ? env : NIL
+                        );
+                        frames.back().fn = *(value*)(stack[fi] >> 4);
+                        stack.resize(base);
+                        stack.push_back(env);
+                        cp              = fn->compiled.get();
+                        pc              = 0;
+                        frames.back().c = cp;
+                        break;
+                    }
+                    value args = NIL;
+                    for(size_t i = stack.size(); i > fi + 1; --i)
+                        args = cons(stack[i - 1], args);
+                    value result = apply(stack[fi], args);
+                    stack.resize(fi);
+                    stack.push_back(result);
+                    // finish like a return of the result
+                    [[fallthrough]];
+                }
+
+                case opcode::ret: {
+                    value result = stack.back();
+                    stack.resize(base);
+                    frames.pop_back();
+                    if(frames.size() == entry) return result;
+                    stack.push_back(result);
+                    cp   = frames.back().c;
+                    pc   = frames.back().pc;
+                    base = frames.back().base;
+                    env  = stack[base];
+                } break;
+
+                case opcode::unique_sym:
+                    stack.push_back(unique_symbol(cp->consts[instr_operand(instr)]));
+                    break;
+
+                case opcode::cons: {
+                    value b = stack.back();
+                    stack.pop_back();
+                    value c      = cons(stack.back(), b);
+                    stack.back() = c;
+                    env          = stack[base];
+                } break;
+
+                case opcode::append: {
+                    value tail = stack.back();
+                    stack.pop_back();
+                    value list = stack.back();
+                    if(list == NIL) {
+                        stack.back() = tail;
+                        break;
+                    }
+                    check_type(
+                        list, value_type::cons, "unquote-splicing expression must yield a list"
+                    );
+                    value      head = NIL, end = NIL;
+                    root_guard g(this, tail, list, head, end);
+                    head = cons(first(list), NIL);
+                    end  = head;
+                    for(list = second(list); list != NIL; list = second(list)) {
+                        value c = cons(first(list), NIL);
+                        set_second(end, c);
+                        end = c;
+                    }
+                    set_second(end, tail);
+                    stack.back() = head;
+                    env          = stack[base];
+                } break;
+            }
+        }
+    } catch(const type_mismatch_error& e) {
+        // report every function that was running, innermost first
+        type_mismatch_error err = e;
+        for(size_t i = frames.size(); i > entry; --i)
+            err = type_mismatch_error(err, this, frames[i - 1].c->source);
+        stack.resize(frames[entry].base);
+        frames.resize(entry);
+        throw err;
+    } catch(...) {
+        stack.resize(frames[entry].base);
+        frames.resize(entry);
+        throw;
+    }
+}
+}  // namespace emlisp
@@ -0,0 +1,87 @@
+#include <emlisp.h>
+#include <cmath>
+#include <iostream>
+using namespace emlisp;
+
+// the kernels work on whole registers and then on what is left, so every length up to a few
+// registers is checked against the same arithmetic done one element at a time
+template<typename T>
+void check(runtime& rt, object_kind kind) {
+    auto call = [&](const char* fn, value a, value b) {
+        return rt.apply(rt.global(fn), rt.cons(a, rt.cons(b)));
+    };
+    for(size_t n = 0; n < 40; ++n) {
+        auto a   = rt.handle_for(rt.make_array(kind, n));
+        auto b   = rt.handle_for(rt.make_array(kind, n));
+        T    sum = 0, dot = 0, lo = 0, hi = 0;
+        for(size_t i = 0; i < n; ++i) {
+            // small whole numbers, so that adding them in any order gives the same result
+            T x = (T)((int64_t)(i * 7 % 11) - 5), y = (T)((int64_t)(i * 5 % 13) + 1);
+            array_data<T>(*a)[i] = x;
+            array_data<T>(*b)[i] = y;
+            sum += x;
+            dot += x * y;
+            lo = i == 0 || x < lo ? x : lo;
+            hi = i == 0 || x > hi ? x : hi;
+        }
+        auto added   = rt.handle_for(call("array+", *a, *b));
+        auto scaled  = rt.handle_for(call("array*", *a, rt.from_int(3)));
+        auto divided = rt.handle_for(call("array/", *a, *b));
+        for(size_t i = 0; i < n; ++i) {
+            T x = array_data<T>(*a)[i], y = array_data<T>(*b)[i];
+            assert(array_data<T>(*added)[i] == x + y);
+            assert(array_data<T>(*scaled)[i] == x * 3);
+            assert(array_data<T>(*divided)[i] == x / y);
+        }
+        assert(array_length(*added) == n);
+        value s = rt.apply(rt.global("array-sum"), rt.cons(*a));
+        value d = call("array-dot", *a, *b);
+        if constexpr(std::is_integral_v<T>) {
+            assert(to_int(s) == sum && to_int(d) == dot);
+        } else {
+            assert(to_float(s) == (float)sum && to_float(d) == (float)dot);
+        }
+        if(n > 0) {
+            value l = rt.apply(rt.global("array-min"), rt.cons(*a));
+            value h = rt.apply(rt.global("array-max"), rt.cons(*a));
+            if constexpr(std::is_integral_v<T>)
+                assert(to_int(l) == lo && to_int(h) == hi);
+            else
+                assert(to_float(l) == (float)lo && to_float(h) == (float)hi);
+        }
+        // a NaN anywhere, in a register or in the elements left over, is the smallest and largest
+        if constexpr(!std::is_integral_v<T>)
+            for(size_t j = 0; j < n; ++j) {
+                T x                  = array_data<T>(*a)[j];
+                array_data<T>(*a)[j] = NAN;
+                assert(std::isnan(to_float(rt.apply(rt.global("array-min"), rt.cons(*a)))));
+                assert(std::isnan(to_float(rt.apply(rt.global("array-max"), rt.cons(*a)))));
+                array_data<T>(*a)[j] = x;
+            }
+    }
+}
+
+int main() {
+    runtime rt{64 * 1024, false};
+    check<float>(rt, object_kind::f32_array);
+    check<double>(rt, object_kind::f64_array);
+    check<int64_t>(rt, object_kind::i64_array);
+
+    // arrays hold bytes, which collections copy without looking inside
+    auto arr = rt.handle_for(rt.read("#f64(1.5 2.5 3.5)"));
+    rt.collect_garbage();
+    rt.collect_garbage(nullptr, true);
+    assert(array_data<double>(*arr)[2] == 3.5 && array_length(*arr) == 3);
+
+    // mismatched arrays, bad indices and integer division by zero are errors
+    for(const char* bad :
+        {"(array+ #v(1 2) #v(1))", "(array+ #v(1) #i64(1))", "(array-ref #v(1) 1)",
+         "(array/ #i64(1 2) 0)", "(array-min #v())", "(make-array 'u8 3)"}) {
+        bool threw = false;
+        try {
+            rt.eval(rt.read(bad));
+        } catch(const std::exception&) { threw = true; }
+        assert(threw);
+    }
+    return 0;
+}
@@ -60,6 +60,18 @@ EL_OBJ struct counter {
     }
 };
 
+EL_VEC struct float3 {
+    float x, y, z;
+};
+
+EL_OBJ struct transform {
+    EL_PROP(rw) float3 position;
+
+    EL_M float3 moved(const float3& by) {
+        return {position.x + by.x, position.y + by.y, position.z + by.z};
+    }
+};
+
 EL_OBJ struct test_fn {
     test_fn() = default;
 
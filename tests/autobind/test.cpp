@@ -56,6 +56,16 @@ int main(int argc, char* argv[]) {
         {rt.eval(rt.read("(test-fn/times (test-fn 3) 10 (lambda (i) (counter/increment c i)))"));
             assert(c.value == 45);}
 
+        std::cout << "test vecs\n";
+        {
+            transform t{{1, 2, 3}};
+            rt.define_global("t", rt.make_extern_reference(&t));
+            value x = rt.eval(rt.read("(transform/moved t (vec3 0.5 0 -3))"));
+            assert(vec_dim(x) == 3 && vec_data(x)[0] == 1.5f && vec_data(x)[2] == 0.f);
+            rt.eval(rt.read("(transform/position t (+ (transform/position t) #vec3(1 1 1)))"));
+            assert(t.position.x == 2 && t.position.y == 3 && t.position.z == 4);
+        }
+
         std::cout << "test constructors\n";
         {
             value x = rt.eval(rt.read("(let ([nc (counter 2)]) (counter/increment nc 3))"));
@@ -0,0 +1,51 @@
+#include <emlisp.h>
+#include <iostream>
+#include <string>
+using namespace emlisp;
+
+int main() {
+    for(auto mode : {eval_mode::tree_walk, eval_mode::bytecode}) {
+        // far more is allocated than fits in the nursery, so collections happen mid-evaluation
+        runtime rt{16 * 1024, true, mode};
+        rt.eval_file(
+            "(define (iota n acc) (if (eq? n 0) acc (iota (- n 1) (cons n acc))))"
+            "(define (sum xs acc) (if (nil? xs) acc (sum (cdr xs) (+ acc (car xs)))))"
+            "(define (square x) (* x x))"
+        );
+        value n = rt.eval(rt.read("(sum (map square (iota 500 #n)) 0)"));
+        assert(to_int(n) == 41791750);
+
+        // strings larger than the nursery grow it
+        std::string big(64 * 1024, 'x');
+        value       s = rt.from_str(big);
+        assert(rt.to_str(s) == big);
+
+        // values in C++ variables are kept up to date by a root guard
+        value list = rt.read("(1 2 3)");
+        {
+            root_guard g(&rt, list);
+            rt.eval(rt.read("(iota 5000 #n)"));
+            assert(to_int(first(second(list))) == 2);
+        }
+        std::cout << "0\n";
+    }
+
+    // the heap stops growing at the limit of the policy
+    runtime     rt{16 * 1024, true};
+    heap_policy p;
+    p.max_heap_size = 512 * 1024;
+    rt.set_heap_policy(p);
+    bool threw = false;
+    try {
+        rt.eval_file(
+            "(define (iota n acc) (if (eq? n 0) acc (iota (- n 1) (cons n acc))))"
+            "(iota 100000 #n)"
+        );
+    } catch(std::runtime_error& e) {
+        threw = std::string(e.what()) == "out of memory";
+    }
+    assert(threw);
+    std::cout << "1\n";
+
+    return 0;
+}
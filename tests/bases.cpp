@@ -0,0 +1,90 @@
+#include <emlisp.h>
+#include <iostream>
+using namespace emlisp;
+
+int main() {
+    int  scale  = 3;
+    auto scaled = [](runtime* rt, value args, void* d) {
+        return rt->from_int(to_int(first(args)) * *(int*)d);
+    };
+
+    for(auto mode : {eval_mode::tree_walk, eval_mode::bytecode}) {
+        std::shared_ptr<const runtime_base> base;
+        {
+            runtime rt{64 * 1024, true, mode};
+            rt.define_fn("scaled", scaled, &scale);
+            rt.eval_file("(define (make-counter) (let ([n 0]) (lambda () (begin (set! n (+ n 1)) n))))"
+                         "(define (adder n) (lambda (x) (+ x n)))"
+                         "(define add2 (adder 2))"
+                         "(define base-counter (make-counter))"
+                         "(define names '(\"ada\" \"grace\" \"barbara\"))"
+                         "(define (total l) (if (nil? l) 0 (+ (string-length (car l)) (total (cdr l)))))"
+                         "(defmacro (twice x) `(begin ,x ,x))"
+                         "(define apply-scaled (lambda (x) (scaled x)))");
+            base = rt.make_base();
+            // the runtime the base was made from carries on
+            rt.eval_file("(define names '())");
+            assert(to_int(rt.eval(rt.read("(total names)"))) == 0);
+        }
+
+        runtime a{base, 16 * 1024, mode};
+        runtime b{base, 16 * 1024, mode};
+        // the symbols made after the base get the same indices in both, and mean different things
+        a.eval_file("(define only-a 1)");
+        b.eval_file("(define only-b (make-counter))");
+        assert(a.symbol("only-a") == b.symbol("only-b"));
+        assert(a.symbol_str(a.symbol("only-a")) == "only-a");
+        assert(b.symbol_str(b.symbol("only-b")) == "only-b");
+        assert(a.symbol("names") == b.symbol("names"));
+
+        // the values of the base work in either, including macros, builtins and the std lib
+        assert(to_int(a.eval(a.read("(total names)"))) == 15);
+        assert(to_int(a.eval(a.read("(add2 5)"))) == 7);
+        assert(to_int(a.eval(a.read("(apply-scaled 2)"))) == 6);
+        b.eval_file("(twice (only-b))");
+        assert(to_int(b.eval(b.read("(only-b)"))) == 3);
+        assert(b.eval(b.read("(cadr (map (adder 1) '(1 2 3)))")) == b.from_int(3));
+
+        // globals are private, redefining one leaves the base and other runtimes alone
+        a.eval_file("(define names '(\"x\"))");
+        assert(to_int(a.eval(a.read("(total names)"))) == 1);
+        assert(to_int(b.eval(b.read("(total names)"))) == 15);
+
+        // and the values of the base can't be changed
+        bool threw = false;
+        try {
+            b.set_first(b.eval(b.read("names")), NIL);
+        } catch(const std::runtime_error&) { threw = true; }
+        assert(threw);
+        // including the variables captured by its closures
+        threw = false;
+        try {
+            b.eval(b.read("(base-counter)"));
+        } catch(const std::runtime_error&) { threw = true; }
+        assert(threw);
+
+        // collections don't copy the base, only what the runtime made itself
+        heap_info info;
+        b.eval_file("(define more (map (adder 1) '(1 2 3)))");
+        b.collect_garbage(&info, true);
+        while(!b.collect_garbage_step(64)) {}
+        b.collect_garbage();
+        assert(info.old_size < base->size);
+        assert(to_int(b.eval(b.read("(only-b)"))) == 4);
+        assert(to_int(b.eval(b.read("(cadr more)"))) == 3);
+        assert(to_int(b.eval(b.read("(total names)"))) == 15);
+
+        // clones share the base too
+        auto c = b.clone();
+        assert(to_int(c->eval(c->read("(only-b)"))) == 5);
+        assert(to_int(c->eval(c->read("(add2 (car more))"))) == 4);
+
+        // a base can't be made from a runtime built on one
+        threw = false;
+        try {
+            a.make_base();
+        } catch(const std::runtime_error&) { threw = true; }
+        assert(threw);
+    }
+    return 0;
+}
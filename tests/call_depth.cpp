@@ -0,0 +1,42 @@
+#include <emlisp.h>
+#include <iostream>
+#include <string>
+using namespace emlisp;
+
+int main() {
+    runtime rt{64 * 1024 * 1024, true, eval_mode::bytecode};
+
+    rt.define_fn("collect!", [](runtime* rt, value args, void* cx) {
+        rt->collect_garbage();
+        return NIL;
+    }, nullptr);
+
+    rt.eval_file(
+        "(define (iota n) (if (eq? n 0) #n (cons n (iota (- n 1)))))"
+        "(define (deep n) (if (eq? n 0) (begin (collect!) 0) (+ 1 (deep (- n 1)))))"
+    );
+
+    // much deeper than the native stack would allow if calls recursed in C++
+    value n = rt.eval(rt.read("(length (iota 200000))"));
+    assert(to_int(n) == 200000);
+
+    // frames and the values they hold survive a collection in the middle of the recursion
+    n = rt.eval(rt.read("(deep 10000)"));
+    assert(to_int(n) == 10000);
+
+    std::cout << "0\n";
+    rt.set_max_call_depth(1000);
+    bool threw = false;
+    try {
+        rt.eval(rt.read("(deep 5000)"));
+    } catch(const std::runtime_error& e) {
+        threw = std::string(e.what()) == "maximum call depth exceeded";
+    }
+    assert(threw);
+
+    // the runtime is still usable after the error unwinds the stack
+    n = rt.eval(rt.read("(length '(1 2 3))"));
+    assert(to_int(n) == 3);
+
+    return 0;
+}
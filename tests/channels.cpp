@@ -0,0 +1,116 @@
+#include <emlisp_pool.h>
+#include <iostream>
+using namespace emlisp;
+
+int main() {
+    runtime from{16 * 1024}, to{16 * 1024};
+
+    // packed values keep shared structure and cycles, and can be unpacked into any runtime
+    value      shared = from.read("(\"text\" sym 1 2.5 #t)");
+    value      v      = from.read("(a b c)");
+    root_guard g(&from, shared, v);
+    value      unique = from.eval(from.read("(unique-symbol u)"));
+    from.set_first(v, shared);
+    from.set_first(second(v), shared);
+    from.set_first(second(second(v)), unique);
+    from.set_second(second(second(v)), v);
+    auto  words = from.pack(v);
+    value u     = to.unpack(words.data(), words.size());
+    assert(first(u) == first(second(u)));
+    assert(second(second(second(u))) == u);
+    assert(to.to_str(first(first(u))) == "text");
+    assert(nth(first(u), 1) == to.symbol("sym"));
+    assert(to_int(nth(first(u), 2)) == 1 && to_float(nth(first(u), 3)) == 2.5f);
+    unique = first(second(second(u)));
+    assert(to.symbol_str(unique) == "u" && unique != to.symbol("u"));
+    // the value stays intact across collections in the runtime that took it
+    root_guard h(&to, u);
+    to.collect_garbage();
+    assert(to.to_str(first(first(u))) == "text");
+    assert(second(second(second(u))) == u);
+    // and the original is untouched by packing it
+    assert(from.to_str(first(first(v))) == "text" && second(second(second(v))) == v);
+
+    // vectors are laid out like strings, with their elements fixed up when unpacked
+    value vec = from.read("#(a \"b\" (c) #(1))");
+    words     = from.pack(vec);
+    vec       = to.unpack(words.data(), words.size());
+    assert(nth(vector_ref(vec, 2), 0) == to.symbol("c") && to.to_str(vector_ref(vec, 1)) == "b");
+    assert(to_int(vector_ref(vector_ref(vec, 3), 0)) == 1 && vector_ref(vec, 0) == to.symbol("a"));
+    words = from.pack(from.read("#(#vec3(1 2 3))"));
+    vec   = to.unpack(words.data(), words.size());
+    assert(vec_dim(vector_ref(vec, 0)) == 3 && vec_data(vector_ref(vec, 0))[2] == 3.f);
+
+    bool threw = false;
+    try {
+        from.pack(from.eval(from.read("(lambda (x) x)")));
+    } catch(const std::runtime_error&) { threw = true; }
+    assert(threw);
+
+    // channels are bounded and keep their values in order
+    channel c{3};
+    assert(c.capacity() == 4);
+    for(int i = 0; i < 4; ++i) {
+        auto p = packed_value::pack(from, from.from_int(i));
+        assert(c.try_send(p));
+    }
+    auto full = packed_value::pack(from, NIL);
+    assert(!c.try_send(full) && !full.words.empty());
+    packed_value out;
+    for(int i = 0; i < 4; ++i) {
+        assert(c.try_receive(out));
+        assert(to_int(out.unpack(to)) == i);
+    }
+    assert(!c.try_receive(out));
+
+    // many threads can send and receive through the same channel at once
+    {
+        channel                  m{16};
+        std::atomic<int64_t>     sum{0};
+        std::vector<std::thread> threads;
+        for(int t = 0; t < 4; ++t)
+            threads.emplace_back([&] {
+                runtime rt{16 * 1024};
+                for(int i = 0; i < 2000; ++i)
+                    m.send(packed_value::pack(rt, rt.from_int(i)));
+            });
+        for(int t = 0; t < 2; ++t)
+            threads.emplace_back([&] {
+                runtime rt{16 * 1024};
+                for(int i = 0; i < 4000; ++i)
+                    sum += to_int(m.receive().unpack(rt));
+            });
+        for(auto& t : threads)
+            t.join();
+        assert(sum == 4 * (1999 * 2000 / 2));
+    }
+
+    // a pipeline of runtimes on the workers of a pool, joined by channels the base refers to
+    for(auto mode : {eval_mode::tree_walk, eval_mode::bytecode}) {
+        channel in{8}, mid{8}, out{8};
+        runtime host{64 * 1024, true, mode};
+        channel::define_functions(host);
+        host.define_global("in", host.make_extern_reference(&in));
+        host.define_global("mid", host.make_extern_reference(&mid));
+        host.define_global("out", host.make_extern_reference(&out));
+        host.eval_file("(define (stage from to f)"
+                       "  (let ([x (receive from)])"
+                       "    (if (eq? x 'done) (send to x) (begin (send to (f x)) (stage from to f)))))"
+                       "(define (double x) (cons (* 2 (car x)) x))"
+                       "(define (label x) (cons \"seen\" x))");
+        runtime_pool pool{host.make_base(), 2, 64 * 1024, mode};
+        pool.run([](runtime& rt) { rt.eval(rt.read("(stage in mid double)")); });
+        pool.run([](runtime& rt) { rt.eval(rt.read("(stage mid out label)")); });
+        for(int i = 0; i < 100; ++i) {
+            in.send(packed_value::pack(host, host.cons(host.from_int(i))));
+            value r = out.receive().unpack(host);
+            assert(host.to_str(first(r)) == "seen");
+            assert(to_int(first(second(r))) == 2 * i && to_int(first(second(second(r)))) == i);
+        }
+        in.send(packed_value::pack(host, host.symbol("done")));
+        assert(out.receive().unpack(host) == host.symbol("done"));
+    }
+
+    std::cout << "channels ok\n";
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include <emlisp.h>
+#include <iostream>
+using namespace emlisp;
+
+struct thing {
+    int x;
+};
+
+int main() {
+    int  scale  = 3;
+    auto scaled = [](runtime* rt, value args, void* d) {
+        return rt->from_int(to_int(first(args)) * *(int*)d);
+    };
+
+    for(auto mode : {eval_mode::tree_walk, eval_mode::bytecode}) {
+        auto base = std::make_unique<runtime>(64 * 1024, true, mode);
+        base->define_fn("scaled", scaled, &scale);
+        base->eval_file("(define (make-counter) (let ([n 0]) (lambda () (begin (set! n (+ n 1)) n))))"
+                        "(define counter (make-counter))"
+                        "(counter)"
+                        "(define names '(\"ada\" \"grace\" \"barbara\"))"
+                        "(define (total l) (if (nil? l) 0 (+ (string-length (car l)) (total (cdr l)))))"
+                        "(defmacro (twice x) `(begin ,x ,x))"
+                        "(define apply-scaled (lambda (x) (scaled x)))");
+
+        // each clone starts from the state of the runtime it was cloned from, and changes to one
+        // aren't seen by the other
+        auto a = base->clone();
+        auto b = base->clone();
+        assert(to_int(a->eval(a->read("(counter)"))) == 2);
+        assert(to_int(a->eval(a->read("(counter)"))) == 3);
+        assert(to_int(b->eval(b->read("(counter)"))) == 2);
+        a->eval_file("(define names '(\"x\"))");
+        assert(to_int(a->eval(a->read("(total names)"))) == 1);
+        assert(to_int(b->eval(b->read("(total names)"))) == 15);
+        assert(to_int(base->eval(base->read("(counter)"))) == 2);
+        assert(to_int(base->eval(base->read("(total names)"))) == 15);
+
+        // macros, builtins and the std lib come along
+        b->eval_file("(define c2 (make-counter)) (twice (c2))");
+        assert(to_int(b->eval(b->read("(c2)"))) == 3);
+        assert(to_int(b->eval(b->read("(apply-scaled 2)"))) == 6);
+        assert(to_int(b->eval(b->read("(length (map cadr (quote ((a 1) (b 2) (c 3)))))"))) == 3);
+
+        // a clone outlives the runtime it was cloned from, and can be cloned in turn
+        base.reset();
+        auto c = b->clone();
+        b.reset();
+        c->collect_garbage(nullptr, true);
+        while(!c->collect_garbage_step(64)) {}
+        c->collect_garbage();
+        assert(to_int(c->eval(c->read("(counter)"))) == 3);
+        assert(to_int(c->eval(c->read("(c2)"))) == 4);
+        assert(to_int(c->eval(c->read("(total names)"))) == 15);
+
+        // C++ values can't be cloned
+        c->define_global("held", c->make_owned_extern<thing>(thing{1}));
+        bool threw = false;
+        try {
+            c->clone();
+        } catch(const std::runtime_error&) { threw = true; }
+        assert(threw);
+    }
+
+    // a runtime that is only cloned from is copied without collecting it each time
+    runtime base{64 * 1024};
+    auto    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < 1000; ++i) {
+        auto rt = base.clone();
+        assert(to_int(rt->eval(rt->read("(+ 1 2)"))) == 3);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "1000 clones took "
+              << std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() << "us\n";
+    return 0;
+}
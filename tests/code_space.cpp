@@ -0,0 +1,56 @@
+#include <emlisp.h>
+#include <iostream>
+using namespace emlisp;
+
+int main() {
+    for(auto mode : {eval_mode::tree_walk, eval_mode::bytecode}) {
+        runtime   rt{64 * 1024, false, mode};
+        heap_info info;
+        rt.eval_file("(define (fib n) (if (eq? n 0) 0 (if (eq? n 1) 1 (+ (fib (- n 1)) (fib (- n 2))))))"
+                     "(define greeting \"hello\")"
+                     "(define numbers '(1 2 3 4 5 6 7 8))"
+                     "(define table #(1 (2 3) \"four\"))"
+                     "(defmacro (make-const) (cons 'quote (cons (lambda () 42) '())))"
+                     "(define (const) ((make-const)))");
+
+        // the program is in the code space, so collections don't copy it
+        rt.collect_garbage(&info, true);
+        assert(info.code_size > 0);
+        size_t old_size = info.old_size;
+        rt.eval_file("(define (fact n) (if (eq? n 0) 1 (* n (fact (- n 1)))))"
+                     "(define (sum l) (if (eq? l '()) 0 (+ (car l) (sum (cdr l)))))");
+        rt.collect_garbage(&info, true);
+        assert(info.old_size - old_size < info.code_size);
+
+        // function bodies and quoted literals keep their addresses
+        value fib_body = closure_function(rt.eval(rt.read("fib")))->body;
+        value numbers  = rt.eval(rt.read("numbers"));
+        for(int i = 0; i < 3; ++i) {
+            rt.collect_garbage(&info, true);
+            rt.collect_garbage(&info);
+        }
+        assert(closure_function(rt.eval(rt.read("fib")))->body == fib_body);
+        assert(rt.eval(rt.read("numbers")) == numbers);
+        assert(to_int(rt.eval(rt.read("(fib 15)"))) == 610);
+        assert(to_int(rt.eval(rt.read("(sum numbers)"))) == 36);
+        assert(rt.to_str(rt.eval(rt.read("greeting"))) == "hello");
+        assert(rt.to_str(rt.eval(rt.read("(vector-ref table 2)"))) == "four");
+
+        // a closure that a macro put into the code stays alive in the heap
+        while(!rt.collect_garbage_step(64)) {}
+        assert(to_int(rt.eval(rt.read("(const)"))) == 42);
+
+        // interned code can't be changed
+        bool threw = false;
+        try {
+            rt.set_first(numbers, NIL);
+        } catch(const std::runtime_error&) { threw = true; }
+        assert(threw);
+        threw = false;
+        try {
+            rt.eval(rt.read("(vector-set! table 0 2)"));
+        } catch(const std::runtime_error&) { threw = true; }
+        assert(threw);
+    }
+    return 0;
+}
@@ -0,0 +1,47 @@
+; packed arrays of f32, f64 or i64 are written as literals, which evaluate to themselves
+(set! a #v(1 2 3 4.5))
+(assert! (array? a))
+(assert! (eq? (array? #(1 2)) #f))
+(assert! (eq? (array-length a) 4))
+(assert! (eq? (array-ref a 0) 1.0))
+(assert! (eq? (array-ref a 3) 4.5))
+(assert! (eq? (array-ref #i64(5 -6) 1) -6))
+(assert! (eq? (array-ref #f64(0.25) 0) 0.25))
+
+; or made with make-array and list->array, storing converts numbers to the element type
+(set! m (make-array 'i64 10 7))
+(assert! (eq? (array-length m) 10))
+(assert! (eq? (array-ref m 9) 7))
+(array-set! m 2 3.75)
+(assert! (eq? (array-ref m 2) 3))
+(assert! (eq? (array-ref (make-array 'f32 3) 2) 0.0))
+(set! l (list->array 'f64 '(1 2 3)))
+(assert! (eq? (array-ref l 2) 3.0))
+(set! back (array->list #i64(4 5 6)))
+(assert! (eq? (car (cdr (cdr back))) 6))
+
+; arithmetic on whole arrays, with another array or a number
+(set! x (list->array 'f32 '(1 2 3 4 5 6 7 8 9 10 11)))
+(set! y (make-array 'f32 11 2))
+(assert! (eq? (array-ref (array+ x y) 10) 13.0))
+(assert! (eq? (array-ref (array- x 1) 0) 0.0))
+(assert! (eq? (array-ref (array* x y) 8) 18.0))
+(assert! (eq? (array-ref (array/ x 2) 4) 2.5))
+(assert! (eq? (array-ref (array+ #i64(1 2 3) #i64(10 20 30)) 2) 33))
+(assert! (eq? (array-ref (array/ #i64(7 9) 2) 1) 4))
+
+; reductions
+(assert! (eq? (array-sum x) 66.0))
+(assert! (eq? (array-sum #i64(1 2 3 4 5)) 15))
+(assert! (eq? (array-sum #v()) 0.0))
+(assert! (eq? (array-dot x y) 132.0))
+(assert! (eq? (array-dot #f64(1 2 3) #f64(4 5 6)) 32.0))
+(assert! (eq? (array-min #v(3 -1 4 1 5 9 2 6 5 3)) -1.0))
+(assert! (eq? (array-max #v(3 -1 4 1 5 9 2 6 5 3)) 9.0))
+(assert! (eq? (array-max #i64(-5 -2 -9)) -2))
+
+; and a function applied to each element
+(assert! (eq? (array-ref (array-map (lambda (e) (* e e)) #i64(1 2 3)) 2) 9))
+; which allocates, so collections can run while the result is being filled
+(set! big (array-map (lambda (e) (begin (cons e (cons e e)) (+ e 1))) (make-array 'i64 300 1)))
+(assert! (eq? (array-sum big) 600))
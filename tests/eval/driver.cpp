@@ -20,7 +20,16 @@ std::string get_file_contents(const char* filename) {
 int main(int argc, char* argv[]) {
     auto source = get_file_contents(argv[1]);
 
-    emlisp::runtime rt(1024*1024, argc > 2 && strcmp(argv[2], "--include-stdlib") == 0);
+    bool include_stdlib = false;
+    auto mode = emlisp::eval_mode::tree_walk;
+    size_t heap_size = 1024*1024;
+    for(int i = 2; i < argc; ++i) {
+        if(strcmp(argv[i], "--include-stdlib") == 0) include_stdlib = true;
+        else if(strcmp(argv[i], "--bytecode") == 0) mode = emlisp::eval_mode::bytecode;
+        else if(strcmp(argv[i], "--heap-size") == 0 && i + 1 < argc) heap_size = atoll(argv[++i]);
+    }
+
+    emlisp::runtime rt(heap_size, include_stdlib, mode);
 
     rt.define_fn("assert!", [](emlisp::runtime* rt, emlisp::value args, void* d) {
         if (emlisp::first(args) != emlisp::TRUE) {
@@ -56,7 +65,7 @@ int main(int argc, char* argv[]) {
         return emlisp::NIL;
 	}, nullptr);
 
-    auto src_vals = rt.handle_for(rt.expand(rt.read_all(source)));
+    auto src_vals = rt.handle_for(rt.intern_code(rt.expand(rt.read_all(source))));
 
     auto cur = src_vals;
     while(*cur != emlisp::NIL) {
@@ -66,8 +75,7 @@ int main(int argc, char* argv[]) {
             rt.eval(emlisp::first(*cur));
             emlisp::heap_info ifo;
             rt.collect_garbage(&ifo);
-			std::cout << "old heap had " << ifo.old_size << " bytes, new heap has " << ifo.new_size << " bytes\n"
-				<< "collected " << (ifo.old_size - ifo.new_size) << " bytes\n";
+			std::cout << "nursery has " << ifo.new_size << " bytes, old space has " << ifo.old_size << " bytes\n";
 			rt.write(std::cout, *src_vals);
 			std::cout << "\n---\n";
 			cur = rt.handle_for(emlisp::second(*cur));
@@ -0,0 +1,41 @@
+(define (equal? a b)
+    (if (cons? a)
+      (if (cons? b)
+        (if (equal? (car a) (car b))
+          (equal? (cdr a) (cdr b))
+          #f)
+        #f)
+      (eq? a b)))
+
+; let forms
+(assert-eq! (let ([a 1] [b 2]) (+ a b)) 3 "let")
+(assert-eq! (let* ([a 1] [b (+ a 1)]) (+ a b)) 3 "let*")
+(assert-eq! (let ([a 1]) (let ([a 2] [b a]) b)) 1 "let binds in parallel")
+(assert-eq! (letrec ([a 5]) a) 5 "letrec")
+
+; begin
+(assert-eq! (begin) #n "empty begin")
+(assert-eq! (begin 1 2 3) 3 "begin yields last value")
+
+; if
+(assert-eq! (if #f 1 2) 2 "if false branch")
+(assert-eq! (if 0 1 2) 1 "only #f is false")
+
+; quasiquote
+(set! x 2)
+(set! xs '(3 4))
+(assert! (equal? `(1 ,x) '(1 2)) "unquote")
+(assert! (equal? `(1 ,@xs 5) '(1 3 4 5)) "unquote-splicing")
+(assert! (equal? `(1 ,@#n 5) '(1 5)) "unquote-splicing empty list")
+(assert! (equal? xs '(3 4)) "splicing leaves the list intact")
+(assert! (equal? `(a (b ,x)) '(a (b 2))) "nested unquote")
+
+; recursion
+(define (fib n) (if (eq? n 0) 0 (if (eq? n 1) 1 (+ (fib (- n 1)) (fib (- n 2))))))
+(assert-eq! (fib 10) 55 "recursive fib")
+(assert-eq! (- 5 3) 2 "subtraction")
+
+; varadic functions
+(set! list (lambda (... xs) xs))
+(assert! (equal? (list 1 2 3) '(1 2 3)) "varadic lambda")
+(assert-eq! (list) #n "varadic lambda with no arguments")
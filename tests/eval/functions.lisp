@@ -38,3 +38,44 @@
 (assert! (equal? (test-closure 'get) (cons 3 2)))
 (assert-eq! (test-closure 'inc) #n)
 (assert! (equal? (test-closure 'get) (cons (cons 3 2) 2)))
+
+; variables from several enclosing functions and shadowing
+(set! nest (lambda (a) (lambda (b) (lambda (a) (cons a b)))))
+(assert! (equal? (((nest 1) 2) 3) (cons 3 2)) "inner binding shadows outer one")
+(assert-eq! (let ([x 1]) (let ([y 2]) ((lambda (z) (+ x (+ y z))) 3))) 6 "let variables in closures")
+
+; captured variables that are assigned are shared between closures and their scope
+(define (counter)
+    (let ([n 0])
+      (cons (lambda () (set! n (+ n 1))) (lambda () n))))
+(set! c (counter))
+((car c))
+((car c))
+(assert-eq! ((cdr c)) 2 "closures share an assigned variable")
+(assert-eq! (let ([x 1]) (let ([f (lambda () x)]) (begin (set! x 2) (f)))) 2 "assignment after capture")
+(define (shared-in-lets a)
+    (let ([get (lambda () a)])
+      (let ([b 0])
+        (let ([inc (lambda () (set! b (+ b 1)))])
+          (begin (inc) (set! a b) (cons (get) b))))))
+(assert! (equal? (shared-in-lets 0) (cons 1 1)) "assignments in nested lets")
+(assert! (equal? (shared-in-lets 5) (cons 1 1)) "assignments in nested lets again")
+(assert-eq! (letrec ([ev? (lambda (n) (if (eq? n 0) #t (od? (- n 1))))]
+                     [od? (lambda (n) (if (eq? n 0) #f (ev? (- n 1))))])
+              (ev? 10))
+            #t "letrec closures see each other")
+
+; globals are looked up when used rather than when a closure is made
+(set! call-later (lambda () (defined-later 3)))
+(define (defined-later x) (+ x 1))
+(assert-eq! (call-later) 4 "forward reference to a global")
+
+; closures made again from the same form capture the values in scope at the time
+(define (adders n acc) (if (eq? n 0) acc (adders (- n 1) (cons (lambda (x) (+ x n)) acc))))
+(set! xs (adders 3 #n))
+(assert-eq! ((car xs) 10) 11 "first closure from a loop")
+(assert-eq! ((car (cdr (cdr xs))) 10) 13 "last closure from a loop")
+(assert-eq! (let ([f (lambda () 5)]) (f)) 5 "closure that captures nothing")
+
+; local functions with the same arguments and a body that is just a name
+(assert! (let ([z 1]) (begin (define (f x) f) (define (g x) f) (eq? (g 0) (f 0)))) "same body, different names")
@@ -0,0 +1,60 @@
+; tables compare keys with eq? unless they are made for equal? keys
+(set! h (make-hash))
+(assert! (hash? h))
+(assert! (eq? (hash? #(1 2)) #f))
+(assert! (eq? (hash-count h) 0))
+(assert! (eq? (hash-set! h 'a 1) 1))
+(hash-set! h 2 'two)
+(hash-set! h "str" 3)
+(assert! (eq? (hash-count h) 3))
+(assert! (eq? (hash-ref h 'a) 1))
+(assert! (eq? (hash-ref h 2) 'two))
+(assert! (hash-contains? h 'a))
+(assert! (eq? (hash-contains? h 'b) #f))
+
+; missing keys give nil or the default
+(assert! (eq? (hash-ref h 'b) #n))
+(assert! (eq? (hash-ref h 'b 'none) 'none))
+; a string is only the same key as itself
+(assert! (eq? (hash-ref h "str" 'none) 'none))
+
+; setting a key again replaces its value
+(hash-set! h 'a 10)
+(assert! (eq? (hash-ref h 'a) 10))
+(assert! (eq? (hash-count h) 3))
+
+(assert! (hash-remove! h 'a))
+(assert! (eq? (hash-remove! h 'a) #f))
+(assert! (eq? (hash-contains? h 'a) #f))
+(assert! (eq? (hash-count h) 2))
+
+; equal? tables look at what strings, lists and vectors hold
+(set! e (make-hash 'equal 100))
+(hash-set! e "ada" 1)
+(hash-set! e '(1 (2 #(3))) 2)
+(assert! (eq? (hash-ref e "ada") 1))
+(assert! (eq? (hash-ref e (cons 1 (cons (cons 2 (cons (vector 3) #n)) #n))) 2))
+(assert! (eq? (hash-ref e '(1 2) 'none) 'none))
+
+; tables grow past the size they were made with
+(set! g (make-hash 'eq 1))
+(define (fill i) (if (eq? i 100) #n (begin (hash-set! g i (* i i)) (fill (+ i 1)))))
+(fill 0)
+(assert! (eq? (hash-count g) 100))
+(assert! (eq? (hash-ref g 99) 9801))
+
+; the entries can be listed or visited
+(set! s (make-hash))
+(hash-set! s 'x 1)
+(assert! (eq? (car (hash-keys s)) 'x))
+(assert! (eq? (car (hash-values s)) 1))
+(assert! (eq? (cdr (car (hash->list s))) 1))
+(set! total 0)
+(hash-for-each g (lambda (k v) (set! total (+ total v))))
+(assert! (eq? total 328350))
+
+; the value set is returned even when growing the table collects garbage
+(set! grown (make-hash 'eq 1))
+(define (grow i)
+  (if (eq? i 100) #t (if (eq? (car (hash-set! grown i (cons i i))) i) (grow (+ i 1)) #f)))
+(assert! (grow 0))
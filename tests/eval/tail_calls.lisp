@@ -0,0 +1,18 @@
+; each of these loops would exhaust the native stack without tail call elimination
+(define (count-down n) (if (eq? n 0) 'done (count-down (- n 1))))
+(assert-eq! (count-down 50000) 'done "self tail call")
+
+(define (ev? n) (if (eq? n 0) #t (od? (- n 1))))
+(define (od? n) (if (eq? n 0) #f (ev? (- n 1))))
+(assert-eq! (ev? 50000) #t "mutual tail calls")
+
+(define (sum-to n acc)
+    (let ([next (- n 1)])
+      (begin
+        (if (eq? n 0)
+          acc
+          (sum-to next (+ acc n))))))
+(assert-eq! (sum-to 50000 0) 1250025000 "tail calls from let and begin")
+
+(set! loop (lambda (n) (if (eq? n 0) #t (loop (- n 1)))))
+(assert-eq! (loop 50000) #t "tail calls of a global closure")
@@ -0,0 +1,37 @@
+; vecs are written as literals or made from numbers, and evaluate to themselves
+(set! a #vec3(1 2 3))
+(set! b (vec3 4 5 6.5))
+(assert! (vec? a))
+(assert! (eq? (vec? #v(1 2 3)) #f))
+(assert! (eq? (vec-dim a) 3))
+(assert! (eq? (vec-dim (vec2 0 0)) 2))
+(assert! (eq? (vec-x a) 1.0))
+(assert! (eq? (vec-z b) 6.5))
+(assert! (eq? (vec-ref (vec4 1 2 3 4) 3) 4.0))
+(set! l (vec->list (vec2 1.5 -2)))
+(assert! (eq? (car l) 1.5))
+(assert! (eq? (car (cdr l)) -2.0))
+
+; they are compared by value
+(assert! (vec-equal? a (vec3 1 2 3)))
+(assert! (eq? (vec-equal? a (vec3 1 2 4)) #f))
+(assert! (eq? (vec-equal? (vec2 1 2) (vec3 1 2 0)) #f))
+
+; + - * / take vecs of the same size or numbers, which apply to every element
+(assert! (vec-equal? (+ a b) #vec3(5 7 9.5)))
+(assert! (vec-equal? (- b a a) #vec3(2 1 0.5)))
+(assert! (vec-equal? (* a 2) #vec3(2 4 6)))
+(assert! (vec-equal? (* a b) #vec3(4 10 19.5)))
+(assert! (vec-equal? (/ #vec2(1 3) 2) #vec2(0.5 1.5)))
+(assert! (vec-equal? (+ #vec4(1 1 1 1) #vec4(0 1 2 3) 1) #vec4(2 3 4 5)))
+
+; dividing by a vec leaves the elements a smaller vec doesn't have alone
+(assert! (vec-equal? (/ #vec2(2 4) #vec2(2 2)) #vec2(1 2)))
+
+(assert! (eq? (vec-dot a b) 33.5))
+(assert! (eq? (vec-dot #vec2(3 4) #vec2(3 4)) 25.0))
+(assert! (vec-equal? (vec-cross #vec3(1 0 0) #vec3(0 1 0)) #vec3(0 0 1)))
+(assert! (vec-equal? (vec-cross a b) #vec3(-2 5.5 -3)))
+(assert! (eq? (vec-length #vec2(3 4)) 5.0))
+(assert! (vec-equal? (vec-normalize #vec2(3 4)) #vec2(0.6 0.8)))
+(assert! (vec-equal? (vec-lerp #vec2(0 10) #vec2(4 20) 0.25) #vec2(1 12.5)))
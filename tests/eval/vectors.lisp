@@ -0,0 +1,44 @@
+; vectors are written as literals, which evaluate to themselves
+(set! v #(1 2 3))
+(assert! (vector? v))
+(assert! (eq? (vector? '(1 2 3)) #f))
+(assert! (eq? (vector-length v) 3))
+(assert! (eq? (vector-ref v 0) 1))
+(assert! (eq? (vector-ref v 2) 3))
+(assert! (eq? (vector-length #()) 0))
+
+; or made with make-vector and vector
+(set! m (make-vector 4 'a))
+(assert! (eq? (vector-length m) 4))
+(assert! (eq? (vector-ref m 3) 'a))
+(assert! (eq? (vector-ref (make-vector 2) 1) #n))
+(vector-set! m 1 "b")
+(assert! (eq? (vector-ref m 0) 'a))
+(assert! (eq? (string-length (vector-ref m 1)) 1))
+
+(set! w (vector 1 (+ 1 1) 'c))
+(assert! (eq? (vector-ref w 1) 2))
+(assert! (eq? (vector-ref w 2) 'c))
+
+; and converted from and to lists
+(set! l (vector->list #(1 #(2) "x")))
+(assert! (eq? (car l) 1))
+(assert! (vector? (car (cdr l))))
+(assert! (eq? (cdr (cdr (cdr l))) #n))
+(set! c (list->vector '(a b c)))
+(assert! (eq? (vector-length c) 3))
+(assert! (eq? (vector-ref c 2) 'c))
+
+; the elements of a vector survive collections, including ones stored after it was promoted
+(define (fill v i)
+  (if (eq? i (vector-length v))
+    v
+    (begin
+      (vector-set! v i (cons i (make-vector 3 i)))
+      (fill v (+ i 1)))))
+(set! big (fill (make-vector 500) 0))
+(assert! (eq? (car (vector-ref big 499)) 499))
+(assert! (eq? (vector-ref (cdr (vector-ref big 250)) 2) 250))
+(fill big 0)
+(assert! (eq? (car (vector-ref big 0)) 0))
+(assert! (eq? (vector-ref (cdr (vector-ref big 499)) 0) 499))
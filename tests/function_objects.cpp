@@ -0,0 +1,87 @@
+#include <cstdlib>
+#include <emlisp.h>
+#include <iostream>
+#include <new>
+using namespace emlisp;
+
+// counts the C++ allocations that are still live, which is where function templates are kept
+size_t live_allocations = 0;
+
+void* operator new(size_t n) {
+    live_allocations++;
+    void* p = malloc(n == 0 ? 1 : n);
+    if(p == nullptr) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    if(p == nullptr) return;
+    live_allocations--;
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+
+int main() {
+    for(auto mode : {eval_mode::tree_walk, eval_mode::bytecode}) {
+        runtime rt{64 * 1024, false, mode};
+        rt.define_fn("collect!", [](runtime* rt, value args, void* cx) {
+            rt->collect_garbage(nullptr, true);
+            return NIL;
+        }, nullptr);
+        rt.eval_file("(define (make-adder n) (lambda (x) (+ x n)))"
+                     "(define (adders n acc) (if (eq? n 0) acc (adders (- n 1) (cons (make-adder n) acc))))");
+
+        // a lambda that is read again every time gets a new template, which is released once
+        // nothing refers to it
+        auto fresh = [&]() {
+            value v = rt.eval(rt.read("(let ([f (lambda (x) (+ x 1))]) (f 1))"));
+            assert(to_int(v) == 2);
+        };
+        for(int i = 0; i < 100; ++i)
+            fresh();
+        rt.collect_garbage(nullptr, true);
+        size_t before = live_allocations;
+        for(int i = 0; i < 5000; ++i)
+            fresh();
+        rt.collect_garbage(nullptr, true);
+        assert(live_allocations < before + 64);
+
+        // evaluating the same lambda form again reuses its template
+        rt.eval(rt.read("(define xs (adders 10 #n))"));
+        rt.collect_garbage(nullptr, true);
+        before = live_allocations;
+        rt.eval(rt.read("(define xs (adders 2000 #n))"));
+        rt.collect_garbage(nullptr, true);
+        assert(live_allocations < before + 64);
+        assert(to_int(rt.eval(rt.read("((car (cdr xs)) 40)"))) == 42);
+        std::cout << "0\n";
+
+        // a function keeps running after the only closure for it becomes garbage
+        value v = rt.eval(rt.read("((lambda (n) (begin (collect!) (adders 100 #n) (collect!) n)) 7)"));
+        assert(to_int(v) == 7);
+        rt.eval(rt.read("(define (f) (begin (set! f #n) (collect!) ((lambda () 5))))"));
+        assert(to_int(rt.eval(rt.read("(f)"))) == 5);
+        std::cout << "1\n";
+    }
+
+    // the tree walker's closures keep the captures of the first closure made from a form at the
+    // same positions, while later ones can find a name that was global then to be local
+    runtime rt{64 * 1024, false, eval_mode::tree_walk};
+    rt.eval_file("(define (where-from local?)"
+                 "  (begin (if local? (set! where 'local) #n) (lambda () where)))"
+                 "(define from-local (where-from #t))"
+                 "(define where 'global)"
+                 "(define from-global (where-from #f))"
+                 "(define where 'global-again)");
+    assert(rt.eval(rt.read("(from-local)")) == rt.symbol("local"));
+    assert(rt.eval(rt.read("(from-global)")) == rt.symbol("global-again"));
+    rt.eval_file("(define (where-else local?)"
+                 "  (begin (if local? (set! elsewhere 'local) #n) (lambda () (cons where elsewhere))))"
+                 "(define unbound (where-else #f))"
+                 "(define from-local (where-else #t))");
+    value v = rt.eval(rt.read("(from-local)"));
+    assert(first(v) == rt.symbol("global-again") && second(v) == rt.symbol("local"));
+    std::cout << "2\n";
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include <emlisp.h>
+#include <iostream>
+using namespace emlisp;
+
+int main() {
+    runtime rt{1024 * 1024, false};
+    heap_info info;
+
+    // survivors are promoted, leaving the nursery empty
+    auto list = rt.handle_for(rt.read("(1 2 3)"));
+    rt.collect_garbage(&info);
+    assert(info.new_size == 0);
+    size_t promoted = info.old_size;
+    assert(promoted > 0);
+
+    // minor collections leave values in the old space where they are
+    value before = *list;
+    rt.collect_garbage(&info);
+    assert(*list == before);
+    assert(info.old_size == promoted);
+
+    // a young value only referenced from the old space survives through the remembered set
+    rt.set_second(second(second(*list)), rt.cons(rt.from_int(4), NIL));
+    rt.collect_garbage(&info);
+    assert(to_int(first(second(second(second(*list))))) == 4);
+    assert(info.old_size > promoted);
+
+    std::cout << "0\n";
+    // garbage in the old space is only reclaimed by a full collection
+    size_t with_list = info.old_size;
+    *list            = NIL;
+    rt.collect_garbage(&info);
+    assert(info.old_size == with_list);
+    rt.collect_garbage(&info, true);
+    assert(info.old_size < with_list);
+
+    // the old space grows to hold everything that survives
+    auto big = rt.handle_for(NIL);
+    for(int i = 0; i < 200000; ++i) {
+        *big = rt.cons(rt.from_int(i), *big);
+        if(i % 10000 == 0) rt.collect_garbage(&info);
+    }
+    rt.collect_garbage(&info);
+    int64_t n = 0;
+    for(value v = *big; v != NIL; v = second(v))
+        n++;
+    assert(n == 200000);
+
+    std::cout << "1\n";
+    // long chains are copied without recursing through them
+    *big = NIL;
+    for(int i = 0; i < 1000000; ++i) {
+        *big = rt.cons(rt.from_int(i), *big);
+        if(i % 50000 == 0) rt.collect_garbage(&info);
+    }
+    rt.collect_garbage(&info, true);
+    n = 0;
+    for(value v = *big; v != NIL; v = second(v))
+        assert(to_int(first(v)) == 999999 - n++);
+    assert(n == 1000000);
+
+    // strings keep their contents when they move
+    auto s = rt.handle_for(rt.from_str("hello, world"));
+    rt.collect_garbage(&info);
+    rt.collect_garbage(&info, true);
+    assert(rt.to_str(*s) == "hello, world");
+
+    // so do vectors, and young values stored into old vectors survive through the remembered set
+    auto vec = rt.handle_for(rt.make_vector(1000, rt.from_int(7)));
+    rt.collect_garbage(&info);
+    rt.vector_set(*vec, 999, rt.cons(rt.from_int(8), NIL));
+    rt.collect_garbage(&info);
+    assert(to_int(first(vector_ref(*vec, 999))) == 8 && to_int(vector_ref(*vec, 0)) == 7);
+    rt.collect_garbage(&info, true);
+    assert(to_int(first(vector_ref(*vec, 999))) == 8 && vector_length(*vec) == 1000);
+
+    return 0;
+}
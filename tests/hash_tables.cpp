@@ -0,0 +1,117 @@
+#include <emlisp.h>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <unordered_map>
+using namespace emlisp;
+
+// conses that are only equal to themselves, kept in a vector so that collections can move them
+// while every one of them stays a key
+const char* program = "(define keys (make-vector 200))"
+                      "(define table (make-hash))"
+                      "(define (fill i)"
+                      "  (if (eq? i 200) '()"
+                      "    (begin (vector-set! keys i (cons i '()))"
+                      "           (hash-set! table (vector-ref keys i) i)"
+                      "           (fill (+ i 1)))))"
+                      "(define (found i)"
+                      "  (if (eq? i 200) #t"
+                      "    (if (eq? (hash-ref table (vector-ref keys i)) i) (found (+ i 1)) #f)))"
+                      "(fill 0)";
+
+bool all_found(runtime& rt) { return rt.eval(rt.read("(found 0)")) == TRUE; }
+
+int main() {
+    for(auto mode : {eval_mode::tree_walk, eval_mode::bytecode}) {
+        runtime rt{16 * 1024, true, mode};
+        rt.eval_file(program);
+        assert(all_found(rt));
+        // a key made the same way is a different key
+        assert(rt.eval(rt.read("(hash-contains? table (cons 3 '()))")) == FALSE);
+
+        // keys hashed by their address are found after every kind of collection moves them
+        rt.collect_garbage();
+        assert(all_found(rt));
+        rt.collect_garbage(nullptr, true);
+        assert(all_found(rt));
+        for(size_t steps = 0; !rt.collect_garbage_step(256); ++steps) {
+            // the table is used and changed while the collection runs
+            assert(all_found(rt));
+            rt.eval(rt.read("(hash-set! table (vector-ref keys 7) 7)"));
+        }
+        assert(all_found(rt));
+        // allocating enough to collect many times on the way
+        rt.eval_file("(define (churn n) (if (eq? n 0) '() (begin (cons n n) (churn (- n 1)))))"
+                     "(churn 5000)");
+        assert(all_found(rt));
+
+        // clones get copies of the table with their own copies of the keys
+        auto c = rt.clone();
+        assert(all_found(*c));
+        c->eval_file("(hash-set! table (vector-ref keys 0) 'changed)");
+        assert(all_found(rt) && !all_found(*c));
+
+        // and so do snapshots
+        rt.save_snapshot("test_hash_snapshot.bin");
+        runtime s{16 * 1024, true, mode};
+        s.load_snapshot("test_hash_snapshot.bin");
+        assert(all_found(s));
+        s.collect_garbage(nullptr, true);
+        assert(all_found(s));
+
+        // tables in a base are never hashed again, and can't be changed
+        runtime b{rt.make_base(), 16 * 1024, mode};
+        assert(all_found(b));
+        b.collect_garbage(nullptr, true);
+        assert(all_found(b));
+        bool threw = false;
+        try {
+            b.eval(b.read("(hash-set! table 'x 1)"));
+        } catch(const std::runtime_error&) { threw = true; }
+        assert(threw);
+    }
+
+    // inserting and removing at random agrees with std::unordered_map, which also checks that
+    // removing keys leaves the ones that collided with them reachable
+    runtime                              rt{16 * 1024, false};
+    auto                                 h = rt.handle_for(rt.make_hash());
+    std::unordered_map<int64_t, int64_t> expected;
+    std::mt19937                         rng(42);
+    for(size_t i = 0; i < 20000; ++i) {
+        int64_t key = rng() % 500, x = rng() % 1000;
+        switch(rng() % 3) {
+            case 0:
+                assert(rt.hash_remove(*h, rt.from_int(key)) == (expected.erase(key) == 1));
+                break;
+            default:
+                rt.hash_set(*h, rt.from_int(key), rt.from_int(x));
+                expected[key] = x;
+        }
+        assert(hash_count(*h) == expected.size());
+        if(i % 1000 == 0)
+            for(int64_t k = 0; k < 500; ++k) {
+                auto v = rt.hash_ref(*h, rt.from_int(k));
+                auto e = expected.find(k);
+                assert(v.has_value() == (e != expected.end()));
+                if(v.has_value()) assert(to_int(*v) == e->second);
+            }
+    }
+
+    // tables of `equal?` keys find strings and lists by their contents
+    auto e = rt.handle_for(rt.make_hash(true));
+    rt.hash_set(*e, rt.read("\"ada\""), rt.from_int(1));
+    rt.hash_set(*e, rt.read("(1 (2 \"x\") #vec2(0 1))"), rt.from_int(2));
+    assert(to_int(*rt.hash_ref(*e, rt.read("\"ada\""))) == 1);
+    assert(to_int(*rt.hash_ref(*e, rt.read("(1 (2 \"x\") #vec2(-0 1))"))) == 2);
+    assert(!rt.hash_ref(*e, rt.read("(1 (2 \"y\") #vec2(0 1))")).has_value());
+    assert(!rt.hash_ref(*h, rt.read("\"ada\"")).has_value());
+
+    // only data can be sent between runtimes
+    bool threw = false;
+    try {
+        std::ostringstream out;
+        rt.serialize(out, *h);
+    } catch(const std::runtime_error&) { threw = true; }
+    assert(threw);
+    return 0;
+}
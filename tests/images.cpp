@@ -0,0 +1,47 @@
+#include <emlisp.h>
+#include <iostream>
+using namespace emlisp;
+
+const char* program = "(defmacro (swap! a b) (let ([t (unique-symbol t)]) `(let ([,t ,a]) (begin (set! ,a ,b) (set! ,b ,t)))))"
+                      "(define greeting \"hello, world\")"
+                      "(define (rotate x t) (begin (swap! x t) (cons x t)))"
+                      "(define pairs '((1 . 2) (3 . 4)))"
+                      "(define table #(a (b) #(\"c\")))";
+
+int main() {
+    std::vector<uint8_t> image;
+    {
+        runtime rt{64 * 1024, false};
+        image = rt.make_image(program);
+    }
+
+    for(auto mode : {eval_mode::tree_walk, eval_mode::bytecode}) {
+        runtime rt{64 * 1024, false, mode};
+        // symbols get different indices than in the runtime that made the image
+        rt.symbol("something-else");
+        rt.eval_image(image.data(), image.size());
+        assert(rt.to_str(rt.eval(rt.read("greeting"))) == "hello, world");
+        assert(to_int(rt.eval(rt.read("(car (car (cdr pairs)))"))) == 3);
+        assert(rt.eval(rt.read("(car (vector-ref table 1))")) == rt.symbol("b"));
+        assert(rt.to_str(rt.eval(rt.read("(vector-ref (vector-ref table 2) 0)"))) == "c");
+
+        // the symbol the macro made is still unique, and the macro still works
+        value r = rt.eval(rt.read("(rotate 1 2)"));
+        assert(to_int(first(r)) == 2 && to_int(second(r)) == 1);
+        rt.eval_file("(define t 5) (define a 1) (define b 2) (swap! a b)");
+        assert(to_int(rt.eval(rt.read("a"))) == 2 && to_int(rt.eval(rt.read("t"))) == 5);
+
+        // the program is in the code space
+        heap_info info;
+        rt.collect_garbage(&info, true);
+        assert(info.code_size >= image.size() / 2);
+    }
+
+    bool threw = false;
+    try {
+        runtime rt{64 * 1024, false};
+        rt.eval_image(image.data(), image.size() - 8);
+    } catch(const std::runtime_error&) { threw = true; }
+    assert(threw);
+    return 0;
+}
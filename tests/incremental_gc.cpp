@@ -0,0 +1,87 @@
+#include <emlisp.h>
+#include <iostream>
+#include <vector>
+using namespace emlisp;
+
+std::vector<int> destroyed;
+
+struct thing {
+    int x;
+
+    thing(int x) : x(x) {}
+
+    ~thing() { destroyed.push_back(x); }
+};
+
+int main() {
+    runtime   rt{64 * 1024, false};
+    heap_info info;
+
+    // a long list in the old space
+    auto list = rt.handle_for(NIL);
+    for(int i = 0; i < 20000; ++i)
+        *list = rt.cons(rt.from_int(i), *list);
+    auto t = rt.handle_for(rt.make_owned_extern<thing>(7));
+    rt.collect_garbage(&info, true);
+    size_t live = info.old_size;
+    // garbage that gets promoted before the collection starts
+    rt.make_owned_extern<thing>(8);
+    rt.collect_garbage();
+
+    // the collection proceeds a slice at a time while the list is changed and garbage is made
+    size_t steps = 0, last_copied = 0;
+    while(!rt.collect_garbage_step(4096, &info)) {
+        assert(info.collecting);
+        assert(info.copied >= last_copied && info.scanned <= info.copied);
+        last_copied = info.copied;
+        value cell  = *list;
+        for(int i = 0; i < (int)steps; ++i)
+            cell = second(cell);
+        rt.set_first(cell, rt.cons(rt.from_int(100000), NIL));
+        for(int i = 0; i < 1000; ++i)
+            rt.cons(NIL, NIL);
+        steps++;
+    }
+    assert(steps > 10);
+    assert(!info.collecting);
+    assert(info.old_size < 2 * live);
+
+    int n = 0;
+    for(value v = *list; v != NIL; v = second(v), ++n) {
+        if(n < (int)steps)
+            assert(to_int(first(first(v))) == 100000);
+        else
+            assert(to_int(first(v)) == 19999 - n);
+    }
+    assert(n == 20000);
+    assert(rt.get_extern_reference<thing>(*t)->x == 7);
+    assert(destroyed == std::vector<int>{8});
+    std::cout << "0\n";
+
+    // a full collection finishes an incremental one
+    rt.collect_garbage_step(1024, &info);
+    assert(info.collecting);
+    rt.collect_garbage(&info, true);
+    assert(!info.collecting);
+    assert(to_int(first(first(second(*list)))) == 100000);
+
+    // a program running between time slices
+    for(auto mode : {eval_mode::tree_walk, eval_mode::bytecode}) {
+        runtime r{16 * 1024, true, mode};
+        r.eval_file(
+            "(define (iota n acc) (if (eq? n 0) acc (iota (- n 1) (cons n acc))))"
+            "(define xs (iota 2000 #n))"
+            "(define count 0)"
+            "(define (frame) (begin (set! count (+ count 1)) (set! xs (cons count (cdr xs))) count))"
+        );
+        for(int i = 0; i < 500; ++i) {
+            r.eval(r.read("(frame)"));
+            r.collect_garbage_step(std::chrono::microseconds(20));
+        }
+        assert(to_int(r.eval(r.read("(car xs)"))) == 500);
+        assert(to_int(r.eval(r.read("(length xs)"))) == 2000);
+    }
+    std::cout << "1\n";
+
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include <emlisp_pool.h>
+#include <iostream>
+#include <set>
+using namespace emlisp;
+
+int main() {
+    for(auto mode : {eval_mode::tree_walk, eval_mode::bytecode}) {
+        runtime host{64 * 1024, true, mode};
+        host.eval_file("(define (fib n) (if (eq? n 0) 0 (if (eq? n 1) 1 (+ (fib (- n 1)) (fib (- n 2))))))"
+                       "(define (pair-up a b) (cons a b))"
+                       "(define (f x) 'global)"
+                       "(define (call-local f x) (touch (future (f x))))"
+                       "(define (tree n) (if (eq? n 0) 1"
+                       "  (+ (touch (future (tree (- n 1)))) (touch (future (tree (- n 1)))))))");
+        runtime_pool pool{host.make_base(), 4, 64 * 1024, mode};
+        assert(pool.size() == 4);
+
+        // jobs run on the workers and their results are read back into the host
+        std::vector<std::future<packed_value>> results;
+        for(int i = 0; i < 64; ++i)
+            results.push_back(pool.submit(host, "fib", host.cons(host.from_int(i % 16))));
+        int fibs[16] = {0, 1};
+        for(int i = 2; i < 16; ++i)
+            fibs[i] = fibs[i - 1] + fibs[i - 2];
+        for(int i = 0; i < 64; ++i)
+            assert(to_int(results[i].get().unpack(host)) == fibs[i % 16]);
+
+        value args = host.read("(\"left\" (right))");
+        value pair = pool.submit(host, "pair-up", args).get().unpack(host);
+        assert(host.to_str(first(pair)) == "left");
+        assert(first(second(pair)) == host.symbol("right"));
+
+        // errors come back through the future
+        bool threw = false;
+        try {
+            pool.submit(host, "no-such-function", NIL).get();
+        } catch(const std::runtime_error&) { threw = true; }
+        assert(threw);
+
+        // jobs posted by a job go to its worker's queue, the idle workers steal them
+        auto ids = pool.run([&](runtime&) {
+                           std::vector<std::future<std::thread::id>> inner;
+                           for(int i = 0; i < 32; ++i)
+                               inner.push_back(pool.run([](runtime& rt) {
+                                   rt.eval(rt.read("(fib 12)"));
+                                   std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                                   return std::this_thread::get_id();
+                               }));
+                           std::set<std::thread::id> seen;
+                           for(auto& f : inner)
+                               seen.insert(f.get());
+                           return seen.size();
+                       }).get();
+        assert(ids > 1);
+
+        // Lisp code runs calls on the workers through futures, which workers can make as well
+        pool.attach(host);
+        auto eval = [&](const char* src) { return host.eval(host.expand(host.read(src))); };
+        value mapped = eval("(pmap fib '(10 11 12 13))");
+        assert(to_int(nth(mapped, 0)) == 55 && to_int(nth(mapped, 3)) == 233);
+        assert(to_int(eval("(tree 6)")) == 64);
+        // touching anything that isn't a future gives it back, C++ references included
+        assert(to_int(eval("(touch 4)")) == 4);
+        int   cpp_value = 7;
+        value ref       = host.make_extern_reference(&cpp_value);
+        assert(host.apply(host.global("touch"), host.cons(ref)) == ref);
+        threw = false;
+        try {
+            eval("(touch (future (no-such-function 1)))");
+        } catch(const std::runtime_error&) { threw = true; }
+        assert(threw);
+        auto nested = pool.submit(host, "tree", host.cons(host.from_int(5))).get();
+        assert(to_int(nested.unpack(host)) == 32);
+
+        // functions that aren't globals are called in the host
+        assert(to_int(eval("(touch (future ((lambda (x) (* x 2)) 21)))")) == 42);
+        mapped = eval("(pmap (lambda (x) (+ x 1)) '(1 2 3))");
+        assert(to_int(nth(mapped, 0)) == 2 && to_int(nth(mapped, 2)) == 4);
+        assert(to_int(eval("(call-local (lambda (x) (+ x 1)) 1)")) == 2);
+        assert(eval("(call-local f 1)") == host.symbol("global"));
+
+        // calls of globals mean the base's definition, whether a worker or `touch` runs them
+        host.eval_file("(define (fib n) 0)");
+        mapped = eval("(pmap fib '(10 10 10 10 10 10 10 10 10 10 10 10 10 10 10 10))");
+        for(size_t i = 0; i < 16; ++i)
+            assert(to_int(nth(mapped, i)) == 55);
+    }
+    return 0;
+}
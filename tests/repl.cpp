@@ -18,8 +18,7 @@ int main(int argc, char* argv[]) {
 	rt.define_fn("run-gc", [](emlisp::runtime* rt, emlisp::value args, void* d) {
 		emlisp::heap_info ifo;
 		rt->collect_garbage(&ifo);
-		std::cout << "old heap had " << ifo.old_size << " bytes, new heap has " << ifo.new_size << " bytes\n"
-			<< "collected " << (ifo.old_size - ifo.new_size) << " bytes\n";
+		std::cout << "nursery has " << ifo.new_size << " bytes, old space has " << ifo.old_size << " bytes\n";
 		return emlisp::NIL;
 	}, nullptr);
 	while (std::cin) {
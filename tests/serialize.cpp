@@ -0,0 +1,107 @@
+#include <emlisp.h>
+#include <iostream>
+#include <sstream>
+using namespace emlisp;
+
+std::string serialized(runtime& rt, value v) {
+    std::ostringstream out;
+    rt.serialize(out, v);
+    return out.str();
+}
+
+value deserialized(runtime& rt, const std::string& s) {
+    return rt.deserialize((const uint8_t*)s.data(), s.size());
+}
+
+int main() {
+    runtime a{64 * 1024, false};
+    runtime b{64 * 1024, false};
+    // symbols get different indices in the other runtime
+    b.symbol("something-else");
+
+    // plain data comes back equal
+    auto data = a.handle_for(a.read("(1 -2 3.5 #t #f \"str\" sym (nested (list)) -123456789012)"));
+    value v   = deserialized(b, serialized(a, *data));
+    std::ostringstream aw, bw;
+    a.write(aw, *data);
+    b.write(bw, v);
+    assert(aw.str() == bw.str());
+    assert(nth(v, 1) == b.from_int(-2) && nth(v, 8) == b.from_int(-123456789012));
+    assert(nth(v, 6) == b.symbol("sym"));
+
+    // shared structure stays shared, and cycles survive
+    value shared = a.cons(a.from_str("shared"), NIL);
+    auto  pair   = a.handle_for(a.cons(shared, shared));
+    value ring   = a.cons(a.from_int(1), a.cons(a.from_int(2), NIL));
+    a.set_second(second(ring), ring);
+    *pair = a.cons(*pair, ring);
+    v     = deserialized(b, serialized(a, *pair));
+    assert(first(first(v)) == second(first(v)));
+    assert(b.to_str(first(first(first(v)))) == "shared");
+    value r = second(v);
+    assert(second(second(r)) == r);
+    assert(to_int(first(second(r))) == 2);
+
+    // serializing leaves the value as it was
+    assert(first(first(*pair)) == second(first(*pair)) && second(second(second(*pair))) == second(*pair));
+    std::ostringstream again;
+    a.write(again, *data);
+    assert(again.str() == aw.str());
+
+    // interned code is numbered on the side instead of being marked
+    v = deserialized(b, serialized(a, a.intern_code(*pair)));
+    assert(first(first(v)) == second(first(v)));
+    assert(second(second(second(v))) == second(v));
+
+    // the value survives collections in the runtime that read it
+    auto h = b.handle_for(v);
+    b.collect_garbage(nullptr, true);
+    assert(second(second(second(*h))) == second(*h));
+
+    // unique symbols don't turn into the symbols they are named after
+    value u = a.eval(a.read("(unique-symbol x)"));
+    v       = deserialized(b, serialized(a, a.cons(u, a.cons(a.symbol("x"), NIL))));
+    assert(first(v) != b.symbol("x") && first(second(v)) == b.symbol("x"));
+
+    // vectors keep their elements, which can refer back to the vector
+    auto vec = a.handle_for(a.read("#(1 \"two\" (3) #(4))"));
+    a.vector_set(*vec, 2, *vec);
+    v = deserialized(b, serialized(a, *vec));
+    assert(vector_length(v) == 4 && to_int(vector_ref(v, 0)) == 1);
+    assert(b.to_str(vector_ref(v, 1)) == "two" && vector_ref(v, 2) == v);
+    assert(to_int(vector_ref(vector_ref(v, 3), 0)) == 4);
+    v = deserialized(b, serialized(a, a.intern_code(*vec)));
+    assert(vector_ref(v, 2) == v);
+
+    // vecs and arrays are copied as their bytes
+    v = deserialized(b, serialized(a, a.read("(#vec2(1.5 -2) #vec4(1 2 3 4) #f64(0.25 8))")));
+    assert(vec_dim(first(v)) == 2 && vec_data(first(v))[1] == -2.f);
+    assert(vec_dim(nth(v, 1)) == 4 && vec_data(nth(v, 1))[3] == 4.f);
+    assert(array_length(nth(v, 2)) == 2 && array_data<double>(nth(v, 2))[0] == 0.25);
+
+    // large lists
+    auto big = a.handle_for(NIL);
+    for(int i = 0; i < 100000; ++i)
+        *big = a.cons(a.from_int(i), *big);
+    v = deserialized(b, serialized(a, *big));
+    size_t n = 0;
+    for(; v != NIL; v = second(v))
+        assert(to_int(first(v)) == 99999 - (int64_t)n++);
+    assert(n == 100000);
+
+    // only data can be serialized, and broken input is rejected
+    bool threw = false;
+    try {
+        serialized(a, a.eval(a.read("(lambda (x) x)")));
+    } catch(const std::runtime_error&) { threw = true; }
+    assert(threw);
+    std::string s = serialized(a, *data);
+    for(size_t len : {(size_t)0, (size_t)3, s.size() / 2, s.size() - 1}) {
+        threw = false;
+        try {
+            deserialized(b, s.substr(0, len));
+        } catch(const std::runtime_error&) { threw = true; }
+        assert(threw);
+    }
+    return 0;
+}
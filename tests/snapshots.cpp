@@ -0,0 +1,74 @@
+#include <emlisp.h>
+#include <iostream>
+using namespace emlisp;
+
+struct thing {
+    int x;
+};
+
+int main() {
+    const std::string path = "test_snapshot.bin";
+    int               scale = 3;
+    auto              scaled = [](runtime* rt, value args, void* d) {
+        return rt->from_int(to_int(first(args)) * *(int*)d);
+    };
+
+    for(auto mode : {eval_mode::tree_walk, eval_mode::bytecode}) {
+        {
+            runtime rt{64 * 1024, true, mode};
+            rt.define_fn("scaled", scaled, &scale);
+            rt.eval_file("(define (make-counter) (let ([n 0]) (lambda () (begin (set! n (+ n 1)) n))))"
+                         "(define counter (make-counter))"
+                         "(counter) (counter)"
+                         "(define names '(\"ada\" \"grace\" \"barbara\"))"
+                         "(define (total l) (if (nil? l) 0 (+ (string-length (car l)) (total (cdr l)))))"
+                         "(defmacro (twice x) `(begin ,x ,x))"
+                         "(define apply-scaled (lambda (x) (scaled x)))");
+            rt.save_snapshot(path);
+        }
+
+        // builtins come from the runtime that loads the snapshot
+        {
+            runtime rt{64 * 1024, false, mode};
+            bool    threw = false;
+            try {
+                rt.load_snapshot(path);
+            } catch(const std::runtime_error&) { threw = true; }
+            assert(threw);
+        }
+
+        int     other = 5;
+        runtime rt{64 * 1024, true, mode};
+        // symbols get different indices than in the runtime that saved the snapshot
+        rt.symbol("something-else");
+        rt.define_fn("scaled", scaled, &other);
+        rt.load_snapshot(path);
+
+        // the state carries on where it was saved
+        assert(to_int(rt.eval(rt.read("(counter)"))) == 3);
+        assert(to_int(rt.eval(rt.read("(total names)"))) == 15);
+        assert(to_int(rt.eval(rt.read("(apply-scaled 2)"))) == 10);
+        rt.eval_file("(define c2 (make-counter)) (twice (c2))");
+        assert(to_int(rt.eval(rt.read("(c2)"))) == 3);
+        // functions made before the save are found from their bodies, so closures made again from
+        // the same form share them
+        assert(closure_function(rt.global("counter")) == closure_function(rt.global("c2")));
+
+        // and survives collections
+        rt.collect_garbage(nullptr, true);
+        while(!rt.collect_garbage_step(64)) {}
+        rt.collect_garbage();
+        assert(to_int(rt.eval(rt.read("(counter)"))) == 4);
+        assert(to_int(rt.eval(rt.read("(total names)"))) == 15);
+
+        // C++ values can't be saved
+        rt.define_global("held", rt.make_owned_extern<thing>(thing{1}));
+        bool threw = false;
+        try {
+            rt.save_snapshot(path);
+        } catch(const std::runtime_error&) { threw = true; }
+        assert(threw);
+    }
+    std::remove(path.c_str());
+    return 0;
+}
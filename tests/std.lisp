@@ -49,9 +49,22 @@
 
 (assert! (equal? (append '(1 2 3) 4) '(1 2 3 4)))
 
+(assert! (equal? #(1 (2 #(3))) (vector 1 '(2 #(3)))))
+(assert! (not (equal? #(1 2) #(1 2 3))))
+(assert! (not (equal? #(1 2) '(1 2))))
+(assert! (equal? (cons #vec2(1 2) #n) (cons (vec2 1 2) #n)))
+(assert! (not (equal? #vec2(1 2) #vec3(1 2 0))))
+(assert! (equal? (cons "ada" #n) (cons (symbol->string 'ada) #n)))
+(assert! (not (equal? "ada" "adb")))
+(assert! (not (equal? "ada" 'ada)))
+
 (assert! (equal? (map (lambda (x) x) '(1 2)) '(1 2)))
 
 (assert! (equal? (map (lambda (x) 'z) '(1 2)) '(z z)))
 
 (assert! (equal? (fold (lambda (a b) (cons a b)) #n '(1 2 3)) '(1 2 3)))
 
+(define (square x) (* x x))
+(assert-eq! (touch (future (square 4))) 16)
+(assert-eq! (touch 5) 5)
+(assert! (equal? (pmap square '(1 2 3)) '(1 4 9)))
@@ -0,0 +1,40 @@
+#include <emlisp.h>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace emlisp;
+
+int main() {
+    runtime rt{64 * 1024};
+
+    // interning many symbols keeps every one of them distinct and findable
+    std::vector<value> syms;
+    for(int i = 0; i < 50000; ++i)
+        syms.push_back(rt.symbol("sym-" + std::to_string(i)));
+    for(int i = 0; i < 50000; ++i) {
+        auto name = "sym-" + std::to_string(i);
+        assert(rt.symbol(name) == syms[i]);
+        assert(rt.symbol_str(syms[i]) == name);
+    }
+    assert(rt.read("quote") == rt.read("quote"));
+    std::cout << "0\n";
+
+    // unique symbols share their name but are never found by it
+    value x = rt.symbol("x");
+    value u = rt.eval(rt.read("(unique-symbol x)"));
+    assert(u != x && rt.symbol_str(u) == "x");
+    assert(rt.symbol("x") == x);
+    assert(rt.symbol("y") != u);
+    std::cout << "1\n";
+
+    // a large source interns each name once
+    std::string src = "(begin";
+    for(int i = 0; i < 20000; ++i)
+        src += " (define v" + std::to_string(i) + " " + std::to_string(i) + ")";
+    src += ")";
+    rt.eval(rt.read(src));
+    assert(to_int(rt.eval(rt.read("v12345"))) == 12345);
+    std::cout << "2\n";
+
+    return 0;
+}